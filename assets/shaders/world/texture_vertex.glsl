@@ -19,11 +19,11 @@ vec4 voxel(vec3 coord) {
 	float y = round(coord.y) + 1.0;
 	float z = round(coord.z) + 1.0;
 	
-	float x0 = mod(y, 5.0) / 5.0;
-	float y0 = floor(y / 5.0) / 5.0;
+	float x0 = mod(y, CHUNK_TEXTURE_GRID_SIZE) / CHUNK_TEXTURE_GRID_SIZE;
+	float y0 = floor(y / CHUNK_TEXTURE_GRID_SIZE) / CHUNK_TEXTURE_GRID_SIZE;
 	return texture2D(
 		chunkTexture,
-		vec2(x0 + (x + 0.5) / (5.0 * 18.0), y0 + (z + 0.5) / (5.0 * 18.0))
+		vec2(x0 + (x + 0.5) / CHUNK_TEXTURE_SIZE, y0 + (z + 0.5) / CHUNK_TEXTURE_SIZE)
 	);
 }
 
@@ -0,0 +1,76 @@
+/*
+ * Measures VoxelWorld lookup throughput of already loaded chunks with 1-16 threads doing random shared and extended
+ * lookups, as network threads, the updater and the light computer do.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include <easylogging++.h>
+#include "world/VoxelWorld.h"
+
+INITIALIZE_EASYLOGGINGPP
+
+static const int AREA_RADIUS = 8;
+static const int AREA_HEIGHT = 4;
+static const auto RUN_TIME = std::chrono::milliseconds(500);
+
+static unsigned long run(VoxelWorld &world, int threadCount) {
+	std::atomic<bool> running = true;
+	std::atomic<unsigned long> lookups = 0;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; t++) {
+		threads.emplace_back([&world, &running, &lookups, t]() {
+			std::default_random_engine engine(t);
+			std::uniform_int_distribution<int> horizontal(-AREA_RADIUS, AREA_RADIUS - 1);
+			std::uniform_int_distribution<int> vertical(0, AREA_HEIGHT - 1);
+			unsigned long count = 0;
+			while (running) {
+				VoxelChunkLocation location(horizontal(engine), vertical(engine), horizontal(engine));
+				if (count % 4 == 0) {
+					auto chunk = world.extendedChunk(location);
+				} else {
+					auto chunk = world.chunk(location);
+				}
+				count++;
+			}
+			lookups += count;
+		});
+	}
+	std::this_thread::sleep_for(RUN_TIME);
+	running = false;
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	return lookups;
+}
+
+int main(int argc, char **argv) {
+	START_EASYLOGGINGPP(argc, argv);
+	{
+		el::Configurations conf;
+		conf.setGlobally(el::ConfigurationType::Enabled, "false");
+		el::Loggers::setDefaultConfigurations(conf, true);
+	}
+	
+	VoxelWorld world;
+	for (int z = -AREA_RADIUS; z < AREA_RADIUS; z++) {
+		for (int y = 0; y < AREA_HEIGHT; y++) {
+			for (int x = -AREA_RADIUS; x < AREA_RADIUS; x++) {
+				world.chunk({x, y, z}, VoxelWorld::MissingChunkPolicy::CREATE);
+			}
+		}
+	}
+	
+	std::cout << "chunks:  " << world.chunkCount() << ", shards: " << VoxelWorld::CHUNK_SHARD_COUNT << std::endl;
+	for (int threadCount = 1; threadCount <= 16; threadCount *= 2) {
+		auto lookups = run(world, threadCount);
+		auto perSecond = (double) lookups / std::chrono::duration<double>(RUN_TIME).count();
+		std::cout << "threads: " << threadCount << ", lookups/s: " << (unsigned long) perSecond << std::endl;
+	}
+	
+	return EXIT_SUCCESS;
+}
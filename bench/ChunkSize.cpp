@@ -0,0 +1,127 @@
+/*
+ * Reports the per-area cost of the chunk size this binary was built with. Build it with different VOXEL_CHUNK_SIZE
+ * values (or VOXEL_CHUNK_SIZE_VARIANTS) and compare the output.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <easylogging++.h>
+#include "Asset.h"
+#include "world/VoxelTypeRegistry.h"
+#include "world/VoxelTypes.h"
+#include "world/VoxelWorld.h"
+#include "world/VoxelChunkNeighborhood.h"
+
+INITIALIZE_EASYLOGGINGPP
+
+// Loaded area around the player in voxels, matches a wide view deployment
+static const int AREA_RADIUS = 128;
+static const int AREA_BOTTOM = -64;
+static const int AREA_TOP = 64;
+
+static int surfaceHeight(int x, int z) {
+	return (int) roundf(6.0f * sinf((float) x / 23.0f) + 4.0f * cosf((float) z / 17.0f));
+}
+
+static void generate(VoxelChunkMutableRef &chunk, VoxelTypeRegistry &registry) {
+	auto &air = registry.get("air");
+	auto &grass = registry.get("grass");
+	auto &dirt = registry.get("dirt");
+	auto &stone = registry.get("stone");
+	chunk.setUniform(VoxelHolder(air));
+	for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
+		for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
+			VoxelLocation column(chunk.location(), {x, 0, z});
+			int surface = surfaceHeight(column.x, column.z) - column.y;
+			if (surface < 0) continue;
+			int top = std::min(surface, VOXEL_CHUNK_SIZE - 1);
+			chunk.fill({x, 0, z}, {x, top, z}, VoxelHolder(stone), false);
+			if (surface - 3 < VOXEL_CHUNK_SIZE) {
+				chunk.fill({x, std::max(surface - 3, 0), z}, {x, top, z}, VoxelHolder(dirt), false);
+			}
+			if (surface < VOXEL_CHUNK_SIZE) {
+				chunk.fill({x, surface, z}, {x, surface, z}, VoxelHolder(grass), false);
+			}
+		}
+	}
+	chunk.compact();
+}
+
+int main(int argc, char **argv) {
+	START_EASYLOGGINGPP(argc, argv);
+	{
+		el::Configurations conf;
+		conf.setGlobally(el::ConfigurationType::Enabled, "false");
+		el::Loggers::setDefaultConfigurations(conf, true);
+	}
+	
+	AssetLoader assetLoader(".");
+	VoxelTypeRegistry registry(assetLoader);
+	registerVoxelTypes(registry, assetLoader);
+	VoxelTypeSerializationContext serializationContext(registry);
+	VoxelWorld world;
+	
+	auto from = VoxelLocation(-AREA_RADIUS, AREA_BOTTOM, -AREA_RADIUS).chunk();
+	auto to = VoxelLocation(AREA_RADIUS - 1, AREA_TOP - 1, AREA_RADIUS - 1).chunk();
+	std::vector<VoxelChunkLocation> locations;
+	for (int z = from.z; z <= to.z; z++) {
+		for (int y = from.y; y <= to.y; y++) {
+			for (int x = from.x; x <= to.x; x++) {
+				locations.emplace_back(x, y, z);
+			}
+		}
+	}
+	
+	auto generateStart = std::chrono::steady_clock::now();
+	for (auto &location : locations) {
+		auto chunk = world.mutableChunk(location, VoxelWorld::MissingChunkPolicy::CREATE);
+		generate(chunk, registry);
+	}
+	auto generateEnd = std::chrono::steady_clock::now();
+	
+	size_t memory = 0, messageBytes = 0, extendedLocks = 0;
+	std::string buffer;
+	for (auto &location : locations) {
+		auto chunk = world.chunk(location);
+		memory += sizeof(SharedVoxelChunk) + chunk.memoryUsage();
+		VoxelSerializer serializer(serializationContext, buffer);
+		serializer.object(location);
+		serializer.object(chunk);
+		messageBytes += serializer.adapter().currentWritePos();
+	}
+	
+	// Every chunk meshed once: the extended lock takes the chunk itself and each loaded neighbor
+	static VoxelChunkNeighborhood neighborhood;
+	auto meshStart = std::chrono::steady_clock::now();
+	for (auto &location : locations) {
+		auto chunk = world.extendedChunk(location);
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					extendedLocks += dx == 0 && dy == 0 && dz == 0 ? 1 : chunk.hasNeighbor(dx, dy, dz);
+				}
+			}
+		}
+		neighborhood.build(chunk);
+	}
+	auto meshEnd = std::chrono::steady_clock::now();
+	
+	auto milliseconds = [](auto duration) {
+		return std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / 1000.0;
+	};
+	auto voxels = (size_t) locations.size() * VOXEL_CHUNK_VOLUME;
+	std::cout << "chunk size:                " << VOXEL_CHUNK_SIZE << std::endl;
+	std::cout << "loaded area (voxels):      " << 2 * AREA_RADIUS << "x" << AREA_TOP - AREA_BOTTOM << "x" <<
+		2 * AREA_RADIUS << " (" << voxels << " loaded)" << std::endl;
+	std::cout << "chunks / SET_CHUNK msgs:   " << locations.size() << std::endl;
+	std::cout << "SET_CHUNK bytes:           " << messageBytes << std::endl;
+	std::cout << "chunk memory (bytes):      " << memory << " (" << (double) memory / (double) voxels <<
+		" per voxel)" << std::endl;
+	std::cout << "locks per area mesh pass:  " << extendedLocks << std::endl;
+	std::cout << "voxels locked per edit:    " << 27 * VOXEL_CHUNK_VOLUME << std::endl;
+	std::cout << "generate time (ms):        " << milliseconds(generateEnd - generateStart) << std::endl;
+	std::cout << "neighborhood pass (ms):    " << milliseconds(meshEnd - meshStart) << std::endl;
+	
+	return EXIT_SUCCESS;
+}
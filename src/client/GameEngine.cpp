@@ -28,6 +28,9 @@ GameEngine::~GameEngine() {
 	if (m_transport) {
 		m_transport->shutdown();
 	}
+	if (m_voxelWorld) {
+		m_voxelWorld->shutdownChunkEvents();
+	}
 	s_instance = nullptr;
 }
 
@@ -190,7 +193,7 @@ void GameEngine::updateDebugInfo() {
 	{
 		auto chunk = m_voxelWorld->chunk(playerChunkLocation);
 		if (chunk) {
-			lightLevel = chunk.at(playerLocation.inChunk()).lightLevel();
+			lightLevel = chunk.lightLevel(playerLocation.inChunk());
 		}
 	}
 	auto playerInChunkLocation = playerLocation.inChunk();
@@ -365,13 +368,16 @@ void GameEngine::setTransport(std::unique_ptr<ClientTransport> transport) {
 	m_transport->start();
 }
 
-void GameEngine::chunkUnlocked(const VoxelChunkLocation &chunkLocation, VoxelChunkLightState lightState) {
-	if (lightState != VoxelChunkLightState::READY) return;
-	m_voxelWorldRenderer->invalidate(chunkLocation);
-	m_voxelWorldRenderer->invalidate({chunkLocation.x - 1, chunkLocation.y, chunkLocation.z});
-	m_voxelWorldRenderer->invalidate({chunkLocation.x, chunkLocation.y - 1, chunkLocation.z});
-	m_voxelWorldRenderer->invalidate({chunkLocation.x, chunkLocation.y, chunkLocation.z - 1});
-	m_voxelWorldRenderer->invalidate({chunkLocation.x + 1, chunkLocation.y, chunkLocation.z});
-	m_voxelWorldRenderer->invalidate({chunkLocation.x, chunkLocation.y + 1, chunkLocation.z});
-	m_voxelWorldRenderer->invalidate({chunkLocation.x, chunkLocation.y, chunkLocation.z + 1});
+void GameEngine::chunkEvents(std::span<const VoxelChunkEvent> events) {
+	for (auto &event : events) {
+		if (!(event.types & VoxelChunkEvent::LIGHT_READY)) continue;
+		auto &chunkLocation = event.location;
+		m_voxelWorldRenderer->invalidate(chunkLocation);
+		m_voxelWorldRenderer->invalidate({chunkLocation.x - 1, chunkLocation.y, chunkLocation.z});
+		m_voxelWorldRenderer->invalidate({chunkLocation.x, chunkLocation.y - 1, chunkLocation.z});
+		m_voxelWorldRenderer->invalidate({chunkLocation.x, chunkLocation.y, chunkLocation.z - 1});
+		m_voxelWorldRenderer->invalidate({chunkLocation.x + 1, chunkLocation.y, chunkLocation.z});
+		m_voxelWorldRenderer->invalidate({chunkLocation.x, chunkLocation.y + 1, chunkLocation.z});
+		m_voxelWorldRenderer->invalidate({chunkLocation.x, chunkLocation.y, chunkLocation.z + 1});
+	}
 }
@@ -68,7 +68,7 @@ class GameEngine: VoxelChunkListener {
 	
 	std::unique_ptr<ClientTransport> m_transport;
 	
-	void chunkUnlocked(const VoxelChunkLocation &chunkLocation, VoxelChunkLightState lightState) override;
+	void chunkEvents(std::span<const VoxelChunkEvent> events) override;
 
 protected:
 	virtual bool platformInit() = 0;
@@ -190,6 +190,18 @@ GL::Shader::Shader(unsigned int type, Asset asset): Shader(
 ) {
 }
 
+GL::Shader::Shader(unsigned int type, Asset asset, const std::string &defines): Shader(type, asset.fileName(), [&]() {
+	std::string source(asset.data(), asset.dataSize());
+	size_t pos = 0;
+	if (source.rfind("#version", 0) == 0) {
+		pos = source.find('\n');
+		pos = pos == std::string::npos ? source.size() : pos + 1;
+	}
+	source.insert(pos, defines);
+	return source;
+}()) {
+}
+
 GL::Shader::Shader(
 		unsigned int type,
 		std::string name,
@@ -95,6 +95,8 @@ namespace GL {
 		
 	public:
 		Shader(unsigned int type, Asset asset);
+		// Inserts the defines after the #version directive
+		Shader(unsigned int type, Asset asset, const std::string &defines);
 		Shader(unsigned int type, std::string name, const std::string &source);
 		Shader(Shader &&shader) noexcept;
 		Shader &operator=(Shader &&shader) noexcept;
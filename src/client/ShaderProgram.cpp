@@ -3,6 +3,7 @@
 #include "ShaderProgram.h"
 #include "OpenGL.h"
 #include "Asset.h"
+#include "world/VoxelWorldRenderer.h"
 
 CommonShaderProgram::CommonShaderProgram(
 		std::string name,
@@ -93,7 +94,12 @@ CommonShaderPrograms::CommonShaderPrograms(AssetLoader &loader): ui {
 }, world {
 	{
 		"world:texture", {
-			GL::Shader(GL_VERTEX_SHADER, loader.load("assets/shaders/world/texture_vertex.glsl")),
+			GL::Shader(
+					GL_VERTEX_SHADER,
+					loader.load("assets/shaders/world/texture_vertex.glsl"),
+					"#define CHUNK_TEXTURE_GRID_SIZE " + std::to_string(VOXEL_CHUNK_TEXTURE_GRID_SIZE) + ".0\n"
+					"#define CHUNK_TEXTURE_SIZE " + std::to_string(VOXEL_CHUNK_TEXTURE_SIZE) + ".0\n"
+			),
 			GL::Shader(GL_FRAGMENT_SHADER, loader.load("assets/shaders/world/texture_fragment.glsl"))
 		}
 	}
@@ -22,6 +22,12 @@ void BinaryClientTransport::handleMessage(const std::string &payload) {
 		case ServerMessageType::SET_VOXEL_TYPES: {
 			ServerMessage<ServerMessageData::SetVoxelTypes> msg({m_voxelTypeSerializationContext});
 			deserialize(payload, msg);
+			if (msg.data.chunkSize != VOXEL_CHUNK_SIZE) {
+				LOG(ERROR) << "Server uses chunk size " << msg.data.chunkSize << ", but the client was built with " <<
+					VOXEL_CHUNK_SIZE;
+				disconnect("Incompatible chunk size");
+				return;
+			}
 			auto names = m_voxelTypeSerializationContext.names();
 			for (size_t i = 0; i < names.size(); i++) {
 				LOG(INFO) << "Received \"" << names[i] << "\" voxel type (id " << i << ") from the server";
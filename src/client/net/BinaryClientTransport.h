@@ -29,6 +29,8 @@ protected:
 	void handleMessage(const std::string &payload);
 	
 	virtual void sendMessage(const void *data, size_t dataSize) = 0;
+	// Closes the connection from the message handler, messages received afterwards are dropped
+	virtual void disconnect(const std::string &reason) = 0;
 	
 	using ClientTransport::sendPlayerPosition;
 
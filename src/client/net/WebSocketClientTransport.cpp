@@ -24,6 +24,7 @@ void WebSocketClientTransport::start() {
 	connection->set_open_handler([this] (auto connection) { handleOpen(); });
 	connection->set_close_handler([this] (auto connection) { handleClose(); });
 	connection->set_message_handler([this] (auto connection, WebSocketClient::message_ptr message) {
+		if (!m_connected) return;
 		handleMessage(message->get_payload());
 	});
 	m_client.connect(connection);
@@ -63,7 +64,9 @@ void WebSocketClientTransport::start() {
 			m_socket,
 			this,
 			[] (int eventType, const EmscriptenWebSocketMessageEvent *websocketEvent, void *userData) {
-				static_cast<WebSocketClientTransport*>(userData)->handleMessage(
+				auto transport = static_cast<WebSocketClientTransport*>(userData);
+				if (!transport->m_connected) return EM_TRUE;
+				transport->handleMessage(
 						std::string((const char*) websocketEvent->data, websocketEvent->numBytes)
 				);
 				return EM_TRUE;
@@ -90,6 +93,19 @@ void WebSocketClientTransport::shutdown() {
 #endif
 }
 
+void WebSocketClientTransport::disconnect(const std::string &reason) {
+	if (!m_connected.exchange(false)) return;
+#ifndef __EMSCRIPTEN__
+	std::error_code errorCode;
+	m_client.close(m_connection, websocketpp::close::status::protocol_error, reason, errorCode);
+	if (errorCode) {
+		LOG(ERROR) << "WebSocket close error: " << errorCode.message();
+	}
+#else
+	emscripten_websocket_close(m_socket, 1002, reason.c_str());
+#endif
+}
+
 void WebSocketClientTransport::handleError() {
 	LOG(ERROR) << "WebSocket error";
 	m_connected = false;
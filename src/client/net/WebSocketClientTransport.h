@@ -38,6 +38,7 @@ class WebSocketClientTransport: public BinaryClientTransport {
 	void handleError();
 	void handleClose();
 	void sendMessage(const void *data, size_t dataSize) override;
+	void disconnect(const std::string &reason) override;
 	
 public:
 	WebSocketClientTransport(GameEngine &engine, std::string url);
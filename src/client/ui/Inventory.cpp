@@ -166,13 +166,13 @@ void InventoryItem::updateTexture() {
 
 void InventoryItem::setVoxel(const VoxelHolder &voxel) {
 	m_voxel = voxel;
-	m_voxel.setLightLevel(MAX_VOXEL_LIGHT_LEVEL);
+	m_voxel.setLight(VoxelLight::fullSky());
 	updateTexture();
 }
 
 void InventoryItem::setVoxel(VoxelHolder &&voxel) {
 	m_voxel = std::move(voxel);
-	m_voxel.setLightLevel(MAX_VOXEL_LIGHT_LEVEL);
+	m_voxel.setLight(VoxelLight::fullSky());
 	updateTexture();
 }
 
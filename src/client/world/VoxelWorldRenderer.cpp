@@ -47,10 +47,6 @@ void VoxelWorldRenderer::buildInvalidated(const glm::vec3 &playerPosition) {
 	} while (location.has_value() && !build(*location));
 }
 
-constexpr int VoxelWorldRenderer::shaderProviderPriority(const VoxelShaderProvider *shaderProvider) {
-	return shaderProvider != nullptr ? shaderProvider->priority() : INT_MIN;
-}
-
 constexpr float VoxelWorldRenderer::convertLightLevel(VoxelLightLevel level) {
 	return std::max(std::min((float) level / MAX_VOXEL_LIGHT_LEVEL, 1.0f), 0.05f);
 }
@@ -60,34 +56,35 @@ void VoxelWorldRenderer::build(
 		const InChunkVoxelLocation &location,
 		std::unordered_map<const VoxelShaderProvider*, std::vector<float>> &parts
 ) {
-	auto &cur = chunk.at(location);
-	auto shaderProvider = cur.shaderProvider();
-	auto curPriority = shaderProviderPriority(shaderProvider);
+	int i = VoxelChunkNeighborhood::index(location);
+	auto &cur = m_neighborhood[i];
+	auto curPriority = cur.priority;
 	if (curPriority < 0) return;
 	
-	auto &prevX = chunk.extendedAt({location.x - 1, location.y, location.z});
-	auto &prevY = chunk.extendedAt({location.x, location.y - 1, location.z});
-	auto &prevZ = chunk.extendedAt({location.x, location.y, location.z - 1});
+	auto &prevX = m_neighborhood[i + VoxelChunkNeighborhood::offset(-1, 0, 0)];
+	auto &prevY = m_neighborhood[i + VoxelChunkNeighborhood::offset(0, -1, 0)];
+	auto &prevZ = m_neighborhood[i + VoxelChunkNeighborhood::offset(0, 0, -1)];
 
-	auto &nextX = chunk.extendedAt({location.x + 1, location.y, location.z});
-	auto &nextY = chunk.extendedAt({location.x, location.y + 1, location.z});
-	auto &nextZ = chunk.extendedAt({location.x, location.y, location.z + 1});
+	auto &nextX = m_neighborhood[i + VoxelChunkNeighborhood::offset(1, 0, 0)];
+	auto &nextY = m_neighborhood[i + VoxelChunkNeighborhood::offset(0, 1, 0)];
+	auto &nextZ = m_neighborhood[i + VoxelChunkNeighborhood::offset(0, 0, 1)];
 
-	auto prevXPriority = shaderProviderPriority(prevX.shaderProvider());
-	auto prevYPriority = shaderProviderPriority(prevY.shaderProvider());
-	auto prevZPriority = shaderProviderPriority(prevZ.shaderProvider());
+	auto prevXPriority = prevX.priority;
+	auto prevYPriority = prevY.priority;
+	auto prevZPriority = prevZ.priority;
 	
-	auto nextXPriority = shaderProviderPriority(nextX.shaderProvider());
-	auto nextYPriority = shaderProviderPriority(nextY.shaderProvider());
-	auto nextZPriority = shaderProviderPriority(nextZ.shaderProvider());
+	auto nextXPriority = nextX.priority;
+	auto nextYPriority = nextY.priority;
+	auto nextZPriority = nextZ.priority;
 	
 	if (
 			curPriority == nextXPriority && curPriority == nextYPriority && curPriority == nextZPriority &&
 			curPriority == prevXPriority && curPriority == prevYPriority && curPriority == prevZPriority
 	) return;
 	
+	auto shaderProvider = cur.voxel->shaderProvider();
 	m_vertexDataBuffer.clear();
-	cur.buildVertexData(chunk, location, m_vertexDataBuffer);
+	cur.voxel->buildVertexData(chunk, location, m_vertexDataBuffer);
 	
 	auto it = parts.find(shaderProvider);
 	if (it == parts.end()) {
@@ -107,29 +104,29 @@ void VoxelWorldRenderer::build(
 
 		if (almostEqual(v0.x, v1.x) && almostEqual(v1.x, v2.x)) {
 			if (almostEqual(v0.x , -0.5f)) {
-				if (&prevX.type() == &EmptyVoxelType::INSTANCE) continue;
+				if (prevX.empty()) continue;
 				if (prevXPriority >= curPriority) continue;
 			} else if (almostEqual(v0.x, 0.5f)) {
-				if (&nextX.type() == &EmptyVoxelType::INSTANCE) continue;
+				if (nextX.empty()) continue;
 				if (nextXPriority >= curPriority) continue;
 			}
 		}
 		if (almostEqual(v0.y, v1.y) && almostEqual(v1.y, v2.y)) {
 			if (almostEqual(v0.y , -0.5f)) {
-				if (&prevY.type() == &EmptyVoxelType::INSTANCE) continue;
+				if (prevY.empty()) continue;
 				if (prevYPriority >= curPriority) continue;
 			} else if (almostEqual(v0.y, 0.5f)) {
-				if (&nextY.type() == &EmptyVoxelType::INSTANCE) continue;
+				if (nextY.empty()) continue;
 				if (nextYPriority >= curPriority) continue;
 			}
 		}
 		if (almostEqual(v0.z, v1.z) && almostEqual(v1.z, v2.z)) {
 			if (almostEqual(v0.z , -0.5f)) {
-				if (&prevZ.type() == &EmptyVoxelType::INSTANCE) continue;
-				if (prevZPriority >= curPriority && &prevZ.type() != &EmptyVoxelType::INSTANCE) continue;
+				if (prevZ.empty()) continue;
+				if (prevZPriority >= curPriority) continue;
 			} else if (almostEqual(v0.z, 0.5f)) {
-				if (&nextZ.type() == &EmptyVoxelType::INSTANCE) continue;
-				if (nextZPriority >= curPriority && &nextZ.type() != &EmptyVoxelType::INSTANCE) continue;
+				if (nextZ.empty()) continue;
+				if (nextZPriority >= curPriority) continue;
 			}
 		}
 		
@@ -142,22 +139,23 @@ void VoxelWorldRenderer::build(
 	}
 }
 
-void VoxelWorldRenderer::buildTexturePixel(VoxelChunkMesh &mesh, int x, int y, int z, const VoxelHolder &voxel) {
-	int x0 = ((y + 1) % 5) * (VOXEL_CHUNK_SIZE + 2);
-	int y0 = ((y + 1) / 5) * (VOXEL_CHUNK_SIZE + 2);
-	int i = ((y0 + (z + 1)) * 5 * (VOXEL_CHUNK_SIZE + 2) + (x0 + (x + 1))) * 4;
+void VoxelWorldRenderer::buildTexturePixel(VoxelChunkMesh &mesh, int x, int y, int z, VoxelLight light) {
+	int x0 = ((y + 1) % VOXEL_CHUNK_TEXTURE_GRID_SIZE) * VOXEL_CHUNK_TEXTURE_SLICE_SIZE;
+	int y0 = ((y + 1) / VOXEL_CHUNK_TEXTURE_GRID_SIZE) * VOXEL_CHUNK_TEXTURE_SLICE_SIZE;
+	int i = ((y0 + (z + 1)) * VOXEL_CHUNK_TEXTURE_SIZE + (x0 + (x + 1))) * 4;
 	assert((i + 4) <= mesh.textureData.size());
-	mesh.textureData[i + 0] = (int) (convertLightLevel(voxel.lightLevel()) * 255); // R
-	mesh.textureData[i + 1] = 0; // G
-	mesh.textureData[i + 2] = 0; // B
+	mesh.textureData[i + 0] = (int) (convertLightLevel(light.level()) * 255); // R
+	mesh.textureData[i + 1] = light.sky() * 255 / VoxelLight::MAX_LEVEL; // G
+	mesh.textureData[i + 2] = light.block() * 255 / VoxelLight::MAX_LEVEL; // B
 	mesh.textureData[i + 3] = 255; // A
 }
 
-void VoxelWorldRenderer::buildTexture(const VoxelChunkExtendedRef &chunk, VoxelChunkMesh &mesh) {
+void VoxelWorldRenderer::buildTexture(const VoxelChunkNeighborhood &neighborhood, VoxelChunkMesh &mesh) {
+	int i = 0;
 	for (int z = -1; z <= VOXEL_CHUNK_SIZE; z++) {
 		for (int y = -1; y <= VOXEL_CHUNK_SIZE; y++) {
 			for (int x = -1; x <= VOXEL_CHUNK_SIZE; x++) {
-				buildTexturePixel(mesh, x, y, z, chunk.extendedAt(x, y, z));
+				buildTexturePixel(mesh, x, y, z, neighborhood[i++].light);
 			}
 		}
 	}
@@ -170,11 +168,27 @@ bool VoxelWorldRenderer::build(const VoxelChunkLocation &location, VoxelChunkMes
 	for (auto &&part : mesh.parts) {
 		part.second.clear();
 	}
-	buildTexture(chunk, mesh);
-	for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
-		for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
-			for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
-				build(chunk, {x, y, z}, mesh.parts);
+	// Voxel types look at their neighbors through extendedAt() while building vertex data, serve them from the snapshot too
+	m_neighborhood.build(chunk);
+	chunk.attachNeighborhood(&m_neighborhood);
+	buildTexture(m_neighborhood, mesh);
+	// Inner voxels of a uniform chunk are always hidden by their neighbors
+	bool uniform = chunk.uniform();
+	if (!uniform || chunk.at(0, 0, 0).shaderProviderPriority() >= 0) {
+		// Same for opaque voxels surrounded by opaque voxels
+		auto hidden = chunk.opaqueMask().interior();
+		for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
+			for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
+				for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
+					if (
+							uniform &&
+							x > 0 && x < VOXEL_CHUNK_SIZE - 1 &&
+							y > 0 && y < VOXEL_CHUNK_SIZE - 1 &&
+							z > 0 && z < VOXEL_CHUNK_SIZE - 1
+					) continue;
+					if (hidden.test(VoxelChunk::voxelIndex(x, y, z))) continue;
+					build(chunk, {x, y, z}, mesh.parts);
+				}
 			}
 		}
 	}
@@ -236,11 +250,7 @@ GL::Texture VoxelWorldRenderer::allocateTexture() {
 		m_textures.erase(it);
 		return texture;
 	}
-	return GL::Texture(
-			5 * (VOXEL_CHUNK_SIZE + 2),
-			5 * (VOXEL_CHUNK_SIZE + 2),
-			false
-	);
+	return GL::Texture(VOXEL_CHUNK_TEXTURE_SIZE, VOXEL_CHUNK_TEXTURE_SIZE, false);
 }
 
 void VoxelWorldRenderer::freeTexture(GL::Texture &&texture) {
@@ -475,16 +485,16 @@ void VoxelWorldRenderer::saveChunkTexture(const glm::vec3 &playerPosition) {
 	}
 	LOG(INFO) << "Saving the texture for chunk x=" << l.x << ",y=" << l.y << ",z=" << l.z;
 	std::unique_lock<std::mutex> lock(it->second->mutex);
-	std::array<uint8_t, (5 * (VOXEL_CHUNK_SIZE + 2) * 5 * (VOXEL_CHUNK_SIZE + 2)) * 4> buffer;
+	std::array<uint8_t, VOXEL_CHUNK_TEXTURE_SIZE * VOXEL_CHUNK_TEXTURE_SIZE * 4> buffer;
 	it->second->texture->bind();
 	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, buffer.data());
 	stbi_write_png(
 			"chunk_texture.png",
-			5 * (VOXEL_CHUNK_SIZE + 2),
-			5 * (VOXEL_CHUNK_SIZE + 2),
+			VOXEL_CHUNK_TEXTURE_SIZE,
+			VOXEL_CHUNK_TEXTURE_SIZE,
 			4,
 			buffer.data(),
-			5 * 18 * 4
+			VOXEL_CHUNK_TEXTURE_SIZE * 4
 	);
 #endif
 }
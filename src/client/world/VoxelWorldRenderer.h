@@ -11,12 +11,24 @@
 #include <glm/mat4x4.hpp>
 #include "world/Voxel.h"
 #include "world/VoxelLocation.h"
+#include "world/VoxelChunkNeighborhood.h"
 #include "PerformanceCounter.h"
 
 class VoxelShaderProvider;
 class VoxelWorld;
 class VoxelChunkExtendedRef;
 
+// The light texture keeps VOXEL_CHUNK_SIZE + 2 padded XZ slices laid out in a square grid
+static constexpr int VOXEL_CHUNK_TEXTURE_SLICE_SIZE = VOXEL_CHUNK_SIZE + 2;
+static constexpr int VOXEL_CHUNK_TEXTURE_GRID_SIZE = [] {
+	int size = 1;
+	while (size * size < VOXEL_CHUNK_TEXTURE_SLICE_SIZE) {
+		size++;
+	}
+	return size;
+}();
+static constexpr int VOXEL_CHUNK_TEXTURE_SIZE = VOXEL_CHUNK_TEXTURE_GRID_SIZE * VOXEL_CHUNK_TEXTURE_SLICE_SIZE;
+
 struct VoxelMeshPart {
 	GL::Buffer buffer;
 	unsigned int vertexCount;
@@ -24,7 +36,7 @@ struct VoxelMeshPart {
 
 struct VoxelChunkMesh {
 	std::unordered_map<const VoxelShaderProvider*, std::vector<float>> parts;
-	std::array<uint8_t, (5 * (VOXEL_CHUNK_SIZE + 2) * 5 * (VOXEL_CHUNK_SIZE + 2)) * 4> textureData;
+	std::array<uint8_t, VOXEL_CHUNK_TEXTURE_SIZE * VOXEL_CHUNK_TEXTURE_SIZE * 4> textureData;
 	std::atomic<bool> valid = false;
 	std::mutex mutex;
 	std::unordered_map<const VoxelShaderProvider*, VoxelMeshPart> buffers;
@@ -45,6 +57,7 @@ class VoxelWorldRenderer {
 	std::unordered_map<VoxelChunkLocation, std::unique_ptr<VoxelChunkMesh>> m_meshes;
 	std::shared_mutex m_meshesMutex;
 	std::vector<VoxelVertexData> m_vertexDataBuffer;
+	VoxelChunkNeighborhood m_neighborhood;
 	std::vector<GL::Buffer> m_buffers;
 	std::vector<GL::Texture> m_textures;
 	std::vector<VoxelChunkRenderStep> m_renderSchedule;
@@ -52,17 +65,16 @@ class VoxelWorldRenderer {
 	PerformanceCounter m_renderPerformanceCounter;
 	
 	std::optional<VoxelChunkLocation> getInvalidated(const glm::vec3 &playerPosition);
-	constexpr static int shaderProviderPriority(const VoxelShaderProvider *shaderProvider);
 	constexpr static float convertLightLevel(VoxelLightLevel level);
 	static void buildTexturePixel(
 			VoxelChunkMesh &mesh,
 			int x,
 			int y,
 			int z,
-			const VoxelHolder &voxel
+			VoxelLight light
 	);
 	static void buildTexture(
-			const VoxelChunkExtendedRef &chunk,
+			const VoxelChunkNeighborhood &neighborhood,
 			VoxelChunkMesh &mesh
 	);
 	void build(
@@ -51,9 +51,12 @@ namespace ServerMessageData {
 		static const ServerMessageType TYPE = ServerMessageType::SET_VOXEL_TYPES;
 		
 		VoxelTypeSerializationContext &voxelSerializationContext;
+		// Chunk data is only meaningful to peers built with the same chunk size
+		uint16_t chunkSize = VOXEL_CHUNK_SIZE;
 		
 		template<typename S> void serialize(S &s) {
 			s.object(voxelSerializationContext);
+			s.value2b(chunkSize);
 		}
 	};
 	
@@ -7,12 +7,13 @@ GameServerEngine::GameServerEngine(
 	m_voxelTypesRegistration(m_voxelTypeRegistry, m_assetLoader),
 	m_voxelWorldGenerator(m_voxelTypeRegistry),
 	m_voxelWorldStorage("world.sqlite", m_voxelTypeRegistry, m_voxelWorldGenerator),
-	m_voxelWorld(this), m_voxelWorldUpdater(m_voxelWorld)
+	m_voxelWorld(this), m_voxelChunkResidency(m_voxelWorld), m_voxelWorldUpdater(m_voxelWorld)
 {
 	m_voxelWorld.setChunkLoader(&m_voxelWorldStorage);
 }
 
 GameServerEngine::~GameServerEngine() {
+	m_voxelWorld.shutdownChunkEvents();
 	m_voxelWorldUpdater.shutdown();
 	m_voxelLightComputer.shutdown();
 	m_voxelWorld.unload();
@@ -24,23 +25,29 @@ void GameServerEngine::addTransport(std::unique_ptr<ServerTransport> transport)
 	m_transports.emplace_back(std::move(transport));
 }
 
-void GameServerEngine::chunkUnlocked(const VoxelChunkLocation &chunkLocation, VoxelChunkLightState lightState) {
-	switch (lightState) {
-		case VoxelChunkLightState::PENDING_INITIAL:
-		case VoxelChunkLightState::PENDING_INCREMENTAL:
-			m_voxelLightComputer.computeAsync(m_voxelWorld, chunkLocation);
-			break;
-		case VoxelChunkLightState::COMPUTING:
-			break;
-		case VoxelChunkLightState::READY: {
-			std::shared_lock<std::shared_mutex> lock(m_connectionsMutex);
-			for (auto &connection : m_connections) {
-				connection.second->chunkInvalidated(chunkLocation);
-			}
-			break;
+void GameServerEngine::chunkEvents(std::span<const VoxelChunkEvent> events) {
+	std::vector<VoxelChunkLocation> readyChunks;
+	for (auto &event : events) {
+		switch (event.lightState) {
+			case VoxelChunkLightState::PENDING_INITIAL:
+			case VoxelChunkLightState::PENDING_INCREMENTAL:
+				m_voxelLightComputer.computeAsync(m_voxelWorld, event.location);
+				break;
+			case VoxelChunkLightState::COMPUTING:
+			case VoxelChunkLightState::READY:
+			case VoxelChunkLightState::COMPLETE:
+				break;
+		}
+		if (event.types & VoxelChunkEvent::LIGHT_READY) {
+			readyChunks.emplace_back(event.location);
+		}
+	}
+	if (readyChunks.empty()) return;
+	std::shared_lock<std::shared_mutex> lock(m_connectionsMutex);
+	for (auto &connection : m_connections) {
+		for (auto &location : readyChunks) {
+			connection.second->chunkInvalidated(location);
 		}
-		case VoxelChunkLightState::COMPLETE:
-			break;
 	}
 }
 
@@ -48,36 +55,47 @@ int GameServerEngine::run() {
 	for (auto &&transport : m_transports) {
 		transport->start(*this);
 	}
+	size_t lightJobs = 0;
 	while (m_running) {
 		std::this_thread::sleep_for(std::chrono::seconds(1));
-		std::unordered_set<VoxelChunkLocation> locations;
-		m_voxelWorld.forEachChunkLocation([&locations](const VoxelChunkLocation &location) {
-			locations.emplace(location);
-		});
-		std::unique_lock<std::shared_mutex> lock(m_connectionsMutex);
-		for (auto &connection : m_connections) {
-			auto p = connection.second->positionChunk();
-			for (int z = -p.second - 1; z <= p.second + 1; z++) {
-				for (int y = -p.second - 1; y <= p.second + 1; y++) {
-					for (int x = -p.second - 1; x <= p.second + 1; x++) {
-						locations.erase({p.first.x + x, p.first.y + y, p.first.z + z});
-					}
-				}
+		{
+			std::vector<VoxelChunkLocation> playerChunks;
+			std::shared_lock<std::shared_mutex> lock(m_connectionsMutex);
+			for (auto &connection : m_connections) {
+				playerChunks.emplace_back(connection.second->positionChunk().first);
 			}
+			lock.unlock();
+			m_voxelLightComputer.setInterests(playerChunks);
 		}
-		lock.unlock();
-		if (!locations.empty()) {
-			for (auto &location : locations) {
+		auto lightStats = m_voxelLightComputer.stats();
+		if (lightStats.jobs != lightJobs) {
+			lightJobs = lightStats.jobs;
+			LOG(DEBUG) << "Light: " << lightStats.jobs << " job(s), " << lightStats.iterations << " iterations, " <<
+				lightStats.touchedChunks << " chunk(s) touched (at most " << lightStats.maxTouchedChunks << " per job), " <<
+				lightStats.handedOffChunks << " handed off, " << lightStats.queued << " queued, " <<
+				lightStats.deduplicated << " of " << lightStats.posted << " posted deduplicated, " <<
+				lightStats.cancelled << " cancelled";
+		}
+		auto evicted = m_voxelChunkResidency.update();
+		if (!evicted.empty()) {
+			for (auto &location : evicted) {
 				m_voxelLightComputer.cancelComputeAsync(m_voxelWorld, location);
 			}
-			m_voxelWorld.unloadChunks(std::vector<VoxelChunkLocation>(locations.begin(), locations.end()));
-			LOG(INFO) << "Unloaded " << locations.size() << " chunk(s)";
+			auto stats = m_voxelChunkResidency.stats();
+			auto poolStats = m_voxelWorld.chunkPoolStats();
+			LOG(INFO) << "Evicted " << evicted.size() << " chunk(s), residency: " << stats.resident << " resident, " <<
+				stats.warm << " warm (" << stats.warmBytes << " bytes), " << stats.evicting << " evicting, chunk pool: " <<
+				poolStats.pooledChunks << " pooled (" << poolStats.residentBytes << " bytes), " << poolStats.hits <<
+				" hits, " << poolStats.misses << " misses";
 		}
 	}
 	for (auto &&transport : m_transports) {
 		transport->shutdown();
 	}
 	std::unique_lock<std::shared_mutex> lock(m_connectionsMutex);
+	for (auto &connection : m_connections) {
+		m_voxelWorld.cancelChunkRequests(connection.first);
+	}
 	m_connections.clear();
 	return 0;
 }
@@ -93,6 +111,8 @@ void GameServerEngine::registerConnection(std::unique_ptr<ClientConnection> conn
 }
 
 void GameServerEngine::unregisterConnection(ClientConnection *connection) {
+	// Request callbacks call into the connection, it has to outlive them
+	m_voxelWorld.cancelChunkRequests(connection);
 	std::unique_lock<std::shared_mutex> lock(m_connectionsMutex);
 	m_connections.erase(connection);
 }
@@ -7,6 +7,7 @@
 #include <shared_mutex>
 #include "Asset.h"
 #include "world/VoxelWorld.h"
+#include "world/VoxelChunkResidency.h"
 #include "world/VoxelTypeRegistry.h"
 #include "world/VoxelWorldGenerator.h"
 #include "world/VoxelWorldStorage.h"
@@ -22,6 +23,7 @@ class GameServerEngine: VoxelChunkListener {
 	VoxelTypeRegistry m_voxelTypeRegistry;
 	VoxelTypesRegistration m_voxelTypesRegistration;
 	VoxelWorld m_voxelWorld;
+	VoxelChunkResidency m_voxelChunkResidency;
 	VoxelWorldGenerator m_voxelWorldGenerator;
 	VoxelWorldStorage m_voxelWorldStorage;
 	VoxelLightComputer m_voxelLightComputer;
@@ -32,7 +34,7 @@ class GameServerEngine: VoxelChunkListener {
 	std::shared_mutex m_connectionsMutex;
 	std::atomic<bool> m_running = true;
 	
-	void chunkUnlocked(const VoxelChunkLocation &chunkLocation, VoxelChunkLightState lightState) override;
+	void chunkEvents(std::span<const VoxelChunkEvent> events) override;
 	
 public:
 	GameServerEngine();
@@ -47,6 +49,9 @@ public:
 	VoxelWorld &voxelWorld() {
 		return m_voxelWorld;
 	}
+	VoxelChunkResidency &voxelChunkResidency() {
+		return m_voxelChunkResidency;
+	}
 	VoxelLightComputer &voxelLightComputer() {
 		return m_voxelLightComputer;
 	}
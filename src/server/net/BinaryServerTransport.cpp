@@ -70,7 +70,7 @@ std::shared_lock<std::shared_mutex> BinaryServerTransport::Connection::ensureVox
 	return std::move(lock);
 }
 
-void BinaryServerTransport::Connection::setChunk(const VoxelChunkRef &chunk) {
+void BinaryServerTransport::Connection::setChunk(const VoxelChunk &chunk) {
 	auto lock = ensureVoxelSerializationContext();
 	logger().debug(
 			"[Client %v] Sending chunk x=%v,y=%v,z=%v",
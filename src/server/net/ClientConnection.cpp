@@ -21,6 +21,11 @@ ClientConnection::ClientConnection(ServerTransport &transport): m_transport(tran
 }
 
 ClientConnection::~ClientConnection() {
+	// A transport job that ran after unregisterConnection() could have requested chunks again
+	transport().engine()->voxelWorld().cancelChunkRequests(this);
+	if (m_residencyTicket != 0) {
+		transport().engine()->voxelChunkResidency().removeTicket(m_residencyTicket);
+	}
 	auto chunk = m_player->mutableChunk(transport().engine()->voxelWorld(), false);
 	if (chunk) {
 		chunk.removeEntity(m_player);
@@ -62,6 +67,7 @@ void ClientConnection::updatePosition(const glm::vec3 &position, float yaw, floa
 		}
 	}
 	m_player->setRotation(yaw, pitch);
+	auto prevRadius = m_viewRadius;
 	if (viewRadius > 3) {
 		logger().warn("[Client %v] Requested too large view radius. Value will be reduced to 3");
 		m_viewRadius = 3;
@@ -75,6 +81,16 @@ void ClientConnection::updatePosition(const glm::vec3 &position, float yaw, floa
 	auto positionChunk = m_positionChunk;
 	chunk.unlock();
 	lock.unlock();
+	if (chunkChanged || radius != prevRadius) {
+		// Neighbors of the visible chunks are kept too, chunk requests wait for them
+		auto &residency = transport().engine()->voxelChunkResidency();
+		auto box = VoxelChunkBox::around(positionChunk, radius + 1);
+		if (m_residencyTicket == 0) {
+			m_residencyTicket = residency.addTicket(box);
+		} else {
+			residency.moveTicket(m_residencyTicket, box);
+		}
+	}
 	if (resetPosition) {
 		setPosition(newPosition);
 	}
@@ -84,16 +100,33 @@ void ClientConnection::updatePosition(const glm::vec3 &position, float yaw, floa
 }
 
 void ClientConnection::handleChunkChanged(const VoxelChunkLocation &location, int viewRadius) {
+	auto inView = [&location, viewRadius](const VoxelChunkLocation &l, int radius) {
+		return abs(l.x - location.x) <= radius && abs(l.y - location.y) <= radius && abs(l.z - location.z) <= radius;
+	};
 	std::unique_lock<std::mutex> lock(m_pendingChunksMutex);
-	m_pendingChunks.clear();
-	bool foundUnloadedChunks = false;
+	std::erase_if(m_pendingChunks, [&inView, viewRadius](const VoxelChunkLocation &l) {
+		return !inView(l, viewRadius);
+	});
+	std::vector<VoxelChunkLocation> cancelledChunks;
+	for (auto it = m_requestedChunks.begin(); it != m_requestedChunks.end();) {
+		if (!inView(*it, viewRadius)) {
+			cancelledChunks.emplace_back(*it);
+			it = m_requestedChunks.erase(it);
+		} else {
+			++it;
+		}
+	}
+	std::vector<VoxelChunkLocation> requestedChunks;
 	for (int dz = -viewRadius; dz <= viewRadius; dz++) {
 		for (int dy = -viewRadius; dy <= viewRadius; dy++) {
 			for (int dx = -viewRadius; dx <= viewRadius; dx++) {
 				VoxelChunkLocation l(location.x + dx, location.y + dy, location.z + dz);
-				if (m_loadedChunks.find(l) == m_loadedChunks.end()) {
-					m_pendingChunks.emplace(l);
-					foundUnloadedChunks = true;
+				if (
+						m_loadedChunks.find(l) == m_loadedChunks.end() &&
+						m_pendingChunks.find(l) == m_pendingChunks.end() &&
+						m_requestedChunks.emplace(l).second
+				) {
+					requestedChunks.emplace_back(l);
 				}
 			}
 		}
@@ -101,14 +134,7 @@ void ClientConnection::handleChunkChanged(const VoxelChunkLocation &location, in
 	std::vector<VoxelChunkLocation> discardedChunks;
 	auto it = m_loadedChunks.begin();
 	while (it != m_loadedChunks.end() && discardedChunks.size() < 65535) {
-		int dx = it->x - location.x;
-		int dy = it->y - location.y;
-		int dz = it->z - location.z;
-		if (
-				dx < -(viewRadius + 1) || dx > (viewRadius + 1) ||
-				dy < -(viewRadius + 1) || dy > (viewRadius + 1) ||
-				dz < -(viewRadius + 1) || dz > (viewRadius + 1)
-				) {
+		if (!inView(*it, viewRadius + 1)) {
 			discardedChunks.emplace_back(*it);
 			it = m_loadedChunks.erase(it);
 		} else {
@@ -116,8 +142,12 @@ void ClientConnection::handleChunkChanged(const VoxelChunkLocation &location, in
 		}
 	}
 	lock.unlock();
-	if (foundUnloadedChunks) {
-		newPendingChunk();
+	auto &world = transport().engine()->voxelWorld();
+	for (auto &l : cancelledChunks) {
+		world.cancelChunkRequest(l, this);
+	}
+	for (auto &l : requestedChunks) {
+		requestChunk(l);
 	}
 	if (!discardedChunks.empty()) {
 		logger().debug("[Client %v] Discarding %v chunk(s)", this, discardedChunks.size());
@@ -125,6 +155,25 @@ void ClientConnection::handleChunkChanged(const VoxelChunkLocation &location, in
 	}
 }
 
+void ClientConnection::requestChunk(const VoxelChunkLocation &location) {
+	transport().engine()->voxelWorld().requestChunk(
+			location,
+			VoxelChunkLightState::READY,
+			this,
+			[this](const VoxelChunkLocation &location) {
+				chunkReady(location);
+			}
+	);
+}
+
+void ClientConnection::chunkReady(const VoxelChunkLocation &location) {
+	std::unique_lock<std::mutex> lock(m_pendingChunksMutex);
+	if (m_requestedChunks.erase(location) == 0) return;
+	m_pendingChunks.emplace(location);
+	lock.unlock();
+	newPendingChunk();
+}
+
 bool ClientConnection::setPendingChunk() {
 	glm::vec3 position;
 	{
@@ -132,7 +181,8 @@ bool ClientConnection::setPendingChunk() {
 		position = m_player->position();
 	}
 	VoxelChunkRef chunk;
-	do {
+	std::vector<VoxelChunkLocation> notReadyChunks;
+	while (!chunk) {
 		std::unique_lock<std::mutex> lock(m_pendingChunksMutex);
 		auto nearestIt = m_pendingChunks.end();
 		float nearestDistance = INFINITY;
@@ -146,20 +196,36 @@ bool ClientConnection::setPendingChunk() {
 				nearestIt = it;
 			}
 		}
-		if (nearestIt == m_pendingChunks.end()) {
-			return false;
-		}
+		if (nearestIt == m_pendingChunks.end()) break;
 		auto location = *nearestIt;
 		m_pendingChunks.erase(nearestIt);
-		m_loadedChunks.emplace(location);
 		lock.unlock();
-		chunk = transport().engine()->voxelWorld().chunk(location, VoxelWorld::MissingChunkPolicy::LOAD_ASYNC);
-		if (chunk && chunk.lightState() != VoxelChunkLightState::COMPLETE) {
+		chunk = transport().engine()->voxelWorld().chunk(location);
+		if (
+				chunk &&
+				chunk.lightState() != VoxelChunkLightState::READY &&
+				chunk.lightState() != VoxelChunkLightState::COMPLETE
+		) {
 			chunk.unlock();
 		}
-		transport().engine()->voxelLightComputer().computeAsync(transport().engine()->voxelWorld(), location);
-	} while (!chunk);
-	setChunk(chunk);
+		lock.lock();
+		if (chunk) {
+			m_loadedChunks.emplace(location);
+		} else {
+			// Light got invalidated or the chunk unloaded since the request completed
+			m_requestedChunks.emplace(location);
+			notReadyChunks.emplace_back(location);
+		}
+	}
+	// Requested after the loop, a request completing right away must not make it pick the same chunk again
+	for (auto &location : notReadyChunks) {
+		requestChunk(location);
+	}
+	if (!chunk) return false;
+	// Serialization and sending work on a copy, writers wait only for the copy
+	auto snapshot = chunk.snapshot();
+	chunk.unlock();
+	setChunk(*snapshot);
 	return true;
 }
 
@@ -9,9 +9,10 @@
 #include "world/Voxel.h"
 #include "world/VoxelLocation.h"
 #include "world/Entity.h"
+#include "world/VoxelChunkResidency.h"
 #include "ServerTransport.h"
 
-class VoxelChunkRef;
+class VoxelChunk;
 
 class ClientConnection {
 	ServerTransport &m_transport;
@@ -22,15 +23,21 @@ class ClientConnection {
 	VoxelChunkLocation m_positionChunk;
 	std::chrono::time_point<std::chrono::steady_clock> m_lastPositionUpdatedAt;
 	bool m_positionValid = false;
+	// Pins the chunks around the player, taken on the first position update
+	VoxelChunkResidency::Ticket m_residencyTicket = 0;
 	std::shared_mutex m_positionMutex;
+	// Chunks sent to the client, chunks ready to be sent and chunks waiting for VoxelWorld::requestChunk()
 	std::unordered_set<VoxelChunkLocation> m_loadedChunks;
 	std::unordered_set<VoxelChunkLocation> m_pendingChunks;
+	std::unordered_set<VoxelChunkLocation> m_requestedChunks;
 	std::mutex m_pendingChunksMutex;
 	std::vector<VoxelHolder> m_inventory;
 	int m_activeInventoryIndex = 0;
 	std::shared_mutex m_inventoryMutex;
 	
 	void handleChunkChanged(const VoxelChunkLocation &location, int viewRadius);
+	void requestChunk(const VoxelChunkLocation &location);
+	void chunkReady(const VoxelChunkLocation &location);
 	
 protected:
 	[[nodiscard]] el::Logger &logger() const {
@@ -38,7 +45,7 @@ protected:
 	}
 	void updatePosition(const glm::vec3 &position, float yaw, float pitch, int viewRadius);
 	virtual void setPosition(const glm::vec3 &position) = 0;
-	virtual void setChunk(const VoxelChunkRef &chunk) = 0;
+	virtual void setChunk(const VoxelChunk &chunk) = 0;
 	virtual void discardChunks(const std::vector<VoxelChunkLocation> &locations) = 0;
 	virtual void newPendingChunk() = 0;
 	bool setPendingChunk();
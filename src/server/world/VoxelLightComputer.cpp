@@ -1,99 +1,269 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <optional>
+#include <thread>
 #include <easylogging++.h>
 #include "VoxelLightComputer.h"
 #include "world/VoxelWorld.h"
 
-VoxelLightComputerJob::VoxelLightComputerJob(
-		VoxelLightComputer *computer,
-		VoxelWorld *world,
-		const VoxelChunkLocation &location
-): computer(computer), world(world), chunkLocation(location) {
-}
+// Six face neighbors, light spreads only through faces
+static const int NEIGHBOR_OFFSETS[][3] = {
+	{-1, 0, 0}, {1, 0, 0},
+	{0, -1, 0}, {0, 1, 0},
+	{0, 0, -1}, {0, 0, 1}
+};
 
 bool VoxelLightComputerJob::operator==(const VoxelLightComputerJob &job) const {
-	return world == job.world && job.chunkLocation == job.chunkLocation;
+	return world == job.world && chunkLocation == job.chunkLocation;
+}
+
+size_t VoxelLightComputerJob::Hash::operator()(const VoxelLightComputerJob &job) const {
+	return std::hash<VoxelChunkLocation>()(job.chunkLocation) ^ std::hash<VoxelWorld*>()(job.world);
+}
+
+long VoxelLightJobQueue::priority(const VoxelChunkLocation &location) const {
+	long nearest = 0;
+	for (size_t i = 0; i < m_interests.size(); i++) {
+		long dx = location.x - m_interests[i].x, dy = location.y - m_interests[i].y, dz = location.z - m_interests[i].z;
+		long distance = dx * dx + dy * dy + dz * dz;
+		if (i == 0 || distance < nearest) {
+			nearest = distance;
+		}
+	}
+	return nearest;
+}
+
+bool VoxelLightJobQueue::push(const VoxelLightComputerJob &job) {
+	Entry entry{priority(job.chunkLocation), m_nextSequence};
+	if (!m_jobs.emplace(job, entry).second) return false;
+	m_order.emplace(std::make_pair(entry.priority, entry.sequence), job);
+	m_nextSequence++;
+	return true;
 }
 
-void VoxelLightComputerJob::operator()() const {
-	computer->runJob(*this);
+bool VoxelLightJobQueue::erase(const VoxelLightComputerJob &job) {
+	auto it = m_jobs.find(job);
+	if (it == m_jobs.end()) return false;
+	m_order.erase(std::make_pair(it->second.priority, it->second.sequence));
+	m_jobs.erase(it);
+	return true;
 }
 
-bool VoxelLightComputer::ChunkQueue::empty() const {
+VoxelLightComputerJob VoxelLightJobQueue::pop() {
+	assert(!m_order.empty());
+	auto job = m_order.begin()->second;
+	m_order.erase(m_order.begin());
+	m_jobs.erase(job);
+	return job;
+}
+
+void VoxelLightJobQueue::setInterests(const std::vector<VoxelChunkLocation> &locations) {
+	m_interests = locations;
+	m_order.clear();
+	for (auto &[job, entry] : m_jobs) {
+		entry.priority = priority(job.chunkLocation);
+		m_order.emplace(std::make_pair(entry.priority, entry.sequence), job);
+	}
+}
+
+bool VoxelLightWorker::ChunkQueue::empty() const {
 	return queue.empty();
 }
 
-void VoxelLightComputer::ChunkQueue::push(const InChunkVoxelLocation &location) {
-	if (!set.emplace(location).second) return;
+void VoxelLightWorker::ChunkQueue::push(const InChunkVoxelLocation &location) {
+	if (!set.insert(location)) return;
 	queue.emplace_back(location);
 }
 
-InChunkVoxelLocation VoxelLightComputer::ChunkQueue::pop() {
+InChunkVoxelLocation VoxelLightWorker::ChunkQueue::pop() {
 	auto location = queue.front();
 	queue.pop_front();
 	set.erase(location);
 	return location;
 }
 
-VoxelLightComputer::VoxelLightComputer(): Worker("VoxelLightComputer") {
+VoxelLightWorker::VoxelLightWorker(int index): m_name("VoxelLightComputer " + std::to_string(index)) {
+	m_thread = std::thread(&VoxelLightWorker::run, this);
 }
 
-VoxelLightComputer::~VoxelLightComputer() {
+VoxelLightWorker::~VoxelLightWorker() {
 	shutdown();
 }
 
-VoxelLightComputer::ChunkQueue &VoxelLightComputer::chunkQueue(const VoxelChunkLocation &location) {
-	auto it = m_chunkQueues.find(location);
-	if (it == m_chunkQueues.end()) {
+void VoxelLightWorker::run() {
+	LOG(INFO) << "Started " << m_name << " worker";
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	while (m_running) {
+		if (m_queue.empty()) {
+			m_queueCondVar.wait(lock);
+			continue;
+		}
+		auto job = m_queue.pop();
+		lock.unlock();
+		runJob(job);
+		lock.lock();
+	}
+	LOG(INFO) << "Stopped " << m_name << " worker";
+}
+
+void VoxelLightWorker::post(const VoxelLightComputerJob &job) {
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	m_stats.posted++;
+	if (!m_queue.push(job)) {
+		m_stats.deduplicated++;
+		return;
+	}
+	m_queueCondVar.notify_one();
+}
+
+void VoxelLightWorker::cancel(const VoxelLightComputerJob &job) {
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	m_stats.cancelled += m_queue.erase(job);
+}
+
+void VoxelLightWorker::setInterests(const std::vector<VoxelChunkLocation> &locations) {
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	m_queue.setInterests(locations);
+}
+
+void VoxelLightWorker::shutdown() {
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	if (!m_running) return;
+	m_running = false;
+	m_queueCondVar.notify_one();
+	lock.unlock();
+	m_thread.join();
+}
+
+VoxelLightWorker::ChunkQueue &VoxelLightWorker::chunkQueue(Channel channel, const VoxelChunkLocation &location) {
+	if (VoxelRegionIndex::regionLocation(location) == m_region) {
+		m_floodChunks.emplace(location);
+	}
+	auto &chunkQueues = m_chunkQueues[channel];
+	auto it = chunkQueues.find(location);
+	if (it == chunkQueues.end()) {
 		auto l = location;
 		//LOG(TRACE) << l.x << "," << l.y << "," << l.z;
-		it = m_chunkQueues.emplace(location, std::make_unique<ChunkQueue>()).first;
+		it = chunkQueues.emplace(location, std::make_unique<ChunkQueue>()).first;
 	}
 	return *it->second;
 }
 
-constexpr VoxelLightLevel VoxelLightComputer::computeLightLevel(VoxelLightLevel cur, VoxelLightLevel neighbor, int dy) {
-	if (neighbor >= MAX_VOXEL_LIGHT_LEVEL) {
+std::deque<VoxelLightWorker::DarkVoxel> &VoxelLightWorker::darknessQueue(
+		Channel channel,
+		const VoxelChunkLocation &location
+) {
+	if (VoxelRegionIndex::regionLocation(location) == m_region) {
+		m_darkChunks.emplace(location);
+	}
+	return m_darknessQueues[channel][location];
+}
+
+// Removals go first, a chunk is flooded only once the region has no darkness left
+std::optional<VoxelChunkLocation> VoxelLightWorker::nextChunk() {
+	while (!m_darkChunks.empty()) {
+		auto location = *m_darkChunks.begin();
+		for (auto &darknessQueues : m_darknessQueues) {
+			auto it = darknessQueues.find(location);
+			if (it != darknessQueues.end() && !it->second.empty()) return location;
+		}
+		m_darkChunks.erase(m_darkChunks.begin());
+	}
+	while (!m_floodChunks.empty()) {
+		auto location = *m_floodChunks.begin();
+		for (auto &chunkQueues : m_chunkQueues) {
+			auto it = chunkQueues.find(location);
+			if (it != chunkQueues.end() && !it->second->empty()) return location;
+		}
+		m_floodChunks.erase(m_floodChunks.begin());
+	}
+	return std::nullopt;
+}
+
+constexpr int VoxelLightWorker::channelLevel(VoxelLight light, Channel channel) {
+	return channel == SKY ? light.sky() : light.block();
+}
+
+constexpr VoxelLight VoxelLightWorker::withChannelLevel(VoxelLight light, Channel channel, int level) {
+	return channel == SKY ? VoxelLight(level, light.block()) : VoxelLight(light.sky(), level);
+}
+
+constexpr int VoxelLightWorker::computeLightLevel(Channel channel, int cur, int neighbor, int dy) {
+	// Full skylight falls down without fading, block light always fades
+	if (channel == SKY && neighbor >= VoxelLight::MAX_LEVEL) {
 		if (dy > 0) {
 			return neighbor;
 		}
-		neighbor = dy == 0 ? MAX_VOXEL_LIGHT_LEVEL : 0;
+		neighbor = dy == 0 ? VoxelLight::MAX_LEVEL : 0;
 	}
 	return cur >= neighbor ? cur : std::max(neighbor - 1, 0);
 }
 
-void VoxelLightComputer::computeLightLevel(
+int VoxelLightWorker::expectedLightLevel(
+		VoxelChunkMutableRef &chunk,
+		const InChunkVoxelLocation &location,
+		Channel channel
+) {
+	const VoxelChunkRef &constChunk = chunk;
+	int typeLightLevel = constChunk.at(location).typeLightLevel();
+	int lightLevel = channel == BLOCK ? std::clamp(typeLightLevel, 0, VoxelLight::MAX_LEVEL) : 0;
+	if (constChunk.opaqueMask().test(VoxelChunk::voxelIndex(location.x, location.y, location.z))) {
+		return lightLevel;
+	}
+	for (auto &offset : NEIGHBOR_OFFSETS) {
+		InChunkVoxelLocation nLocation(
+				location.x + offset[0],
+				location.y + offset[1],
+				location.z + offset[2]
+		);
+		if (chunk.extendedEmpty(nLocation)) continue;
+		lightLevel = computeLightLevel(
+				channel,
+				lightLevel,
+				channelLevel(chunk.extendedLight(nLocation), channel),
+				offset[1]
+		);
+	}
+	if (typeLightLevel < 0) {
+		lightLevel = std::max(lightLevel + typeLightLevel, 0);
+	}
+	return lightLevel;
+}
+
+void VoxelLightWorker::computeLightLevel(
 	VoxelChunkMutableRef &chunk,
 	const InChunkVoxelLocation &location,
+	Channel channel,
 	ChunkQueue &queue,
 	bool load
 ) {
-	static const int offsets[][3] = {
-		{-1, 0, 0}, {1, 0, 0},
-		{0, -1, 0}, {0, 1, 0},
-		{0, 0, -1}, {0, 0, 1}
-	};
-
 	m_iterationCount++;
-	auto &cur = chunk.at(location);
-	auto typeLightLevel = cur.typeLightLevel();
-	auto lightLevel = std::max(typeLightLevel, (VoxelLightLevel) 0);
-	auto shaderProvider = cur.shaderProvider();
-	if (shaderProvider == nullptr || shaderProvider->priority() < MAX_VOXEL_SHADER_PRIORITY) {
-		for (auto &offset : offsets) {
-			auto &n = chunk.extendedAt(
-					location.x + offset[0],
-					location.y + offset[1],
-					location.z + offset[2]
-			);
-			if (&n.type() == &EmptyVoxelType::INSTANCE) continue;
-			lightLevel = computeLightLevel(lightLevel, n.lightLevel(), offset[1]);
-		}
-		if (typeLightLevel < 0) {
-			lightLevel = std::max(lightLevel + typeLightLevel, 0);
-		}
-	}
-	auto prevLightLevel = cur.lightLevel();
-	cur.setLightLevel(lightLevel);
-	for (auto &offset : offsets) {
+	const VoxelChunkRef &constChunk = chunk;
+	auto lightLevel = expectedLightLevel(chunk, location, channel);
+	auto light = constChunk.light(location);
+	auto prevLightLevel = channelLevel(light, channel);
+	chunk.setLight(location, withChannelLevel(light, channel, lightLevel));
+	propagateLightLevel(chunk, location, channel, prevLightLevel, lightLevel, queue, load);
+}
+
+void VoxelLightWorker::propagateLightLevel(
+		VoxelChunkMutableRef &chunk,
+		const InChunkVoxelLocation &location,
+		Channel channel,
+		int prevLightLevel,
+		int lightLevel,
+		ChunkQueue &queue,
+		bool load
+) {
+	auto affects = [channel, prevLightLevel, lightLevel](int dy, int nLightLevel) {
+		return (
+				(lightLevel != prevLightLevel) &&
+				(computeLightLevel(channel, 0, prevLightLevel, -dy) == nLightLevel)
+		) || (computeLightLevel(channel, 0, lightLevel, -dy) > nLightLevel);
+	};
+	const VoxelChunkRef &constChunk = chunk;
+	for (auto &offset : NEIGHBOR_OFFSETS) {
 		InChunkVoxelLocation nLocation(
 				location.x + offset[0],
 				location.y + offset[1],
@@ -104,73 +274,179 @@ void VoxelLightComputer::computeLightLevel(
 				nLocation.y >= 0 && nLocation.y < VOXEL_CHUNK_SIZE &&
 				nLocation.z >= 0 && nLocation.z < VOXEL_CHUNK_SIZE
 		) {
-			auto &n = chunk.at(nLocation);
-			auto nLightLevel = n.lightLevel();
-			auto nShaderProvider = n.shaderProvider();
-			if (
-					(nShaderProvider == nullptr || nShaderProvider->priority() < MAX_VOXEL_SHADER_PRIORITY) && (
-							(
-									(lightLevel != prevLightLevel) &&
-									(computeLightLevel(0, prevLightLevel, -offset[1]) == nLightLevel)
-							) || (computeLightLevel(0, lightLevel, -offset[1]) > nLightLevel)
-					)
-			) {
+			auto nLightLevel = channelLevel(constChunk.light(nLocation), channel);
+			if (!chunk.extendedOpaque(nLocation) && affects(offset[1], nLightLevel)) {
 				queue.push(nLocation);
 			}
 		} else {
 			bool exists = chunk.hasNeighbor(offset[0], offset[1], offset[2]);
-			VoxelLocation gLocation;
-			auto &n = chunk.extendedAt(nLocation, &gLocation);
+			VoxelLocation gLocation(chunk.location(), nLocation);
 			if (exists || load) {
 				if (exists) {
-					auto nLightLevel = n.lightLevel();
-					auto nShaderProvider = n.shaderProvider();
-					if (
-							(nShaderProvider == nullptr || nShaderProvider->priority() < MAX_VOXEL_SHADER_PRIORITY) && (
-									(
-											(lightLevel != prevLightLevel) &&
-											(computeLightLevel(0, prevLightLevel, -offset[1]) == nLightLevel)
-									) || (computeLightLevel(0, lightLevel, -offset[1]) > nLightLevel)
-							)
-					) {
-						chunkQueue(gLocation.chunk()).push(gLocation.inChunk());
+					auto nLightLevel = channelLevel(chunk.extendedLight(nLocation), channel);
+					if (!chunk.extendedOpaque(nLocation) && affects(offset[1], nLightLevel)) {
+						chunkQueue(channel, gLocation.chunk()).push(gLocation.inChunk());
 					}
 				} else {
-					chunkQueue(gLocation.chunk()).push(gLocation.inChunk());
+					chunkQueue(channel, gLocation.chunk()).push(gLocation.inChunk());
 				}
 			}
 		}
 	}
 }
 
-void VoxelLightComputer::computeInitialLightLevels(VoxelChunkMutableRef &chunk, bool load) {
+/*
+ * Clears the light of the voxel and queues the neighbors that could have got their light from it for removal. Brighter
+ * neighbors have another source, they are queued to flood the cleared area once all removals are done.
+ */
+void VoxelLightWorker::removeLightLevel(
+		VoxelChunkMutableRef &chunk,
+		const DarkVoxel &voxel,
+		Channel channel,
+		ChunkQueue &queue,
+		std::deque<DarkVoxel> &darkness
+) {
+	const VoxelChunkRef &constChunk = chunk;
+	auto &location = voxel.location;
+	auto light = constChunk.light(location);
+	if (channelLevel(light, channel) == 0) return;
+	m_iterationCount++;
+	chunk.setLight(location, withChannelLevel(light, channel, 0));
+	if (channel == BLOCK && constChunk.at(location).typeLightLevel() > 0) {
+		queue.push(location);
+	}
+	for (auto &offset : NEIGHBOR_OFFSETS) {
+		InChunkVoxelLocation nLocation(
+				location.x + offset[0],
+				location.y + offset[1],
+				location.z + offset[2]
+		);
+		bool inside = nLocation.x >= 0 && nLocation.x < VOXEL_CHUNK_SIZE &&
+			nLocation.y >= 0 && nLocation.y < VOXEL_CHUNK_SIZE &&
+			nLocation.z >= 0 && nLocation.z < VOXEL_CHUNK_SIZE;
+		if (!inside && !chunk.hasNeighbor(offset[0], offset[1], offset[2])) continue;
+		if (chunk.extendedOpaque(nLocation)) continue;
+		auto nLightLevel = channelLevel(chunk.extendedLight(nLocation), channel);
+		if (nLightLevel == 0) continue;
+		bool dependent = nLightLevel <= computeLightLevel(channel, 0, voxel.lightLevel, -offset[1]);
+		if (inside) {
+			if (dependent) {
+				darkness.push_back({nLocation, nLightLevel});
+			} else {
+				queue.push(nLocation);
+			}
+			continue;
+		}
+		VoxelLocation gLocation(chunk.location(), nLocation);
+		if (dependent) {
+			darknessQueue(channel, gLocation.chunk()).push_back({gLocation.inChunk(), nLightLevel});
+		} else {
+			chunkQueue(channel, gLocation.chunk()).push(gLocation.inChunk());
+		}
+	}
+}
+
+void VoxelLightWorker::computeInitialLightLevels(VoxelChunkMutableRef &chunk, bool load) {
 	auto &l = chunk.location();
 	LOG(DEBUG) << "Initial light levels computation for chunk x=" << l.x << ",y=" << l.y << ",z=" << l.z;
+	auto &skyQueue = chunkQueue(SKY, chunk.location());
+	auto &blockQueue = chunkQueue(BLOCK, chunk.location());
+	if (chunk.uniform()) {
+		// Light doesn't pass through opaque voxels, so only voxels on the chunk boundary can affect neighbors
+		const VoxelChunkRef &constChunk = chunk;
+		auto &voxel = constChunk.at(0, 0, 0);
+		if (voxel.opaque()) {
+			int lightLevel = std::clamp((int) voxel.typeLightLevel(), 0, VoxelLight::MAX_LEVEL);
+			chunk.setUniformLight(VoxelLight(0, lightLevel));
+			for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
+				for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
+					for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
+						if (
+								x > 0 && x < VOXEL_CHUNK_SIZE - 1 &&
+								y > 0 && y < VOXEL_CHUNK_SIZE - 1 &&
+								z > 0 && z < VOXEL_CHUNK_SIZE - 1
+						) continue;
+						m_iterationCount++;
+						propagateLightLevel(chunk, {x, y, z}, SKY, -1, 0, skyQueue, load);
+						propagateLightLevel(chunk, {x, y, z}, BLOCK, -1, lightLevel, blockQueue, load);
+					}
+				}
+			}
+			return;
+		}
+	}
+	/*
+	 * Skylight coming from above falls straight down to the heightmap. The BFS starts only where the filled columns
+	 * border on something else, at emitters and at the chunk boundary, everything it doesn't reach stays dark.
+	 */
+	auto &heightmap = chunk.heightmap();
+	std::array<int, VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE> skyFrom;
+	chunk.setUniformLight(VoxelLight());
 	for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
-		for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
-			for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
-				chunk.at(x, y, z).setLightLevel(-1);
+		for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
+			auto &from = skyFrom[VoxelChunk::columnIndex(x, z)];
+			InChunkVoxelLocation above(x, VOXEL_CHUNK_SIZE, z);
+			if (chunk.extendedEmpty(above) || chunk.extendedLight(above).sky() < VoxelLight::MAX_LEVEL) {
+				from = VOXEL_CHUNK_SIZE;
+				continue;
+			}
+			from = heightmap[VoxelChunk::columnIndex(x, z)] + 1;
+			for (int y = from; y < VOXEL_CHUNK_SIZE; y++) {
+				chunk.setLight(x, y, z, VoxelLight::fullSky());
 			}
 		}
 	}
-	auto &queue = chunkQueue(chunk.location());
+	auto sky = [&skyFrom](int x, int y, int z) {
+		return x >= 0 && x < VOXEL_CHUNK_SIZE && z >= 0 && z < VOXEL_CHUNK_SIZE &&
+			y >= skyFrom[VoxelChunk::columnIndex(x, z)];
+	};
+	const VoxelChunkRef &constChunk = chunk;
 	for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
 		for (int y = VOXEL_CHUNK_SIZE - 1; y >= 0; y--) {
 			for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
-				computeLightLevel(chunk, {x, y, z}, queue, load);
+				bool boundary = x == 0 || x == VOXEL_CHUNK_SIZE - 1 || y == 0 || y == VOXEL_CHUNK_SIZE - 1 ||
+					z == 0 || z == VOXEL_CHUNK_SIZE - 1;
+				// Block light of the neighbors can enter through any boundary voxel
+				if (boundary || constChunk.at(x, y, z).typeLightLevel() > 0) {
+					blockQueue.push({x, y, z});
+				}
+				if (!sky(x, y, z)) {
+					if (boundary) {
+						skyQueue.push({x, y, z});
+					}
+					continue;
+				}
+				if (
+						boundary || !sky(x - 1, y, z) || !sky(x + 1, y, z) || !sky(x, y - 1, z) ||
+						!sky(x, y, z - 1) || !sky(x, y, z + 1)
+				) {
+					m_iterationCount++;
+					propagateLightLevel(chunk, {x, y, z}, SKY, -1, VoxelLight::MAX_LEVEL, skyQueue, load);
+				}
 			}
 		}
 	}
 }
 
-void VoxelLightComputer::runJob(const VoxelLightComputerJob &job) {
-	static const int offsets[][3] = {
-			{-1, 0, 0}, {1, 0, 0},
-			{0, -1, 0}, {0, 1, 0},
-			{0, 0, -1}, {0, 0, 1}
-	};
-	
+void VoxelLightWorker::handOff(VoxelWorld &world, const VoxelChunkLocation &location, const HandOff &handOff) {
+	auto chunk = world.mutableChunk(location, VoxelWorld::MissingChunkPolicy::NONE);
+	// The initial computation of a missing or pending chunk reads the border from its neighbors anyway
+	if (!chunk || chunk.lightState() == VoxelChunkLightState::PENDING_INITIAL) return;
+	// The chunk becomes pending, its owner gets the job from the LIGHT_PENDING event like after an edit
+	if (!handOff.darkness.empty()) {
+		chunk.markDirty(handOff.darkness, false);
+	}
+	if (!handOff.relight.empty()) {
+		chunk.markRelight(handOff.relight);
+	}
+	auto &l = chunk.location();
+	LOG(TRACE) << "Handed off " << handOff.darkness.size() << " dark and " << handOff.relight.size() <<
+		" relit voxel(s) to chunk x=" << l.x << ",y=" << l.y << ",z=" << l.z;
+}
+
+void VoxelLightWorker::runJob(const VoxelLightComputerJob &job) {
 	m_iterationCount = 0;
+	m_region = VoxelRegionIndex::regionLocation(job.chunkLocation);
 	auto chunk = job.world->mutableChunk(job.chunkLocation, VoxelWorld::MissingChunkPolicy::LOAD);
 	{
 		auto &l = job.chunkLocation;
@@ -187,14 +463,31 @@ void VoxelLightComputer::runJob(const VoxelLightComputerJob &job) {
 				computeInitialLightLevels(chunk, chunk.location() == job.chunkLocation);
 				break;
 			case VoxelChunkLightState::PENDING_INCREMENTAL: {
+				/*
+				 * Edited voxels that would get less light than they have (an emitter or a light path went away) lose
+				 * it first, then the cleared area is flooded again from its boundary. The other ones are only flooded.
+				 */
 				auto &l = chunk.location();
-				auto &queue = chunkQueue(l);
-				LOG(DEBUG) << "Recompute light levels for " << chunk.dirtyLocations().size() <<
-						   " voxel(s) in chunk x=" << l.x << ",y=" << l.y << ",z=" << l.z;
-				for (auto &location : chunk.dirtyLocations()) {
-					queue.push(location);
+				LOG(DEBUG) << "Recompute light levels for " << chunk.dirtyLocations().size() << " edited and " <<
+						   chunk.relightLocations().size() << " relit voxel(s) in chunk x=" << l.x << ",y=" << l.y <<
+						   ",z=" << l.z;
+				const VoxelChunkRef &constChunk = chunk;
+				for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+					auto &queue = chunkQueue((Channel) channel, l);
+					for (auto &location : chunk.dirtyLocations()) {
+						auto lightLevel = channelLevel(constChunk.light(location), (Channel) channel);
+						if (expectedLightLevel(chunk, location, (Channel) channel) < lightLevel) {
+							darknessQueue((Channel) channel, l).push_back({location, lightLevel});
+						} else {
+							queue.push(location);
+						}
+					}
+					for (auto &location : chunk.relightLocations()) {
+						queue.push(location);
+					}
 				}
 				chunk.clearDirtyLocations();
+				chunk.clearRelightLocations();
 				break;
 			}
 			case VoxelChunkLightState::COMPUTING:
@@ -203,42 +496,77 @@ void VoxelLightComputer::runJob(const VoxelLightComputerJob &job) {
 				break;
 		}
 		chunk.setLightState(VoxelChunkLightState::COMPUTING);
-		auto it = m_chunkQueues.find(chunk.location());
-		if (it != m_chunkQueues.end()) {
-			auto &queue = *it->second;
-			while (!queue.empty()) {
-				computeLightLevel(chunk, queue.pop(), queue, chunk.location() == job.chunkLocation);
+		for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+			auto it = m_darknessQueues[channel].find(chunk.location());
+			if (it == m_darknessQueues[channel].end()) continue;
+			auto &queue = chunkQueue((Channel) channel, chunk.location());
+			auto &darkness = it->second;
+			while (!darkness.empty()) {
+				auto voxel = darkness.front();
+				darkness.pop_front();
+				removeLightLevel(chunk, voxel, (Channel) channel, queue, darkness);
 			}
 		}
-		chunk.unlock();
-		it = m_chunkQueues.begin();
-		while (it != m_chunkQueues.end()) {
-			if (it->second->empty()) {
-				it++;
-				continue;
+		m_darkChunks.erase(chunk.location());
+		// Flooding before all removals in the region are done could pick up light that is about to be removed
+		if (m_darkChunks.empty()) {
+			for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+				auto it = m_chunkQueues[channel].find(chunk.location());
+				if (it == m_chunkQueues[channel].end()) continue;
+				auto &queue = *it->second;
+				while (!queue.empty()) {
+					computeLightLevel(chunk, queue.pop(), (Channel) channel, queue, chunk.location() == job.chunkLocation);
+				}
 			}
-			auto &l = it->first;
+			m_floodChunks.erase(chunk.location());
+		}
+		chunk.unlock();
+		auto next = nextChunk();
+		if (next) {
+			auto &l = *next;
 			LOG(TRACE) << "Changing chunk to x=" << l.x << ",y=" << l.y << ",z=" << l.z;
 			chunk = job.world->mutableChunk(l, VoxelWorld::MissingChunkPolicy::LOAD);
-			break;
 		}
 	}
-	LOG(TRACE) << "Light computation completed (" << m_iterationCount << " iterations)";
-	m_chunkQueues.clear();
+	LOG(TRACE) << "Light computation completed (" << m_iterationCount << " iterations, " << m_visitedChunks.size() <<
+		" chunk(s) touched)";
+	// Removals handed off start over from the current light of the voxels in the other region
+	std::unordered_map<VoxelChunkLocation, HandOff> handOffs;
+	for (auto &chunkQueues : m_chunkQueues) {
+		for (auto &[location, queue] : chunkQueues) {
+			if (queue->empty() || VoxelRegionIndex::regionLocation(location) == m_region) continue;
+			auto &relight = handOffs[location].relight;
+			relight.insert(relight.end(), queue->queue.begin(), queue->queue.end());
+		}
+		chunkQueues.clear();
+	}
+	for (auto &darknessQueues : m_darknessQueues) {
+		for (auto &[location, darkness] : darknessQueues) {
+			if (darkness.empty() || VoxelRegionIndex::regionLocation(location) == m_region) continue;
+			auto &locations = handOffs[location].darkness;
+			for (auto &voxel : darkness) {
+				locations.emplace_back(voxel.location);
+			}
+		}
+		darknessQueues.clear();
+	}
+	m_darkChunks.clear();
+	m_floodChunks.clear();
+	for (auto &[location, handOff] : handOffs) {
+		this->handOff(*job.world, location, handOff);
+	}
+	{
+		std::unique_lock<std::mutex> lock(m_queueMutex);
+		m_stats.jobs++;
+		m_stats.iterations += m_iterationCount;
+		m_stats.touchedChunks += m_visitedChunks.size();
+		m_stats.maxTouchedChunks = std::max(m_stats.maxTouchedChunks, m_visitedChunks.size());
+		m_stats.handedOffChunks += handOffs.size();
+	}
 	for (auto &location : m_visitedChunks) {
 		chunk = job.world->mutableChunk(location);
 		if (!chunk) continue;
 		if (chunk.lightState() == VoxelChunkLightState::COMPUTING) {
-			bool complete = true;
-			for (int dz = -1; dz <= 1 && complete; dz++) {
-				for (int dy = -1; dy <= 1 && complete; dy++) {
-					for (int dx = -1; dx <= 1 && complete; dx++) {
-						if (!chunk.hasNeighbor(dx, dy, dz)) {
-							complete = false;
-						}
-					}
-				}
-			}
 			chunk.setLightState(VoxelChunkLightState::READY);
 			chunk.invalidateStorage();
 			auto &l = chunk.location();
@@ -249,10 +577,69 @@ void VoxelLightComputer::runJob(const VoxelLightComputerJob &job) {
 	m_visitedChunks.clear();
 }
 
+VoxelLightComputerStats VoxelLightWorker::stats() {
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	auto stats = m_stats;
+	stats.queued = m_queue.size();
+	return stats;
+}
+
+/* VoxelLightComputer */
+
+VoxelLightComputer::VoxelLightComputer(int threadCount) {
+	assert(threadCount > 0);
+	for (int i = 0; i < threadCount; i++) {
+		m_workers.emplace_back(std::make_unique<VoxelLightWorker>(i));
+	}
+}
+
+VoxelLightComputer::~VoxelLightComputer() {
+	shutdown();
+}
+
+int VoxelLightComputer::defaultThreadCount() {
+	return std::max((int) std::thread::hardware_concurrency() / 2, 1);
+}
+
+VoxelLightWorker &VoxelLightComputer::worker(const VoxelChunkLocation &location) {
+	auto region = VoxelRegionIndex::regionLocation(location);
+	auto hash = (size_t) region.x * 73856093 ^ (size_t) region.y * 19349663 ^ (size_t) region.z * 83492791;
+	return *m_workers[hash % m_workers.size()];
+}
+
 void VoxelLightComputer::computeAsync(VoxelWorld &world, const VoxelChunkLocation &location) {
-	post(this, &world, location);
+	worker(location).post({&world, location});
 }
 
 void VoxelLightComputer::cancelComputeAsync(VoxelWorld &world, const VoxelChunkLocation &location) {
-	cancel(VoxelLightComputerJob(this, &world, location), false);
+	worker(location).cancel({&world, location});
+}
+
+void VoxelLightComputer::setInterests(const std::vector<VoxelChunkLocation> &locations) {
+	for (auto &worker : m_workers) {
+		worker->setInterests(locations);
+	}
+}
+
+void VoxelLightComputer::shutdown() {
+	for (auto &worker : m_workers) {
+		worker->shutdown();
+	}
+}
+
+VoxelLightComputerStats VoxelLightComputer::stats() {
+	VoxelLightComputerStats stats;
+	for (auto &worker : m_workers) {
+		auto workerStats = worker->stats();
+		stats.jobs += workerStats.jobs;
+		stats.iterations += workerStats.iterations;
+		stats.touchedChunks += workerStats.touchedChunks;
+		stats.maxTouchedChunks = std::max(stats.maxTouchedChunks, workerStats.maxTouchedChunks);
+		stats.handedOffChunks += workerStats.handedOffChunks;
+		stats.queued += workerStats.queued;
+		stats.posted += workerStats.posted;
+		stats.deduplicated += workerStats.deduplicated;
+		stats.cancelled += workerStats.cancelled;
+	}
+	return stats;
 }
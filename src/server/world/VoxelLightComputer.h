@@ -1,57 +1,200 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
 #include "world/VoxelLocation.h"
+#include "world/VoxelChunk.h"
 #include "world/Voxel.h"
-#include "Worker.h"
 
 class VoxelWorld;
 class VoxelChunkMutableRef;
-class VoxelLightComputer;
+
+struct VoxelLightComputerStats {
+	size_t jobs = 0;
+	size_t iterations = 0;
+	// Chunks visited by the jobs, they never leave the region of the job
+	size_t touchedChunks = 0;
+	size_t maxTouchedChunks = 0;
+	// Chunks of other regions that got voxels handed off
+	size_t handedOffChunks = 0;
+	// Jobs waiting to run, posted jobs and the ones dropped because the chunk was already queued
+	size_t queued = 0;
+	size_t posted = 0;
+	size_t deduplicated = 0;
+	size_t cancelled = 0;
+};
 
 struct VoxelLightComputerJob {
-	VoxelLightComputer *computer;
 	VoxelWorld *world;
 	VoxelChunkLocation chunkLocation;
 	
-	VoxelLightComputerJob(VoxelLightComputer *computer, VoxelWorld *world, const VoxelChunkLocation &location);
 	bool operator==(const VoxelLightComputerJob &job) const;
-	void operator()() const;
+	
+	struct Hash {
+		size_t operator()(const VoxelLightComputerJob &job) const;
+	};
 };
 
-class VoxelLightComputer: public Worker<VoxelLightComputerJob> {
+/*
+ * Light jobs waiting to run, a chunk is queued at most once. The job nearest to an interest location (a player) is taken
+ * first, older jobs win between equally distant chunks. Priorities are computed when a job is pushed and again only when
+ * the interests change.
+ */
+class VoxelLightJobQueue {
+	struct Entry {
+		long priority;
+		unsigned long sequence;
+	};
+	
+	std::unordered_map<VoxelLightComputerJob, Entry, VoxelLightComputerJob::Hash> m_jobs;
+	std::map<std::pair<long, unsigned long>, VoxelLightComputerJob> m_order;
+	std::vector<VoxelChunkLocation> m_interests;
+	unsigned long m_nextSequence = 0;
+	
+	[[nodiscard]] long priority(const VoxelChunkLocation &location) const;
+	
+public:
+	// Returns false if the job is queued already
+	bool push(const VoxelLightComputerJob &job);
+	bool erase(const VoxelLightComputerJob &job);
+	VoxelLightComputerJob pop();
+	void setInterests(const std::vector<VoxelChunkLocation> &locations);
+	
+	[[nodiscard]] bool empty() const {
+		return m_jobs.empty();
+	}
+	
+	[[nodiscard]] size_t size() const {
+		return m_jobs.size();
+	}
+	
+};
+
+/*
+ * Computes light of the chunks in the regions assigned to it. The propagation stays inside the region of the job,
+ * voxels queued in the chunks of other regions are handed off to them: the ones losing light as dirty locations, the
+ * ones to flood from as relight locations.
+ */
+class VoxelLightWorker {
 	struct ChunkQueue {
 		std::deque<InChunkVoxelLocation> queue;
-		std::unordered_set<InChunkVoxelLocation> set;
+		VoxelChunkLocationSet set;
 		
 		bool empty() const;
 		void push(const InChunkVoxelLocation &location);
 		InChunkVoxelLocation pop();
 	};
 	
-	std::unordered_map<VoxelChunkLocation, std::unique_ptr<ChunkQueue>> m_chunkQueues;
+	// Voxel whose light is being removed together with the level it had
+	struct DarkVoxel {
+		InChunkVoxelLocation location;
+		int lightLevel;
+	};
+	
+	// Skylight and block light propagate independently, each channel has its own queues
+	enum Channel {
+		SKY,
+		BLOCK,
+		CHANNEL_COUNT
+	};
+	
+	struct HandOff {
+		std::vector<InChunkVoxelLocation> darkness;
+		std::vector<InChunkVoxelLocation> relight;
+	};
+	
+	std::unordered_map<VoxelChunkLocation, std::unique_ptr<ChunkQueue>> m_chunkQueues[CHANNEL_COUNT];
+	std::unordered_map<VoxelChunkLocation, std::deque<DarkVoxel>> m_darknessQueues[CHANNEL_COUNT];
+	// Chunks of the job region that got queued voxels, they may be empty again once taken
+	std::unordered_set<VoxelChunkLocation> m_darkChunks;
+	std::unordered_set<VoxelChunkLocation> m_floodChunks;
+	VoxelChunkLocation m_region;
 	std::unordered_set<VoxelChunkLocation> m_visitedChunks;
 	int m_iterationCount = 0;
+	std::string m_name;
+	VoxelLightJobQueue m_queue;
+	VoxelLightComputerStats m_stats;
+	bool m_running = true;
+	// Guards the queue, the interests and the stats
+	std::mutex m_queueMutex;
+	std::condition_variable m_queueCondVar;
+	std::thread m_thread;
+	
+	void run();
 	
-	ChunkQueue &chunkQueue(const VoxelChunkLocation &location);
-	constexpr static VoxelLightLevel computeLightLevel(VoxelLightLevel cur, VoxelLightLevel neighbor, int dy);
+	ChunkQueue &chunkQueue(Channel channel, const VoxelChunkLocation &location);
+	std::deque<DarkVoxel> &darknessQueue(Channel channel, const VoxelChunkLocation &location);
+	[[nodiscard]] std::optional<VoxelChunkLocation> nextChunk();
+	constexpr static int channelLevel(VoxelLight light, Channel channel);
+	constexpr static VoxelLight withChannelLevel(VoxelLight light, Channel channel, int level);
+	constexpr static int computeLightLevel(Channel channel, int cur, int neighbor, int dy);
+	[[nodiscard]] static int expectedLightLevel(
+			VoxelChunkMutableRef &chunk,
+			const InChunkVoxelLocation &location,
+			Channel channel
+	);
 	void computeLightLevel(
 			VoxelChunkMutableRef &chunk,
 			const InChunkVoxelLocation &location,
+			Channel channel,
+			ChunkQueue &queue,
+			bool load
+	);
+	void propagateLightLevel(
+			VoxelChunkMutableRef &chunk,
+			const InChunkVoxelLocation &location,
+			Channel channel,
+			int prevLightLevel,
+			int lightLevel,
 			ChunkQueue &queue,
 			bool load
 	);
+	void removeLightLevel(
+			VoxelChunkMutableRef &chunk,
+			const DarkVoxel &voxel,
+			Channel channel,
+			ChunkQueue &queue,
+			std::deque<DarkVoxel> &darkness
+	);
 	void computeInitialLightLevels(VoxelChunkMutableRef &chunk, bool load);
+	void handOff(VoxelWorld &world, const VoxelChunkLocation &location, const HandOff &handOff);
 	void runJob(const VoxelLightComputerJob &job);
 	
-	friend struct VoxelLightComputerJob;
+public:
+	explicit VoxelLightWorker(int index);
+	~VoxelLightWorker();
+	void post(const VoxelLightComputerJob &job);
+	void cancel(const VoxelLightComputerJob &job);
+	void setInterests(const std::vector<VoxelChunkLocation> &locations);
+	void shutdown();
+	[[nodiscard]] VoxelLightComputerStats stats();
+	
+};
 
+// Spreads light jobs over a pool of workers, all jobs of a region run on the same worker one after another
+class VoxelLightComputer {
+	std::vector<std::unique_ptr<VoxelLightWorker>> m_workers;
+	
+	VoxelLightWorker &worker(const VoxelChunkLocation &location);
+	
 public:
-	VoxelLightComputer();
+	explicit VoxelLightComputer(int threadCount = defaultThreadCount());
 	~VoxelLightComputer();
+	static int defaultThreadCount();
 	void computeAsync(VoxelWorld &world, const VoxelChunkLocation &location);
 	void cancelComputeAsync(VoxelWorld &world, const VoxelChunkLocation &location);
+	// Chunks of the players, queued jobs nearer to them run first
+	void setInterests(const std::vector<VoxelChunkLocation> &locations);
+	void shutdown();
+	[[nodiscard]] VoxelLightComputerStats stats();
 	
 };
@@ -45,36 +45,38 @@ void VoxelWorldGenerator::load(VoxelChunkMutableRef &chunk) {
 	auto &location = chunk.location();
 	LOG(DEBUG) << "Generating chunk at x=" << location.x << ",y=" << location.y << ",z=" << location.z;
 	if (location.y >= 0) {
-		for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
-			for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
-				for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
-					auto &v = chunk.at(x, y, z);
-					v.setType(m_air);
-					v.setLightLevel(MAX_VOXEL_LIGHT_LEVEL);
-				}
-			}
-		}
+		chunk.setUniform(VoxelHolder(m_air));
+		chunk.setUniformLight(VoxelLight::fullSky());
 		chunk.setLightState(VoxelChunkLightState::READY);
 		return;
 	}
+	if (VoxelLocation(location, {0, VOXEL_CHUNK_SIZE - 1, 0}).y < -3) {
+		chunk.setUniform(VoxelHolder(m_stone));
+		return;
+	}
 	
-	for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
-		for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
-			for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
-				VoxelLocation l(location, {x, y, z});
-				auto &v = chunk.at(x, y, z);
-				if (l.x == 3 && l.y == -1 && l.z == -4) {
-					v.setType(m_stone);
-				} else if (l.y < -3) {
-					v.setType(m_stone);
-				} else if (l.y < -1) {
-					v.setType(m_dirt);
-				} else if (l.y == -1) {
-					v.setType(m_grass);
-				} else {
-					v.setType(m_air);
-				}
-			}
+	auto layerType = [this, &location](int y) -> VoxelTypeInterface& {
+		auto worldY = VoxelLocation(location, {0, y, 0}).y;
+		if (worldY < -3) return m_stone;
+		if (worldY < -1) return m_dirt;
+		if (worldY == -1) return m_grass;
+		return m_air;
+	};
+	chunk.setUniform(VoxelHolder(m_air));
+	for (int y = 0; y < VOXEL_CHUNK_SIZE;) {
+		auto &type = layerType(y);
+		int toY = y;
+		while (toY + 1 < VOXEL_CHUNK_SIZE && &layerType(toY + 1) == &type) {
+			toY++;
 		}
+		if (&type != &m_air) {
+			chunk.fill({0, y, 0}, {VOXEL_CHUNK_SIZE - 1, toY, VOXEL_CHUNK_SIZE - 1}, VoxelHolder(type), false);
+		}
+		y = toY + 1;
+	}
+	
+	VoxelLocation stoneLocation(3, -1, -4);
+	if (stoneLocation.chunk() == location) {
+		chunk.fill(stoneLocation.inChunk(), stoneLocation.inChunk(), VoxelHolder(m_stone), false);
 	}
 }
@@ -24,11 +24,33 @@ void VoxelWorldStorageJob::operator()() const {
 			break;
 		}
 		case VoxelWorldStorageAction::STORE: {
-			auto ref = world->chunk(location);
-			if (ref) {
-				storage->store(ref);
-				ref.unlock();
-				world->chunkStored(location);
+			// The chunk is locked only while it is copied, so writers don't wait for serialization and SQLite
+			VoxelChunkSnapshot snapshot;
+			unsigned long version;
+			bool lightComputed = false;
+			{
+				auto ref = world->chunk(location);
+				if (!ref) break;
+				switch (ref.lightState()) {
+					case VoxelChunkLightState::PENDING_INITIAL:
+					case VoxelChunkLightState::PENDING_INCREMENTAL:
+					case VoxelChunkLightState::COMPUTING:
+						break;
+					case VoxelChunkLightState::READY:
+					case VoxelChunkLightState::COMPLETE:
+						lightComputed = true;
+						break;
+				}
+				if (lightComputed) {
+					snapshot = ref.snapshot();
+				}
+				version = ref.version();
+			}
+			if (snapshot) {
+				storage->store(*snapshot);
+			}
+			if (!world->chunkStored(location, version)) {
+				storage->storeChunkAsync(*world, location);
 			}
 			break;
 		}
@@ -75,8 +97,12 @@ void VoxelWorldStorage::openDatabase() {
 			"	y INTEGER NOT NULL,\n"
    			"	z INTEGER NOT NULL,\n"
 	  		"	data BLOB NOT NULL,\n"
+			"	light_format INTEGER NOT NULL DEFAULT 0,\n"
 	 		"	PRIMARY KEY(x, y, z)\n"
-	 		");\n";
+	 		");\n"
+			"CREATE TABLE IF NOT EXISTS world_info (\n"
+			"	chunk_size INTEGER NOT NULL\n"
+			");\n";
 	if (sqlite3_exec(m_database, initSql, nullptr, nullptr, &errorMsg) != SQLITE_OK) {
 		LOG(ERROR) << "Failed to init database: " << errorMsg;
 		sqlite3_free(errorMsg);
@@ -84,8 +110,76 @@ void VoxelWorldStorage::openDatabase() {
 		return;
 	}
 	
-	static const char *queryVoxelTypesSql = "SELECT id, name FROM voxel_types ORDER BY id";
+	// Worlds stored before the chunk size was recorded were always 16
+	static const char *queryChunkSizeSql =
+			"SELECT COALESCE((SELECT chunk_size FROM world_info), (SELECT 16 FROM chunks LIMIT 1), ?)";
 	sqlite3_stmt *stmt = nullptr;
+	retVal = sqlite3_prepare_v2(m_database, queryChunkSizeSql, -1, &stmt, nullptr);
+	if (retVal != SQLITE_OK) {
+		LOG(ERROR) << "Failed to prepare query chunk size SQL statement: " << sqlite3_errmsg(m_database);
+		closeDatabase();
+		return;
+	}
+	sqlite3_bind_int(stmt, 1, VOXEL_CHUNK_SIZE);
+	retVal = sqlite3_step(stmt);
+	int chunkSize = retVal == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+	sqlite3_finalize(stmt);
+	if (retVal != SQLITE_ROW) {
+		LOG(ERROR) << "Failed to execute query chunk size SQL statement: " << sqlite3_errmsg(m_database);
+		closeDatabase();
+		return;
+	}
+	if (chunkSize != VOXEL_CHUNK_SIZE) {
+		LOG(ERROR) << "Database \"" << m_fileName << "\" stores chunks of size " << chunkSize <<
+			", but the server was built with " << VOXEL_CHUNK_SIZE;
+		closeDatabase();
+		return;
+	}
+	static const char *insertChunkSizeSql =
+			"INSERT INTO world_info (chunk_size) SELECT ? WHERE NOT EXISTS (SELECT 1 FROM world_info)";
+	retVal = sqlite3_prepare_v2(m_database, insertChunkSizeSql, -1, &stmt, nullptr);
+	if (retVal == SQLITE_OK) {
+		sqlite3_bind_int(stmt, 1, chunkSize);
+		retVal = sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+	}
+	if (retVal != SQLITE_DONE) {
+		LOG(ERROR) << "Failed to store chunk size: " << sqlite3_errmsg(m_database);
+		closeDatabase();
+		return;
+	}
+	
+	// Chunks stored before the light was split into the sky and block channels have no light format. Their light is
+	// recomputed once on load, then they are stored with the current format
+	static const char *queryLightFormatColumnSql =
+			"SELECT COUNT(*) FROM pragma_table_info('chunks') WHERE name = 'light_format'";
+	retVal = sqlite3_prepare_v2(m_database, queryLightFormatColumnSql, -1, &stmt, nullptr);
+	if (retVal != SQLITE_OK) {
+		LOG(ERROR) << "Failed to prepare query light format SQL statement: " << sqlite3_errmsg(m_database);
+		closeDatabase();
+		return;
+	}
+	retVal = sqlite3_step(stmt);
+	bool hasLightFormat = retVal == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+	sqlite3_finalize(stmt);
+	if (retVal != SQLITE_ROW) {
+		LOG(ERROR) << "Failed to execute query light format SQL statement: " << sqlite3_errmsg(m_database);
+		closeDatabase();
+		return;
+	}
+	if (!hasLightFormat) {
+		LOG(WARNING) << "Database \"" << m_fileName << "\" stores no light format, " <<
+			"the light of its chunks will be recomputed on load";
+		static const char *addLightFormatSql = "ALTER TABLE chunks ADD COLUMN light_format INTEGER NOT NULL DEFAULT 0";
+		if (sqlite3_exec(m_database, addLightFormatSql, nullptr, nullptr, &errorMsg) != SQLITE_OK) {
+			LOG(ERROR) << "Failed to add light format column: " << errorMsg;
+			sqlite3_free(errorMsg);
+			closeDatabase();
+			return;
+		}
+	}
+	
+	static const char *queryVoxelTypesSql = "SELECT id, name FROM voxel_types ORDER BY id";
 	retVal = sqlite3_prepare_v2(m_database, queryVoxelTypesSql, -1, &stmt, nullptr);
 	if (retVal != SQLITE_OK) {
 		LOG(ERROR) << "Failed to prepare query voxel types SQL statement: " << sqlite3_errmsg(m_database);
@@ -138,7 +232,8 @@ void VoxelWorldStorage::openDatabase() {
 	}
 	sqlite3_finalize(stmt);
 	
-	static const char *storeChunkSql = "INSERT OR REPLACE INTO chunks (x, y, z, data) VALUES (?, ?, ?, ?)";
+	static const char *storeChunkSql =
+			"INSERT OR REPLACE INTO chunks (x, y, z, data, light_format) VALUES (?, ?, ?, ?, ?)";
 	retVal = sqlite3_prepare_v2(m_database, storeChunkSql, -1, &m_storeChunkStmt, nullptr);
 	if (retVal != SQLITE_OK) {
 		LOG(ERROR) << "Failed to prepare store chunk SQL statement: " << sqlite3_errmsg(m_database);
@@ -168,7 +263,8 @@ void VoxelWorldStorage::load(VoxelChunkMutableRef &chunk) {
 			std::unique_lock<std::shared_mutex> lock(m_loadChunkStmtsMutex);
 			it = m_loadChunkStmts.find(threadId);
 			if (it == m_loadChunkStmts.end()) {
-				static const char *loadChunkSql = "SELECT data FROM chunks WHERE x = ? AND y = ? AND Z = ? LIMIT 1";
+				static const char *loadChunkSql =
+						"SELECT data, light_format FROM chunks WHERE x = ? AND y = ? AND Z = ? LIMIT 1";
 				auto retVal = sqlite3_prepare_v2(m_database, loadChunkSql, -1, &stmt, nullptr);
 				if (retVal != SQLITE_OK) {
 					LOG(ERROR) << "Failed to prepare load chunk SQL statement: " << sqlite3_errmsg(m_database);
@@ -196,8 +292,12 @@ void VoxelWorldStorage::load(VoxelChunkMutableRef &chunk) {
 			std::string buffer((const char*) data, dataSize);
 			VoxelDeserializer deserializer(m_serializationContext, buffer.cbegin(), buffer.cend());
 			deserializer.object(chunk);
+			// Light stored in another format is not trusted, the chunk stays PENDING_INITIAL to get it recomputed
+			bool lightValid = sqlite3_column_int(stmt, 1) == LIGHT_FORMAT;
 			sqlite3_reset(stmt);
-			chunk.setLightState(VoxelChunkLightState::READY);
+			if (lightValid) {
+				chunk.setLightState(VoxelChunkLightState::READY);
+			}
 			chunk.setUpdatedAt(0);
 			chunk.setStoredAt(0);
 			return;
@@ -211,17 +311,7 @@ void VoxelWorldStorage::load(VoxelChunkMutableRef &chunk) {
 	m_generator.load(chunk);
 }
 
-void VoxelWorldStorage::store(const VoxelChunkRef &chunk) {
-	if (!chunk) return;
-	switch (chunk.lightState()) {
-		case VoxelChunkLightState::PENDING_INITIAL:
-		case VoxelChunkLightState::PENDING_INCREMENTAL:
-		case VoxelChunkLightState::COMPUTING:
-			return;
-		case VoxelChunkLightState::READY:
-		case VoxelChunkLightState::COMPLETE:
-			break;
-	}
+void VoxelWorldStorage::store(const VoxelChunk &chunk) {
 	auto &l = chunk.location();
 	LOG(DEBUG) << "Storing chunk at x=" << l.x << ",y=" << l.y << ",z=" << l.z;
 	std::string buffer;
@@ -231,6 +321,7 @@ void VoxelWorldStorage::store(const VoxelChunkRef &chunk) {
 	sqlite3_bind_int(m_storeChunkStmt, 2, l.y);
 	sqlite3_bind_int(m_storeChunkStmt, 3, l.z);
 	sqlite3_bind_blob(m_storeChunkStmt, 4, buffer.data(), buffer.size(), SQLITE_STATIC);
+	sqlite3_bind_int(m_storeChunkStmt, 5, LIGHT_FORMAT);
 	if (sqlite3_step(m_storeChunkStmt) != SQLITE_DONE) {
 		LOG(ERROR) << "Failed to store chunk at x=" << l.x << ",y=" << l.y << ",z=" << l.z << ": " <<
 				   sqlite3_errmsg(m_database);
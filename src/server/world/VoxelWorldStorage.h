@@ -37,6 +37,9 @@ struct VoxelWorldStorageJob {
 };
 
 class VoxelWorldStorage: public VoxelChunkLoader, public Worker<VoxelWorldStorageJob> {
+	// Bumped whenever the meaning of the stored voxel light changes
+	static constexpr int LIGHT_FORMAT = 1;
+	
 	std::string m_fileName;
 	sqlite3 *m_database = nullptr;
 	std::unordered_map<std::thread::id, sqlite3_stmt*> m_loadChunkStmts;
@@ -48,7 +51,7 @@ class VoxelWorldStorage: public VoxelChunkLoader, public Worker<VoxelWorldStorag
 	
 	void openDatabase();
 	void closeDatabase();
-	void store(const VoxelChunkRef &chunk);
+	void store(const VoxelChunk &chunk);
 	
 	friend struct VoxelWorldStorageJob;
 	
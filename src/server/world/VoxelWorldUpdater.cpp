@@ -24,31 +24,14 @@ void VoxelWorldUpdater::run() {
 	while (m_running) {
 		auto nextUpdateTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
 		chunkLocations.clear();
-		m_world.forEachChunkLocation([&chunkLocations](const VoxelChunkLocation &location) {
-			chunkLocations.emplace_back(location);
-		});
+		m_world.updatableChunkLocations(chunkLocations);
 		unsigned int pendingVoxelCount = 0;
-		for (auto &chunkLocation : chunkLocations) {
-			auto chunk = m_world.extendedMutableChunk(chunkLocation);
-			if (!chunk) continue;
-			bool complete = chunk.lightState() == VoxelChunkLightState::COMPLETE;
-			for (int dz = -1; dz <= 1 && complete; dz++) {
-				for (int dy = -1; dy <= 1 && complete; dy++) {
-					for (int dx = -1; dx <= 1 && complete; dx++) {
-						if (dx == 0 && dy == 0 && dz == 0) continue;
-						if (!chunk.hasNeighbor(dx, dy, dz)) {
-							complete = false;
-						}
-					}
-				}
-			}
-			if (!complete) {
-				chunk.unlock();
-				continue;
-			}
+		m_world.forEachChunk<VoxelChunkExtendedMutableRef>(chunkLocations, [&](VoxelChunkExtendedMutableRef &chunk) {
+			// The state could change after the locations were taken, neighbors being unloaded are not locked
+			if (chunk.lightState() != VoxelChunkLightState::COMPLETE || !chunk.hasAllNeighbors()) return;
 			chunk.update(time);
 			pendingVoxelCount += chunk.pendingVoxelCount();
-		}
+		});
 		time++;
 		m_pendingVoxelCount = pendingVoxelCount;
 		if (nextUpdateTime > std::chrono::steady_clock::now()) {
@@ -86,11 +86,11 @@ void EntityPhysics::applyMovementConstraint(
 				if (!(dx == -width || dx == width
 					  || dz == -width || dz == width
 					  || dy == -1 || dy == height)) continue;
-				if (!chunk.extendedAt(
+				if (!chunk.extendedHasDensity(
 						(int) lroundf(prevPosition.x /* - (float) chunkLocationZero.x */ + (float) dx),
 						(int) lroundf(prevPosition.y /* - (float) chunkLocationZero.y */ + (float) dy),
 						(int) lroundf(prevPosition.z /* - (float) chunkLocationZero.z */ + (float) dz)
-				).hasDensity()) {
+				)) {
 					continue;
 				}
 				if ((dx > 0) && (dy > -1) && (dy < height) && (dz > -width) && (dz < width)) {              //x
@@ -127,11 +127,11 @@ void EntityPhysics::applyMovementConstraint(
 				if (!(dx == -width || dx == width
 					  || dz == -width || dz == width
 					  || dy == -1 || dy == height)) continue;
-				if (!chunk.extendedAt(
+				if (!chunk.extendedHasDensity(
 						(int) lroundf(prevPosition.x /* - (float) chunkLocationZero.x */ + (float) dx),
 						(int) lroundf(prevPosition.y /* - (float) chunkLocationZero.y */ + (float) dy),
 						(int) lroundf(prevPosition.z /* - (float) chunkLocationZero.z */ + (float) dz)
-				).hasDensity()) {
+				)) {
 					continue;
 				}
 				constraintMovementAxis(
@@ -162,11 +162,11 @@ void EntityPhysics::applyMovementConstraint(
 		for (int dy = -1; dy <= height; dy += height + 1) {
 			for (int dz = -width; dz <= width; dz += 2 * width) {
 				//if (dx == 0 && dy == 0 && dz == 0) continue;
-				if (!chunk.extendedAt(
+				if (!chunk.extendedHasDensity(
 						(int) lroundf(prevPosition.x /* - (float) chunkLocationZero.x */ + (float) dx),
 						(int) lroundf(prevPosition.y /* - (float) chunkLocationZero.y */ + (float) dy),
 						(int) lroundf(prevPosition.z /* - (float) chunkLocationZero.z */ + (float) dz)
-				).hasDensity()) {
+				)) {
 					continue;
 				}
 				if ((dx > 0) && (dy > 0) && (dz > 0)) {        //x y z
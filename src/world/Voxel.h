@@ -1,6 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <climits>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <vector>
@@ -70,9 +72,65 @@ typedef bitsery::Deserializer<bitsery::InputBufferAdapter<std::string>, const Vo
 typedef int8_t VoxelLightLevel;
 static const VoxelLightLevel MAX_VOXEL_LIGHT_LEVEL = 16;
 
+/*
+ * Light of a voxel in two 4-bit channels: skylight and light of emitting voxels (block light). They propagate and are
+ * updated independently. Full skylight falls down without fading, a day/night cycle can scale the sky channel alone.
+ */
+struct VoxelLight {
+	static constexpr int MAX_LEVEL = 15;
+	
+	uint8_t value = 0;
+	
+	constexpr VoxelLight() = default;
+	constexpr VoxelLight(int sky, int block): value((uint8_t) (sky << 4 | block)) {
+	}
+	
+	[[nodiscard]] constexpr int sky() const {
+		return value >> 4;
+	}
+	
+	[[nodiscard]] constexpr int block() const {
+		return value & 0xF;
+	}
+	
+	// Both channels on the MAX_VOXEL_LIGHT_LEVEL scale, skylight counts one level above block light
+	[[nodiscard]] constexpr VoxelLightLevel level() const {
+		return (VoxelLightLevel) std::max(sky() > 0 ? sky() + 1 : 0, block());
+	}
+	
+	constexpr bool operator==(const VoxelLight &light) const = default;
+	
+	static constexpr VoxelLight fullSky() {
+		return {MAX_LEVEL, 0};
+	}
+	
+};
+
+/*
+ * Answers of the hot per-voxel queries, frozen by VoxelTypeRegistry::link() for types whose answers don't depend on
+ * the voxel state. Until then (and for stateful types) the properties stay dynamic and VoxelHolder falls back to the
+ * virtual methods.
+ */
+struct VoxelTypeProperties {
+	const VoxelShaderProvider *shaderProvider = nullptr;
+	int priority = INT_MIN; // INT_MIN if there is no shader provider
+	VoxelLightLevel lightLevel = 0;
+	bool empty = false;
+	bool opaque = false;
+	bool hasDensity = true;
+	bool dynamic = true;
+};
+
 class VoxelTypeInterface {
+	VoxelTypeProperties m_properties;
+	
+	friend class VoxelTypeRegistry;
+	
 public:
 	virtual ~VoxelTypeInterface() = default;
+	[[nodiscard]] const VoxelTypeProperties &properties() const {
+		return m_properties;
+	}
 	virtual void invokeHandleRegistration(const std::string &name, VoxelTypeRegistry &registry) = 0;
 	virtual void invokeLink(VoxelTypeRegistry &registry) = 0;
 	virtual Voxel &invokeInit(void *ptr) = 0;
@@ -81,6 +139,7 @@ public:
 	virtual void invokeDestroy(Voxel &voxel) = 0;
 	virtual const void *invokeTraitState(const Voxel &voxel, const std::type_info &typeInfo) = 0;
 	virtual void invokeSerialize(const Voxel &voxel, VoxelSerializer &serializer) = 0;
+	virtual void invokeSerialize(const Voxel &voxel, VoxelSerializer &serializer, VoxelLight light) = 0;
 	virtual void invokeDeserialize(Voxel &voxel, VoxelDeserializer &deserializer) = 0;
 	virtual std::string invokeToString(const Voxel &voxel) = 0;
 	virtual const VoxelShaderProvider *invokeShaderProvider(const Voxel &voxel) = 0;
@@ -105,6 +164,10 @@ public:
 			std::unordered_set<InChunkVoxelLocation> &invalidatedLocations
 	) = 0;
 	virtual bool invokeHasDensity(const Voxel &voxel) = 0;
+	virtual bool invokeHasState() = 0;
+	virtual bool invokeHasTrivialData() = 0;
+	virtual bool invokeHasUpdate() = 0;
+	virtual bool invokeHasSlowUpdate() = 0;
 	
 };
 
@@ -191,11 +254,11 @@ namespace bitsery::traits {
 
 struct Voxel {
 	VoxelTypeInterface *type;
-	VoxelLightLevel lightLevel = MAX_VOXEL_LIGHT_LEVEL;
+	VoxelLight light = VoxelLight::fullSky();
 	
 	template<typename S> void serialize(S& s) {
 		s.ext(type, VoxelTypeSerializationHelper {});
-		s.value1b(lightLevel);
+		s.value1b(light.value);
 	}
 	
 };
@@ -541,6 +604,22 @@ private:
 	) {
 	}
 	
+	template<typename Trait> static constexpr bool traitHasUpdateImpl() {
+		if constexpr (std::is_base_of_v<VoxelTypeInterface, Trait>) {
+			return Trait::hasUpdate();
+		} else {
+			return traitHasUpdate<Trait, State>;
+		}
+	}
+	
+	template<typename Trait> static constexpr bool traitHasSlowUpdateImpl() {
+		if constexpr (std::is_base_of_v<VoxelTypeInterface, Trait>) {
+			return Trait::hasSlowUpdate();
+		} else {
+			return traitHasSlowUpdate<Trait, State>;
+		}
+	}
+	
 public:
 	explicit VoxelType(Traits&&... traits): Traits(std::forward<Traits>(traits))... {
 		setType(this);
@@ -596,6 +675,14 @@ public:
 		serializer.object(static_cast<const Data&>(voxel));
 	}
 	
+	// Same layout as Data::serialize, but with the light taken from the caller
+	void invokeSerialize(const Voxel &voxel, VoxelSerializer &serializer, VoxelLight light) override {
+		Voxel header = voxel;
+		header.light = light;
+		serializer.object(header);
+		serializer.object(static_cast<const State&>(static_cast<const Data&>(voxel)));
+	}
+	
 	void invokeDeserialize(Voxel &voxel, VoxelDeserializer &deserializer) override {
 		invokeInit(&voxel);
 		deserializer.object(static_cast<Data&>(voxel));
@@ -712,6 +799,42 @@ public:
 		return static_cast<T*>(this)->T::hasDensity(static_cast<const Data&>(voxel));
 	}
 	
+	static constexpr bool hasState() {
+		return !std::is_empty_v<State>;
+	}
+	
+	bool invokeHasState() override {
+		return T::hasState();
+	}
+	
+	// Voxels of such types can be copied and overwritten with memcpy
+	static constexpr bool hasTrivialData() {
+		return std::is_trivially_copyable_v<Data>;
+	}
+	
+	bool invokeHasTrivialData() override {
+		return T::hasTrivialData();
+	}
+	
+	// True if T or any of its traits overrides update(), i.e. update() is not a no-op
+	static constexpr bool hasUpdate() {
+		return !std::is_same_v<decltype(&T::update), decltype(&VoxelType::update)> ||
+			(traitHasUpdateImpl<Traits>() || ...);
+	}
+	
+	bool invokeHasUpdate() override {
+		return T::hasUpdate();
+	}
+	
+	static constexpr bool hasSlowUpdate() {
+		return !std::is_same_v<decltype(&T::slowUpdate), decltype(&VoxelType::slowUpdate)> ||
+			(traitHasSlowUpdateImpl<Traits>() || ...);
+	}
+	
+	bool invokeHasSlowUpdate() override {
+		return T::hasSlowUpdate();
+	}
+	
 };
 
 class EmptyVoxelType: public VoxelType<EmptyVoxelType> {
@@ -752,20 +875,20 @@ public:
 	
 	VoxelHolder &operator=(const VoxelHolder &holder) {
 		if (this != &holder) {
-			auto savedLightLevel = lightLevel();
+			auto savedLight = light();
 			get().type->invokeDestroy(get());
 			holder.type().invokeInit(m_data, holder.get());
-			setLightLevel(savedLightLevel);
+			setLight(savedLight);
 		}
 		return *this;
 	}
 	
 	VoxelHolder &operator=(VoxelHolder &&holder) noexcept {
 		if (this != &holder) {
-			auto savedLightLevel = lightLevel();
+			auto savedLight = light();
 			get().type->invokeDestroy(get());
 			holder.type().invokeInit(m_data, std::move(holder.get()));
-			setLightLevel(savedLightLevel);
+			setLight(savedLight);
 		}
 		return *this;
 	}
@@ -774,6 +897,14 @@ public:
 		get().type->invokeDestroy(get());
 	}
 	
+	// Same as operator=, but without virtual calls. Both types must have trivial data
+	void assignTrivially(const VoxelHolder &holder) {
+		assert(type().invokeHasTrivialData() && holder.type().invokeHasTrivialData());
+		auto savedLight = light();
+		memcpy(m_data, holder.m_data, sizeof(m_data));
+		setLight(savedLight);
+	}
+	
 	template<typename T=Voxel> [[nodiscard]] const T &get() const {
 		auto state = getTraitState<T>(*reinterpret_cast<const Voxel*>(m_data));
 		assert(state != nullptr);
@@ -791,22 +922,23 @@ public:
 	}
 	
 	void setType(VoxelTypeInterface &newType) {
-		auto savedLightLevel = lightLevel();
+		auto savedLight = light();
 		get().type->invokeDestroy(get());
 		newType.invokeInit(m_data);
-		setLightLevel(savedLightLevel);
+		setLight(savedLight);
 	}
 	
-	[[nodiscard]] VoxelLightLevel lightLevel() const {
-		return get().lightLevel;
+	[[nodiscard]] VoxelLight light() const {
+		return get().light;
 	}
 	
-	void setLightLevel(VoxelLightLevel level) {
-		get().lightLevel = level;
+	void setLight(VoxelLight light) {
+		get().light = light;
 	}
 	
 	[[nodiscard]] VoxelLightLevel typeLightLevel() const {
-		return get().type->invokeLightLevel(get());
+		auto &properties = type().properties();
+		return properties.dynamic ? get().type->invokeLightLevel(get()) : properties.lightLevel;
 	}
 	
 	[[nodiscard]] std::string toString() const {
@@ -814,7 +946,27 @@ public:
 	}
 	
 	[[nodiscard]] const VoxelShaderProvider *shaderProvider() const {
-		return get().type->invokeShaderProvider(get());
+		auto &properties = type().properties();
+		return properties.dynamic ? get().type->invokeShaderProvider(get()) : properties.shaderProvider;
+	}
+	
+	// Priority of the shader provider, INT_MIN for invisible voxels
+	[[nodiscard]] int shaderProviderPriority() const {
+		auto &properties = type().properties();
+		if (properties.dynamic) {
+			auto shaderProvider = get().type->invokeShaderProvider(get());
+			return shaderProvider != nullptr ? shaderProvider->priority() : INT_MIN;
+		}
+		return properties.priority;
+	}
+	
+	// Opaque voxels don't let light through
+	[[nodiscard]] bool opaque() const {
+		return shaderProviderPriority() >= MAX_VOXEL_SHADER_PRIORITY;
+	}
+	
+	[[nodiscard]] bool empty() const {
+		return &type() == &EmptyVoxelType::INSTANCE;
 	}
 	
 	void buildVertexData(
@@ -829,6 +981,10 @@ public:
 		get().type->invokeSerialize(get(), serializer);
 	}
 	
+	void serialize(VoxelSerializer &serializer, VoxelLight light) const {
+		get().type->invokeSerialize(get(), serializer, light);
+	}
+	
 	void serialize(VoxelDeserializer &deserializer);
 	
 	void slowUpdate(
@@ -849,7 +1005,8 @@ public:
 	}
 	
 	[[nodiscard]] bool hasDensity() const {
-		return get().type->invokeHasDensity(get());
+		auto &properties = type().properties();
+		return properties.dynamic ? get().type->invokeHasDensity(get()) : properties.hasDensity;
 	}
 	
 };
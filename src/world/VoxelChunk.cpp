@@ -1,4 +1,539 @@
+#include <cassert>
 #include "VoxelChunk.h"
 
-VoxelChunk::VoxelChunk(const VoxelChunkLocation &location): m_location(location), m_data() {
+void VoxelChunkMask::fill(bool value) {
+	m_words.fill(value ? ~(uint64_t) 0 : 0);
+}
+
+VoxelChunkMask VoxelChunkMask::shifted(int bits) const {
+	VoxelChunkMask result;
+	if (bits >= 0) {
+		size_t wordShift = bits / 64;
+		size_t bitShift = bits % 64;
+		for (size_t i = wordShift; i < WORD_COUNT; i++) {
+			auto word = m_words[i - wordShift] << bitShift;
+			if (bitShift > 0 && i > wordShift) {
+				word |= m_words[i - wordShift - 1] >> (64 - bitShift);
+			}
+			result.m_words[i] = word;
+		}
+	} else {
+		size_t wordShift = -bits / 64;
+		size_t bitShift = -bits % 64;
+		for (size_t i = 0; i + wordShift < WORD_COUNT; i++) {
+			auto word = m_words[i + wordShift] >> bitShift;
+			if (bitShift > 0 && i + wordShift + 1 < WORD_COUNT) {
+				word |= m_words[i + wordShift + 1] << (64 - bitShift);
+			}
+			result.m_words[i] = word;
+		}
+	}
+	return result;
+}
+
+VoxelChunkMask VoxelChunkMask::interior() const {
+	static const VoxelChunkMask inner = []() {
+		VoxelChunkMask mask;
+		VoxelChunk::forEachInBox(
+				{1, 1, 1},
+				{VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2},
+				[&mask](size_t index) {
+					mask.set(index, true);
+				}
+		);
+		return mask;
+	}();
+	// Shifting a row into the next one only breaks bits on the boundary which are cleared anyway
+	auto result = *this;
+	result &= inner;
+	static const int offsets[] = {
+		1, -1,
+		VOXEL_CHUNK_SIZE, -VOXEL_CHUNK_SIZE,
+		VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE, -VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE
+	};
+	for (auto offset : offsets) {
+		result &= shifted(offset);
+	}
+	return result;
+}
+
+// Remembers whether the last seen type has trivial data, consecutive voxels usually share the type
+class TrivialDataCache {
+	const VoxelTypeInterface *m_type = nullptr;
+	bool m_trivial = false;
+	
+public:
+	bool operator()(const VoxelHolder &voxel) {
+		auto &type = voxel.type();
+		if (&type != m_type) {
+			m_type = &type;
+			m_trivial = type.invokeHasTrivialData();
+		}
+		return m_trivial;
+	}
+	
+};
+
+class VoxelChunk::PaletteBuilder {
+	std::vector<VoxelHolder> m_palette;
+	std::unordered_map<uint16_t, VoxelHolder> m_statefulVoxels;
+	std::vector<uint16_t> m_indices;
+	size_t m_lastIndex = 0;
+	
+	static const uint16_t STATEFUL_INDEX = UINT16_MAX;
+	
+	static bool matches(const VoxelHolder &a, const VoxelHolder &b) {
+		return &a.type() == &b.type();
+	}
+	
+public:
+	PaletteBuilder(): m_indices(VOXEL_CHUNK_VOLUME) {
+	}
+	
+	// Moves the voxel into the builder on success, leaves it untouched if the chunk can't be compacted
+	template<typename H> bool add(size_t index, H &voxel) {
+		if (voxel.type().invokeHasState()) {
+			if (m_statefulVoxels.size() >= MAX_VOXEL_CHUNK_STATEFUL_VOXEL_COUNT) return false;
+			if (m_palette.size() + 1 > MAX_VOXEL_CHUNK_PALETTE_SIZE) return false;
+			m_statefulVoxels.emplace(index, std::move(voxel));
+			m_indices[index] = STATEFUL_INDEX;
+			return true;
+		}
+		if (m_lastIndex >= m_palette.size() || !matches(m_palette[m_lastIndex], voxel)) {
+			m_lastIndex = 0;
+			while (m_lastIndex < m_palette.size() && !matches(m_palette[m_lastIndex], voxel)) {
+				m_lastIndex++;
+			}
+			if (m_lastIndex == m_palette.size()) {
+				if (m_palette.size() + (m_statefulVoxels.empty() ? 0 : 1) >= MAX_VOXEL_CHUNK_PALETTE_SIZE) {
+					return false;
+				}
+				m_palette.emplace_back(std::move(voxel));
+			}
+		}
+		m_indices[index] = m_lastIndex;
+		return true;
+	}
+	
+	[[nodiscard]] const VoxelHolder &at(size_t index) const {
+		auto i = m_indices[index];
+		return i == STATEFUL_INDEX ? m_statefulVoxels.at(index) : m_palette[i];
+	}
+	
+	void build(VoxelChunk &chunk) {
+		chunk.m_data = std::vector<VoxelHolder>();
+		chunk.m_palette = std::move(m_palette);
+		chunk.m_statefulVoxels = std::move(m_statefulVoxels);
+		chunk.resetPaletteIndices();
+		if (chunk.m_paletteIndexBits > 0) {
+			for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+				auto i = m_indices[index];
+				chunk.setPaletteIndex(index, i == STATEFUL_INDEX ? chunk.m_palette.size() : i);
+			}
+		}
+	}
+	
+};
+
+VoxelChunk::VoxelChunk(const VoxelChunkLocation &location): m_location(location), m_palette(1) {
+	rebuildMasks();
+}
+
+unsigned int VoxelChunk::paletteIndex(size_t index) const {
+	if (m_paletteIndexBits == 0) {
+		return 0;
+	}
+	auto bitIndex = index * m_paletteIndexBits;
+	auto mask = (1ul << m_paletteIndexBits) - 1;
+	return (unsigned int) ((m_paletteIndices[bitIndex / 64] >> (bitIndex % 64)) & mask);
+}
+
+void VoxelChunk::setPaletteIndex(size_t index, unsigned int paletteIndex) {
+	auto bitIndex = index * m_paletteIndexBits;
+	auto mask = (uint64_t) ((1ul << m_paletteIndexBits) - 1);
+	auto &word = m_paletteIndices[bitIndex / 64];
+	word = (word & ~(mask << (bitIndex % 64))) | ((uint64_t) paletteIndex << (bitIndex % 64));
+}
+
+const VoxelHolder &VoxelChunk::compactedAt(size_t index) const {
+	auto i = paletteIndex(index);
+	if (i < m_palette.size()) {
+		return m_palette[i];
+	}
+	return m_statefulVoxels.at(index);
+}
+
+void VoxelChunk::clearPalette() {
+	m_palette.clear();
+	m_paletteIndices.clear();
+	m_paletteIndexBits = 0;
+	m_statefulVoxels.clear();
+}
+
+void VoxelChunk::resetPaletteIndices() {
+	auto indexCount = m_palette.size() + (m_statefulVoxels.empty() ? 0 : 1);
+	m_paletteIndexBits = 0;
+	if (indexCount > 1) {
+		m_paletteIndexBits = 1;
+		while ((1u << m_paletteIndexBits) < indexCount) {
+			m_paletteIndexBits *= 2;
+		}
+	}
+	m_paletteIndices.assign((VOXEL_CHUNK_VOLUME * m_paletteIndexBits + 63) / 64, 0);
+}
+
+void VoxelChunk::setUniform(const VoxelHolder &voxel) {
+	VoxelHolder value(voxel);
+	if (value.type().invokeHasState()) {
+		expand();
+		for (auto &v : m_data) {
+			v = value;
+		}
+		rebuildMasks();
+		return;
+	}
+	m_data = std::vector<VoxelHolder>();
+	clearPalette();
+	m_palette.emplace_back(std::move(value));
+	rebuildMasks();
+}
+
+void VoxelChunk::assign(const VoxelChunk &chunk) {
+	m_location = chunk.m_location;
+	m_data = chunk.m_data;
+	m_palette = chunk.m_palette;
+	m_paletteIndices = chunk.m_paletteIndices;
+	m_paletteIndexBits = chunk.m_paletteIndexBits;
+	m_statefulVoxels = chunk.m_statefulVoxels;
+	m_light = chunk.m_light;
+	m_uniformLight = chunk.m_uniformLight;
+	m_densityMask = chunk.m_densityMask;
+	m_opaqueMask = chunk.m_opaqueMask;
+	m_emptyMask = chunk.m_emptyMask;
+	m_heightmap = chunk.m_heightmap;
+	m_heightmapValid = chunk.m_heightmapValid;
+}
+
+void VoxelChunk::reset(const VoxelChunkLocation &location) {
+	m_location = location;
+	m_data = std::vector<VoxelHolder>();
+	clearPalette();
+	m_palette.emplace_back();
+	m_light.clear();
+	m_uniformLight = VoxelLight::fullSky();
+	rebuildMasks();
+}
+
+void VoxelChunk::updateMasks(size_t index) {
+	auto &voxel = at(index);
+	m_densityMask.set(index, voxel.hasDensity());
+	m_opaqueMask.set(index, voxel.opaque());
+	m_emptyMask.set(index, voxel.empty());
+	m_heightmapValid = false;
+}
+
+void VoxelChunk::rebuildMasks() {
+	m_heightmapValid = false;
+	if (uniform()) {
+		auto &voxel = m_palette.front();
+		m_densityMask.fill(voxel.hasDensity());
+		m_opaqueMask.fill(voxel.opaque());
+		m_emptyMask.fill(voxel.empty());
+		return;
+	}
+	for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+		updateMasks(index);
+	}
+}
+
+bool VoxelChunk::blocksSkyLight(size_t index) const {
+	return m_opaqueMask.test(index) || at(index).typeLightLevel() < 0;
+}
+
+const VoxelChunkHeightmap &VoxelChunk::heightmap() {
+	if (m_heightmapValid) return m_heightmap;
+	if (uniform()) {
+		m_heightmap.fill((int8_t) (blocksSkyLight(0) ? VOXEL_CHUNK_SIZE - 1 : -1));
+	} else {
+		for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
+			for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
+				int y = VOXEL_CHUNK_SIZE - 1;
+				while (y >= 0 && !blocksSkyLight(voxelIndex(x, y, z))) {
+					y--;
+				}
+				m_heightmap[columnIndex(x, z)] = (int8_t) y;
+			}
+		}
+	}
+	m_heightmapValid = true;
+	return m_heightmap;
+}
+
+bool VoxelChunk::compactedFill(
+		const InChunkVoxelLocation &from,
+		const InChunkVoxelLocation &to,
+		const VoxelHolder &voxel
+) {
+	assert(m_data.empty());
+	if (voxel.type().invokeHasState()) return false;
+	unsigned int paletteIndex = 0;
+	while (paletteIndex < m_palette.size() && &m_palette[paletteIndex].type() != &voxel.type()) {
+		paletteIndex++;
+	}
+	if (paletteIndex == m_palette.size()) {
+		if (m_palette.size() + (m_statefulVoxels.empty() ? 0 : 1) >= MAX_VOXEL_CHUNK_PALETTE_SIZE) return false;
+		std::vector<uint16_t> indices(VOXEL_CHUNK_VOLUME);
+		for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+			indices[index] = this->paletteIndex(index);
+		}
+		m_palette.emplace_back(voxel);
+		resetPaletteIndices();
+		if (m_paletteIndexBits > 0) {
+			// The stateful marker moves one entry further
+			for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+				auto i = indices[index];
+				setPaletteIndex(index, i == paletteIndex ? m_palette.size() : i);
+			}
+		}
+	}
+	if (m_paletteIndexBits == 0) return true;
+	forEachInBox(from, to, [this, paletteIndex](size_t index) {
+		if (!m_statefulVoxels.empty() && this->paletteIndex(index) == m_palette.size()) {
+			m_statefulVoxels.erase(index);
+		}
+		setPaletteIndex(index, paletteIndex);
+		updateMasks(index);
+	});
+	return true;
+}
+
+void VoxelChunk::fill(const InChunkVoxelLocation &from, const InChunkVoxelLocation &to, const VoxelHolder &voxel) {
+	if (
+			from == InChunkVoxelLocation(0, 0, 0) &&
+			to == InChunkVoxelLocation(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1)
+	) {
+		setUniform(voxel);
+		return;
+	}
+	if (m_data.empty() && compactedFill(from, to, voxel)) return;
+	expand();
+	bool trivial = voxel.type().invokeHasTrivialData();
+	TrivialDataCache isTrivial;
+	forEachInBox(from, to, [this, &voxel, trivial, &isTrivial](size_t index) {
+		auto &v = m_data[index];
+		if (trivial && isTrivial(v)) {
+			v.assignTrivially(voxel);
+		} else {
+			v = voxel;
+		}
+		updateMasks(index);
+	});
+}
+
+void VoxelChunk::copyFrom(
+		const InChunkVoxelLocation &from,
+		const InChunkVoxelLocation &to,
+		std::span<const VoxelHolder> voxels
+) {
+	assert(voxels.size() == (size_t) (to.x - from.x + 1) * (to.y - from.y + 1) * (to.z - from.z + 1));
+	expand();
+	auto it = voxels.begin();
+	TrivialDataCache isSourceTrivial, isTrivial;
+	forEachInBox(from, to, [this, &it, &isSourceTrivial, &isTrivial](size_t index) {
+		auto &v = m_data[index];
+		auto &source = *it++;
+		if (isSourceTrivial(source) && isTrivial(v)) {
+			v.assignTrivially(source);
+		} else {
+			v = source;
+		}
+		updateMasks(index);
+	});
+}
+
+void VoxelChunk::copyFrom(std::span<const VoxelHolder> voxels) {
+	assert(voxels.size() == VOXEL_CHUNK_VOLUME);
+	PaletteBuilder builder;
+	size_t index = 0;
+	while (index < VOXEL_CHUNK_VOLUME && builder.add(index, voxels[index])) {
+		index++;
+	}
+	if (index == VOXEL_CHUNK_VOLUME) {
+		builder.build(*this);
+		rebuildMasks();
+		return;
+	}
+	copyFrom({0, 0, 0}, {VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1}, voxels);
+}
+
+size_t VoxelChunk::replace(
+		VoxelTypeInterface &from,
+		VoxelTypeInterface &to,
+		std::vector<InChunkVoxelLocation> *locations
+) {
+	size_t count = 0;
+	if (&from == &to) return count;
+	if (m_data.empty() && !from.invokeHasState() && !to.invokeHasState()) {
+		// Entries of the replaced type are merged into a single entry, indices are remapped in one pass
+		std::vector<bool> replaced(m_palette.size() + 1);
+		bool found = false;
+		for (size_t i = 0; i < m_palette.size(); i++) {
+			if (&m_palette[i].type() == &from) {
+				replaced[i] = true;
+				found = true;
+			}
+		}
+		if (!found) return count;
+		std::vector<VoxelHolder> palette;
+		std::vector<unsigned int> remap(m_palette.size() + 1);
+		auto toIndex = m_palette.size();
+		for (size_t i = 0; i < m_palette.size(); i++) {
+			if (replaced[i]) continue;
+			if (&m_palette[i].type() == &to && toIndex == m_palette.size()) {
+				toIndex = palette.size();
+			}
+			remap[i] = palette.size();
+			palette.emplace_back(std::move(m_palette[i]));
+		}
+		if (toIndex == m_palette.size()) {
+			toIndex = palette.size();
+			palette.emplace_back(to);
+		}
+		for (size_t i = 0; i < m_palette.size(); i++) {
+			if (replaced[i]) {
+				remap[i] = toIndex;
+			}
+		}
+		remap[m_palette.size()] = palette.size();
+		auto indices = std::move(m_paletteIndices);
+		auto indexBits = m_paletteIndexBits;
+		auto indexMask = (1ul << indexBits) - 1;
+		m_palette = std::move(palette);
+		resetPaletteIndices();
+		for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+			auto bitIndex = index * indexBits;
+			auto i = indexBits == 0 ? 0 : (unsigned int) ((indices[bitIndex / 64] >> (bitIndex % 64)) & indexMask);
+			if (m_paletteIndexBits > 0) {
+				setPaletteIndex(index, remap[i]);
+			}
+			if (!replaced[i]) continue;
+			updateMasks(index);
+			count++;
+			if (locations != nullptr) {
+				locations->emplace_back(voxelLocation(index));
+			}
+		}
+		return count;
+	}
+	expand();
+	VoxelHolder voxel(to);
+	bool trivial = to.invokeHasTrivialData();
+	TrivialDataCache isTrivial;
+	for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+		auto &v = m_data[index];
+		if (&v.type() != &from) continue;
+		if (trivial && isTrivial(v)) {
+			v.assignTrivially(voxel);
+		} else {
+			v = voxel;
+		}
+		updateMasks(index);
+		count++;
+		if (locations != nullptr) {
+			locations->emplace_back(voxelLocation(index));
+		}
+	}
+	return count;
+}
+
+void VoxelChunk::setUniformLight(VoxelLight light) {
+	m_light = std::vector<VoxelLight>();
+	m_uniformLight = light;
+}
+
+void VoxelChunk::compactLight() {
+	if (m_light.empty()) return;
+	auto light = m_light.front();
+	for (auto l : m_light) {
+		if (l != light) return;
+	}
+	setUniformLight(light);
+}
+
+bool VoxelChunk::compact() {
+	compactLight();
+	if (m_data.empty()) return true;
+	PaletteBuilder builder;
+	for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+		const auto &voxel = m_data[index];
+		if (!builder.add(index, voxel)) return false;
+	}
+	builder.build(*this);
+	return true;
+}
+
+void VoxelChunk::expand() {
+	if (!m_data.empty()) return;
+	m_data.reserve(VOXEL_CHUNK_VOLUME);
+	for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+		m_data.emplace_back(compactedAt(index));
+	}
+	clearPalette();
+}
+
+size_t VoxelChunk::memoryUsage() const {
+	return sizeof(VoxelChunk) +
+		m_data.capacity() * sizeof(VoxelHolder) +
+		m_palette.capacity() * sizeof(VoxelHolder) +
+		m_paletteIndices.capacity() * sizeof(uint64_t) +
+		m_light.capacity() * sizeof(VoxelLight) +
+		m_statefulVoxels.size() * (sizeof(uint16_t) + sizeof(VoxelHolder) + sizeof(void*) * 2);
+}
+
+void VoxelChunk::serialize(VoxelSerializer &s) const {
+	if (uniform() && lightUniform()) {
+		std::string buffer;
+		VoxelSerializer serializer(s.context<const VoxelTypeSerializationContext>(), buffer);
+		m_palette.front().serialize(serializer, m_uniformLight);
+		auto size = serializer.adapter().currentWritePos();
+		for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+			s.adapter().writeBuffer<1>(buffer.data(), size);
+		}
+		return;
+	}
+	for (size_t index = 0; index < VOXEL_CHUNK_VOLUME; index++) {
+		at(index).serialize(s, light(index));
+	}
+}
+
+void VoxelChunk::serialize(VoxelDeserializer &s) {
+	std::vector<VoxelLight> light(VOXEL_CHUNK_VOLUME);
+	PaletteBuilder builder;
+	size_t index = 0;
+	for (; index < VOXEL_CHUNK_VOLUME; index++) {
+		VoxelHolder voxel;
+		s.object(voxel);
+		light[index] = voxel.light();
+		if (builder.add(index, voxel)) continue;
+		std::vector<VoxelHolder> data;
+		data.reserve(VOXEL_CHUNK_VOLUME);
+		for (size_t i = 0; i < index; i++) {
+			data.emplace_back(builder.at(i));
+		}
+		data.emplace_back(std::move(voxel));
+		while (data.size() < VOXEL_CHUNK_VOLUME) {
+			auto &v = data.emplace_back();
+			s.object(v);
+			light[data.size() - 1] = v.light();
+		}
+		clearPalette();
+		m_data = std::move(data);
+		break;
+	}
+	if (index == VOXEL_CHUNK_VOLUME) {
+		builder.build(*this);
+	}
+	m_light = std::move(light);
+	compactLight();
+	rebuildMasks();
 }
@@ -1,18 +1,216 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <bit>
+#include <vector>
+#include <span>
+#include <unordered_map>
 #include "Voxel.h"
 #include "VoxelLocation.h"
 
+static const int VOXEL_CHUNK_VOLUME = VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE;
+static_assert(VOXEL_CHUNK_VOLUME < UINT16_MAX, "In-chunk voxel indices are stored as uint16_t");
+static const int MAX_VOXEL_CHUNK_PALETTE_SIZE = 256;
+// An eighth of the chunk at most, small chunks would never give up the palette otherwise
+static const int MAX_VOXEL_CHUNK_STATEFUL_VOXEL_COUNT = std::min(512, VOXEL_CHUNK_VOLUME / 8);
+
+// Per (x, z) column the highest voxel that stops or dims skylight, -1 if the skylight passes the whole column
+typedef std::array<int8_t, VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE> VoxelChunkHeightmap;
+
+// One bit per chunk voxel, indexed the same way as voxels
+class VoxelChunkMask {
+	static const size_t WORD_COUNT = (VOXEL_CHUNK_VOLUME + 63) / 64;
+	
+	std::array<uint64_t, WORD_COUNT> m_words = {};
+	
+	[[nodiscard]] VoxelChunkMask shifted(int bits) const;
+	
+public:
+	// Enumerates indices of the set bits in ascending order
+	class Iterator {
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef size_t value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const size_t *pointer;
+		typedef size_t reference;
+	
+	private:
+		const uint64_t *m_words;
+		size_t m_wordIndex;
+		uint64_t m_word;
+		size_t m_index = SIZE_MAX;
+		
+		void next() {
+			while (m_word == 0) {
+				if (++m_wordIndex >= WORD_COUNT) {
+					m_index = SIZE_MAX;
+					return;
+				}
+				m_word = m_words[m_wordIndex];
+			}
+			m_index = m_wordIndex * 64 + std::countr_zero(m_word);
+			m_word &= m_word - 1;
+		}
+	
+	public:
+		Iterator(const uint64_t *words, size_t wordIndex): m_words(words), m_wordIndex(wordIndex), m_word(0) {
+			if (wordIndex < WORD_COUNT) {
+				m_word = words[wordIndex];
+				next();
+			}
+		}
+		
+		size_t operator*() const {
+			return m_index;
+		}
+		
+		Iterator &operator++() {
+			next();
+			return *this;
+		}
+		
+		bool operator==(const Iterator &it) const {
+			return m_index == it.m_index;
+		}
+		
+	};
+	
+	[[nodiscard]] bool test(size_t index) const {
+		return (m_words[index / 64] >> (index % 64)) & 1;
+	}
+	
+	void set(size_t index, bool value) {
+		auto bit = (uint64_t) 1 << (index % 64);
+		if (value) {
+			m_words[index / 64] |= bit;
+		} else {
+			m_words[index / 64] &= ~bit;
+		}
+	}
+	
+	void fill(bool value);
+	
+	[[nodiscard]] size_t count() const {
+		size_t result = 0;
+		for (auto word : m_words) {
+			result += std::popcount(word);
+		}
+		return result;
+	}
+	
+	[[nodiscard]] const std::array<uint64_t, WORD_COUNT> &words() const {
+		return m_words;
+	}
+	
+	VoxelChunkMask &operator&=(const VoxelChunkMask &mask) {
+		for (size_t i = 0; i < WORD_COUNT; i++) {
+			m_words[i] &= mask.m_words[i];
+		}
+		return *this;
+	}
+	
+	[[nodiscard]] Iterator begin() const {
+		return Iterator(m_words.data(), 0);
+	}
+	
+	[[nodiscard]] Iterator end() const {
+		return Iterator(m_words.data(), WORD_COUNT);
+	}
+	
+	// Voxels whose six neighbors are all set too. Voxels on the chunk boundary are never included
+	[[nodiscard]] VoxelChunkMask interior() const;
+	
+};
+
+/*
+ * A chunk is either expanded (one VoxelHolder per voxel) or compacted. A compacted chunk keeps a palette of
+ * distinct stateless voxel types and a bit-packed palette index per voxel. Voxels with a state
+ * are kept in a side table and marked with the index right past the end of the palette.
+ * A compacted chunk with a single palette entry is uniform and doesn't store indices at all.
+ * Const access works in both modes, mutable access expands the chunk first.
+ * New chunks start uniformly empty.
+ *
+ * Bulk operations (fill, copyFrom, replace) work on inclusive boxes and avoid per-voxel virtual calls where possible:
+ * stateless fills of a compacted chunk only touch palette indices and voxels with trivial data are copied with memcpy.
+ *
+ * The chunk also keeps occupancy masks (voxels with density, opaque voxels and empty voxels) for neighbor queries that
+ * shouldn't touch VoxelHolders. Bulk operations keep them up to date, a voxel changed through mutable at() must be
+ * followed by updateMasks() (SharedVoxelChunk::markDirty() does that). Mask updates also invalidate the skylight
+ * heightmap, it is rebuilt on the next heightmap() call.
+ *
+ * Light levels of the chunk voxels are kept in a separate plane (the light level stored inside VoxelHolder is not
+ * used for them). The plane isn't allocated while all voxels share the same light level.
+ */
 class VoxelChunk {
+	class PaletteBuilder;
+	
 	VoxelChunkLocation m_location;
-	VoxelHolder m_data[VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE];
+	std::vector<VoxelHolder> m_data;
+	std::vector<VoxelHolder> m_palette;
+	std::vector<uint64_t> m_paletteIndices;
+	unsigned int m_paletteIndexBits = 0;
+	std::unordered_map<uint16_t, VoxelHolder> m_statefulVoxels;
+	std::vector<VoxelLight> m_light;
+	VoxelLight m_uniformLight = VoxelLight::fullSky();
+	VoxelChunkMask m_densityMask;
+	VoxelChunkMask m_opaqueMask;
+	VoxelChunkMask m_emptyMask;
+	VoxelChunkHeightmap m_heightmap;
+	bool m_heightmapValid = false;
+	
+	[[nodiscard]] unsigned int paletteIndex(size_t index) const;
+	void setPaletteIndex(size_t index, unsigned int paletteIndex);
+	[[nodiscard]] const VoxelHolder &compactedAt(size_t index) const;
+	void clearPalette();
+	void resetPaletteIndices();
+	bool compactedFill(const InChunkVoxelLocation &from, const InChunkVoxelLocation &to, const VoxelHolder &voxel);
+	void compactLight();
+	void updateMasks(size_t index);
+	void rebuildMasks();
+	[[nodiscard]] bool blocksSkyLight(size_t index) const;
+	
+	[[nodiscard]] const VoxelHolder &at(size_t index) const {
+		return m_data.empty() ? compactedAt(index) : m_data[index];
+	}
 	
+	[[nodiscard]] VoxelLight light(size_t index) const {
+		return m_light.empty() ? m_uniformLight : m_light[index];
+	}
+	
+public:
 	static size_t voxelIndex(int x, int y, int z) {
 		return z * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE + y * VOXEL_CHUNK_SIZE + x;
 	}
 	
-public:
+	static InChunkVoxelLocation voxelLocation(size_t index) {
+		return {
+			(int) (index % VOXEL_CHUNK_SIZE),
+			(int) (index / VOXEL_CHUNK_SIZE % VOXEL_CHUNK_SIZE),
+			(int) (index / (VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE))
+		};
+	}
+	
+	template<typename Callable> static void forEachInBox(
+			const InChunkVoxelLocation &from,
+			const InChunkVoxelLocation &to,
+			Callable &&callable
+	) {
+		assert(from.x >= 0 && from.y >= 0 && from.z >= 0);
+		assert(to.x < VOXEL_CHUNK_SIZE && to.y < VOXEL_CHUNK_SIZE && to.z < VOXEL_CHUNK_SIZE);
+		for (int z = from.z; z <= to.z; z++) {
+			for (int y = from.y; y <= to.y; y++) {
+				for (int x = from.x; x <= to.x; x++) {
+					callable(voxelIndex(x, y, z));
+				}
+			}
+		}
+	}
+	
 	explicit VoxelChunk(const VoxelChunkLocation &location);
 	VoxelChunk(const VoxelChunk&) = delete;
 	VoxelChunk &operator=(const VoxelChunk&) = delete;
@@ -22,7 +220,7 @@ public:
 	}
 	
 	[[nodiscard]] const VoxelHolder &at(int x, int y, int z) const {
-		return m_data[voxelIndex(x, y, z)];
+		return at(voxelIndex(x, y, z));
 	}
 	
 	[[nodiscard]] const VoxelHolder &at(const InChunkVoxelLocation &location) const {
@@ -30,6 +228,9 @@ public:
 	}
 	
 	[[nodiscard]] VoxelHolder &at(int x, int y, int z) {
+		if (m_data.empty()) {
+			expand();
+		}
 		return m_data[voxelIndex(x, y, z)];
 	}
 	
@@ -37,11 +238,191 @@ public:
 		return at(location.x, location.y, location.z);
 	}
 	
-	template<typename S> void serialize(S &s) const {
-		s.container(m_data);
+	[[nodiscard]] VoxelLight light(int x, int y, int z) const {
+		return light(voxelIndex(x, y, z));
+	}
+	
+	[[nodiscard]] VoxelLight light(const InChunkVoxelLocation &location) const {
+		return light(location.x, location.y, location.z);
+	}
+	
+	[[nodiscard]] VoxelLightLevel lightLevel(int x, int y, int z) const {
+		return light(x, y, z).level();
+	}
+	
+	[[nodiscard]] VoxelLightLevel lightLevel(const InChunkVoxelLocation &location) const {
+		return light(location).level();
+	}
+	
+	void setLight(int x, int y, int z, VoxelLight light) {
+		if (m_light.empty()) {
+			if (light == m_uniformLight) return;
+			m_light.assign(VOXEL_CHUNK_VOLUME, m_uniformLight);
+		}
+		m_light[voxelIndex(x, y, z)] = light;
+	}
+	
+	void setLight(const InChunkVoxelLocation &location, VoxelLight light) {
+		setLight(location.x, location.y, location.z, light);
+	}
+	
+	[[nodiscard]] bool lightUniform() const {
+		return m_light.empty();
 	}
-	template<typename S> void serialize(S &s) {
-		s.container(m_data);
+	
+	// Dense plane indexed the same way as voxels, nullptr while the light is uniform
+	[[nodiscard]] const VoxelLight *lights() const {
+		return m_light.empty() ? nullptr : m_light.data();
+	}
+	
+	void setUniformLight(VoxelLight light);
+	
+	[[nodiscard]] const VoxelChunkMask &densityMask() const {
+		return m_densityMask;
+	}
+	
+	[[nodiscard]] const VoxelChunkMask &opaqueMask() const {
+		return m_opaqueMask;
+	}
+	
+	[[nodiscard]] const VoxelChunkMask &emptyMask() const {
+		return m_emptyMask;
+	}
+	
+	void updateMasks(const InChunkVoxelLocation &location) {
+		updateMasks(voxelIndex(location.x, location.y, location.z));
 	}
+	
+	const VoxelChunkHeightmap &heightmap();
+	
+	static size_t columnIndex(int x, int z) {
+		return z * VOXEL_CHUNK_SIZE + x;
+	}
+	
+	[[nodiscard]] bool compacted() const {
+		return m_data.empty();
+	}
+	
+	[[nodiscard]] bool uniform() const {
+		return m_data.empty() && m_paletteIndexBits == 0 && m_palette.size() == 1;
+	}
+	
+	void setUniform(const VoxelHolder &voxel);
+	// Copies content, light and location of another chunk reusing the allocated storage
+	void assign(const VoxelChunk &chunk);
+	// Turns the chunk into an empty one at another location, small buffers keep their capacity
+	void reset(const VoxelChunkLocation &location);
+	void fill(const InChunkVoxelLocation &from, const InChunkVoxelLocation &to, const VoxelHolder &voxel);
+	// Voxels are taken in the same order as voxelIndex() enumerates the box
+	void copyFrom(const InChunkVoxelLocation &from, const InChunkVoxelLocation &to, std::span<const VoxelHolder> voxels);
+	void copyFrom(std::span<const VoxelHolder> voxels);
+	size_t replace(
+			VoxelTypeInterface &from,
+			VoxelTypeInterface &to,
+			std::vector<InChunkVoxelLocation> *locations = nullptr
+	);
+	bool compact();
+	void expand();
+	[[nodiscard]] size_t memoryUsage() const;
+	
+	void serialize(VoxelSerializer &s) const;
+	void serialize(VoxelDeserializer &s);
 
 };
+
+// Set of voxel locations inside a single chunk, one bit per voxel
+class VoxelChunkLocationSet {
+	VoxelChunkMask m_mask;
+	size_t m_size = 0;
+	
+public:
+	class Iterator {
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef InChunkVoxelLocation value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const InChunkVoxelLocation *pointer;
+		typedef const InChunkVoxelLocation &reference;
+	
+	private:
+		VoxelChunkMask::Iterator m_it;
+		InChunkVoxelLocation m_location;
+	
+	public:
+		explicit Iterator(VoxelChunkMask::Iterator it): m_it(it) {
+			if (*m_it < VOXEL_CHUNK_VOLUME) {
+				m_location = VoxelChunk::voxelLocation(*m_it);
+			}
+		}
+		
+		const InChunkVoxelLocation &operator*() const {
+			return m_location;
+		}
+		
+		Iterator &operator++() {
+			++m_it;
+			if (*m_it < VOXEL_CHUNK_VOLUME) {
+				m_location = VoxelChunk::voxelLocation(*m_it);
+			}
+			return *this;
+		}
+		
+		bool operator==(const Iterator &it) const {
+			return m_it == it.m_it;
+		}
+		
+	};
+	
+	bool insert(const InChunkVoxelLocation &location) {
+		auto index = VoxelChunk::voxelIndex(location.x, location.y, location.z);
+		if (m_mask.test(index)) return false;
+		m_mask.set(index, true);
+		m_size++;
+		return true;
+	}
+	
+	template<typename It> void insert(It begin, It end) {
+		for (auto it = begin; it != end; ++it) {
+			insert(*it);
+		}
+	}
+	
+	bool erase(const InChunkVoxelLocation &location) {
+		auto index = VoxelChunk::voxelIndex(location.x, location.y, location.z);
+		if (!m_mask.test(index)) return false;
+		m_mask.set(index, false);
+		m_size--;
+		return true;
+	}
+	
+	[[nodiscard]] bool contains(const InChunkVoxelLocation &location) const {
+		return m_mask.test(VoxelChunk::voxelIndex(location.x, location.y, location.z));
+	}
+	
+	[[nodiscard]] size_t size() const {
+		return m_size;
+	}
+	
+	[[nodiscard]] bool empty() const {
+		return m_size == 0;
+	}
+	
+	void clear() {
+		if (m_size == 0) return;
+		m_mask.fill(false);
+		m_size = 0;
+	}
+	
+	[[nodiscard]] const VoxelChunkMask &mask() const {
+		return m_mask;
+	}
+	
+	[[nodiscard]] Iterator begin() const {
+		return Iterator(m_mask.begin());
+	}
+	
+	[[nodiscard]] Iterator end() const {
+		return Iterator(m_mask.end());
+	}
+	
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "VoxelLocation.h"
+
+/*
+ * Multi-producer single-consumer queue of chunk locations. Producers push with a CAS and never block, the consumer
+ * takes everything queued at once.
+ */
+class VoxelChunkEventQueue {
+	struct Node {
+		VoxelChunkLocation location;
+		Node *next;
+	};
+	
+	std::atomic<Node*> m_head = nullptr;
+	// Pushed by close(), the consumer stops when it meets it
+	Node m_closed = {{0, 0, 0}, nullptr};
+	
+	void push(Node *node) {
+		node->next = m_head.load(std::memory_order_relaxed);
+		while (!m_head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+		}
+		if (node->next == nullptr) {
+			m_head.notify_one();
+		}
+	}
+	
+public:
+	VoxelChunkEventQueue() = default;
+	VoxelChunkEventQueue(const VoxelChunkEventQueue&) = delete;
+	VoxelChunkEventQueue &operator=(const VoxelChunkEventQueue&) = delete;
+	
+	~VoxelChunkEventQueue() {
+		auto node = m_head.exchange(nullptr);
+		while (node != nullptr) {
+			auto next = node->next;
+			if (node != &m_closed) {
+				delete node;
+			}
+			node = next;
+		}
+	}
+	
+	void push(const VoxelChunkLocation &location) {
+		push(new Node {location, nullptr});
+	}
+	
+	// Blocks until something is queued and appends it oldest first, returns false once the queue has been closed
+	bool pop(std::vector<VoxelChunkLocation> &locations) {
+		m_head.wait(nullptr, std::memory_order_acquire);
+		auto node = m_head.exchange(nullptr, std::memory_order_acquire);
+		auto first = locations.size();
+		bool closed = false;
+		while (node != nullptr) {
+			auto next = node->next;
+			if (node == &m_closed) {
+				closed = true;
+			} else {
+				locations.emplace_back(node->location);
+				delete node;
+			}
+			node = next;
+		}
+		std::reverse(locations.begin() + (long) first, locations.end());
+		return !closed;
+	}
+	
+	// Must be called once, locations pushed after the consumer stopped stay queued
+	void close() {
+		push(&m_closed);
+	}
+	
+};
@@ -0,0 +1,59 @@
+#include <algorithm>
+#include "VoxelChunkNeighborhood.h"
+#include "VoxelWorld.h"
+
+void VoxelChunkNeighborhood::build(const VoxelChunkExtendedRef &chunk) {
+	static const VoxelHolder empty;
+	const Entry missing = {
+		&empty,
+		empty.shaderProviderPriority(),
+		VoxelLight::fullSky(),
+		HAS_DENSITY | EMPTY
+	};
+	
+	// Per axis: which chunk (0 - previous, 1 - current, 2 - next) and the coordinate inside of it
+	int chunkOffsets[SIZE], coords[SIZE];
+	for (int i = 0; i < SIZE; i++) {
+		int c = i - PADDING;
+		chunkOffsets[i] = (c >= VOXEL_CHUNK_SIZE) - (c < 0) + 1;
+		coords[i] = c - (chunkOffsets[i] - 1) * VOXEL_CHUNK_SIZE;
+	}
+	
+	// X runs are split into the previous, current and next chunk parts
+	static constexpr int RUNS[3][2] = {
+		{0, PADDING},
+		{PADDING, PADDING + VOXEL_CHUNK_SIZE},
+		{PADDING + VOXEL_CHUNK_SIZE, SIZE}
+	};
+	
+	auto out = m_entries.begin();
+	for (int z = 0; z < SIZE; z++) {
+		for (int y = 0; y < SIZE; y++) {
+			for (int run = 0; run < 3; run++) {
+				int n = run + chunkOffsets[y] * 3 + chunkOffsets[z] * 3 * 3;
+				const VoxelChunk *source = n == 1 + 3 + 3 * 3 ? chunk.m_chunk : chunk.m_neighbors[n];
+				if (source == nullptr) {
+					out = std::fill_n(out, RUNS[run][1] - RUNS[run][0], missing);
+					continue;
+				}
+				auto &densityMask = source->densityMask();
+				auto &opaqueMask = source->opaqueMask();
+				auto &emptyMask = source->emptyMask();
+				for (int x = RUNS[run][0]; x < RUNS[run][1]; x++) {
+					InChunkVoxelLocation location(coords[x], coords[y], coords[z]);
+					auto i = VoxelChunk::voxelIndex(location.x, location.y, location.z);
+					auto &voxel = source->at(location);
+					out->voxel = &voxel;
+					out->priority = voxel.shaderProviderPriority();
+					out->light = source->light(location);
+					out->flags = (densityMask.test(i) ? HAS_DENSITY : 0) |
+						(opaqueMask.test(i) ? OPAQUE : 0) |
+						(emptyMask.test(i) ? EMPTY : 0);
+					++out;
+				}
+			}
+		}
+	}
+	m_location = chunk.location();
+	m_valid = true;
+}
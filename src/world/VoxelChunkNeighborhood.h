@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "VoxelLocation.h"
+#include "Voxel.h"
+
+class VoxelChunkExtendedRef;
+
+/*
+ * Copy of a chunk and one voxel layer of its neighbors, taken under the extended lock.
+ * Stencil code indexes it directly instead of going through VoxelChunkExtendedRef::extendedAt().
+ */
+class VoxelChunkNeighborhood {
+public:
+	static constexpr int PADDING = 1;
+	static constexpr int SIZE = VOXEL_CHUNK_SIZE + 2 * PADDING;
+	static constexpr int VOLUME = SIZE * SIZE * SIZE;
+	
+	enum Flags: uint8_t {
+		HAS_DENSITY = 1 << 0,
+		OPAQUE = 1 << 1,
+		EMPTY = 1 << 2
+	};
+	
+	struct Entry {
+		const VoxelHolder *voxel;
+		int priority;
+		VoxelLight light;
+		uint8_t flags;
+		
+		[[nodiscard]] bool hasDensity() const {
+			return flags & HAS_DENSITY;
+		}
+		
+		[[nodiscard]] bool opaque() const {
+			return flags & OPAQUE;
+		}
+		
+		[[nodiscard]] bool empty() const {
+			return flags & EMPTY;
+		}
+		
+	};
+	
+private:
+	std::array<Entry, VOLUME> m_entries;
+	VoxelChunkLocation m_location;
+	bool m_valid = false;
+	
+public:
+	// Accepts in-chunk coordinates in the [-PADDING, VOXEL_CHUNK_SIZE + PADDING) range
+	static constexpr int index(int x, int y, int z) {
+		return ((z + PADDING) * SIZE + (y + PADDING)) * SIZE + (x + PADDING);
+	}
+	
+	static constexpr int index(const InChunkVoxelLocation &location) {
+		return index(location.x, location.y, location.z);
+	}
+	
+	// Index delta of a neighbor, add it to index() of the center voxel
+	static constexpr int offset(int dx, int dy, int dz) {
+		return (dz * SIZE + dy) * SIZE + dx;
+	}
+	
+	static constexpr bool contains(const InChunkVoxelLocation &location) {
+		return location.x >= -PADDING && location.x < VOXEL_CHUNK_SIZE + PADDING &&
+			location.y >= -PADDING && location.y < VOXEL_CHUNK_SIZE + PADDING &&
+			location.z >= -PADDING && location.z < VOXEL_CHUNK_SIZE + PADDING;
+	}
+	
+	void build(const VoxelChunkExtendedRef &chunk);
+	void invalidate() {
+		m_valid = false;
+	}
+	[[nodiscard]] bool valid() const {
+		return m_valid;
+	}
+	[[nodiscard]] const VoxelChunkLocation &location() const {
+		return m_location;
+	}
+	[[nodiscard]] const Entry &operator[](int index) const {
+		return m_entries[index];
+	}
+	[[nodiscard]] const Entry &at(int x, int y, int z) const {
+		return m_entries[index(x, y, z)];
+	}
+	[[nodiscard]] const Entry &at(const InChunkVoxelLocation &location) const {
+		return m_entries[index(location)];
+	}
+	
+};
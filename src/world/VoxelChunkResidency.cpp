@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <unordered_set>
+#include "VoxelChunkResidency.h"
+#include "VoxelWorld.h"
+
+VoxelChunkResidency::VoxelChunkResidency(VoxelWorld &world, size_t warmBudget): m_world(world), m_warmBudget(warmBudget) {
+}
+
+VoxelChunkResidency::Ticket VoxelChunkResidency::addTicket(const VoxelChunkBox &box) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	auto ticket = m_nextTicket++;
+	m_tickets.emplace(ticket, box);
+	return ticket;
+}
+
+void VoxelChunkResidency::moveTicket(Ticket ticket, const VoxelChunkBox &box) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	auto it = m_tickets.find(ticket);
+	assert(it != m_tickets.end());
+	it->second = box;
+}
+
+void VoxelChunkResidency::removeTicket(Ticket ticket) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_tickets.erase(ticket);
+}
+
+void VoxelChunkResidency::setWarmBudget(size_t bytes) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_warmBudget = bytes;
+}
+
+std::vector<VoxelChunkLocation> VoxelChunkResidency::update() {
+	std::vector<VoxelChunkBox> boxes;
+	size_t warmBudget;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		boxes.reserve(m_tickets.size());
+		for (auto &ticket : m_tickets) {
+			boxes.emplace_back(ticket.second);
+		}
+		warmBudget = m_warmBudget;
+	}
+	std::unordered_set<VoxelChunkLocation> unticketed;
+	m_world.forEachChunkLocationOutside(boxes, [&unticketed](const VoxelChunkLocation &location) {
+		unticketed.emplace(location);
+	});
+	
+	// Chunks ticketed again or unloaded meanwhile leave the warm list
+	for (auto it = m_warm.begin(); it != m_warm.end();) {
+		if (unticketed.erase(it->location) != 0) {
+			++it;
+			continue;
+		}
+		m_warmBytes -= it->bytes;
+		it = m_warm.erase(it);
+	}
+	for (auto &location : unticketed) {
+		auto chunk = m_world.chunk(location);
+		if (!chunk) continue;
+		auto bytes = sizeof(SharedVoxelChunk) + chunk.memoryUsage();
+		chunk.unlock();
+		m_warm.push_back({location, bytes});
+		m_warmBytes += bytes;
+	}
+	
+	std::vector<VoxelChunkLocation> evicted;
+	while (m_warmBytes > warmBudget && !m_warm.empty()) {
+		auto &warm = m_warm.front();
+		evicted.emplace_back(warm.location);
+		m_warmBytes -= warm.bytes;
+		m_warm.pop_front();
+	}
+	if (!evicted.empty()) {
+		m_world.unloadChunks(evicted);
+	}
+	
+	auto chunkCount = m_world.chunkCount();
+	auto evicting = std::min(m_world.unloadingChunkCount(), chunkCount);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_stats.resident = chunkCount - evicting;
+	m_stats.warm = m_warm.size();
+	m_stats.warmBytes = m_warmBytes;
+	m_stats.evicting = evicting;
+	return evicted;
+}
+
+VoxelChunkResidency::Stats VoxelChunkResidency::stats() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_stats;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "VoxelRegionIndex.h"
+
+class VoxelWorld;
+
+/*
+ * Decides which chunks stay loaded. Chunks inside a ticket box are pinned. Chunks that lost their last ticket stay warm
+ * in LRU order while the warm ones fit the byte budget, the oldest are stored and evicted once they don't. A player
+ * moving back and forth across a boundary finds its chunks warm instead of reloading them.
+ */
+class VoxelChunkResidency {
+public:
+	using Ticket = unsigned long;
+	
+	static constexpr size_t DEFAULT_WARM_BUDGET = 64 * 1024 * 1024;
+	
+	struct Stats {
+		// Loaded chunks not being unloaded, warm ones included
+		size_t resident = 0;
+		size_t warm = 0;
+		size_t warmBytes = 0;
+		// Chunks being stored before they are erased
+		size_t evicting = 0;
+	};
+	
+private:
+	struct WarmChunk {
+		VoxelChunkLocation location;
+		size_t bytes;
+	};
+	
+	VoxelWorld &m_world;
+	std::unordered_map<Ticket, VoxelChunkBox> m_tickets;
+	Ticket m_nextTicket = 1;
+	size_t m_warmBudget;
+	Stats m_stats;
+	// Guards the tickets, the budget and the stats
+	std::mutex m_mutex;
+	// Least recently ticketed first, owned by the update() caller
+	std::list<WarmChunk> m_warm;
+	size_t m_warmBytes = 0;
+	
+public:
+	explicit VoxelChunkResidency(VoxelWorld &world, size_t warmBudget = DEFAULT_WARM_BUDGET);
+	VoxelChunkResidency(const VoxelChunkResidency&) = delete;
+	VoxelChunkResidency &operator=(const VoxelChunkResidency&) = delete;
+	[[nodiscard]] Ticket addTicket(const VoxelChunkBox &box);
+	void moveTicket(Ticket ticket, const VoxelChunkBox &box);
+	void removeTicket(Ticket ticket);
+	void setWarmBudget(size_t bytes);
+	// Moves unticketed chunks to the warm list and evicts the ones over budget, returns the evicted ones
+	std::vector<VoxelChunkLocation> update();
+	[[nodiscard]] Stats stats();
+	
+};
@@ -2,9 +2,18 @@
 
 #include <cstddef>
 #include <cmath>
+#include <functional>
 #include <glm/vec3.hpp>
 
-static const int VOXEL_CHUNK_SIZE = 16;
+// Chunk edge length, selected at build time with the VOXEL_CHUNK_SIZE CMake option
+#ifndef VOXEL_CHUNK_SIZE_CONFIG
+#define VOXEL_CHUNK_SIZE_CONFIG 16
+#endif
+static const int VOXEL_CHUNK_SIZE = VOXEL_CHUNK_SIZE_CONFIG;
+static_assert(
+		VOXEL_CHUNK_SIZE >= 4 && (VOXEL_CHUNK_SIZE & (VOXEL_CHUNK_SIZE - 1)) == 0,
+		"Chunk size must be a power of two"
+);
 
 struct VoxelLocation;
 
@@ -23,6 +32,13 @@ struct VoxelChunkLocation {
 		return x == location.x && y == location.y && z == location.z;
 	}
 	
+	// Global order in which multi-chunk operations lock chunks: by z, then y, then x
+	constexpr bool operator<(const VoxelChunkLocation &location) const {
+		if (z != location.z) return z < location.z;
+		if (y != location.y) return y < location.y;
+		return x < location.x;
+	}
+	
 	constexpr bool operator!=(const VoxelChunkLocation &location) const {
 		return !(*this == location);
 	}
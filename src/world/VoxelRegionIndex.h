@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include "VoxelLocation.h"
+
+class SharedVoxelChunk;
+
+// Inclusive box of chunk locations
+struct VoxelChunkBox {
+	VoxelChunkLocation from, to;
+	
+	[[nodiscard]] constexpr bool contains(const VoxelChunkLocation &location) const {
+		return location.x >= from.x && location.x <= to.x &&
+			location.y >= from.y && location.y <= to.y &&
+			location.z >= from.z && location.z <= to.z;
+	}
+	
+	[[nodiscard]] constexpr bool intersects(const VoxelChunkBox &box) const {
+		return from.x <= box.to.x && to.x >= box.from.x &&
+			from.y <= box.to.y && to.y >= box.from.y &&
+			from.z <= box.to.z && to.z >= box.from.z;
+	}
+	
+	[[nodiscard]] constexpr bool containsBox(const VoxelChunkBox &box) const {
+		return contains(box.from) && contains(box.to);
+	}
+	
+	[[nodiscard]] static constexpr VoxelChunkBox around(const VoxelChunkLocation &center, int radius) {
+		return {
+			{center.x - radius, center.y - radius, center.z - radius},
+			{center.x + radius, center.y + radius, center.z + radius}
+		};
+	}
+	
+};
+
+/*
+ * Loaded chunks grouped into cubic regions of REGION_SIZE^3 chunks, so that box queries visit only the regions they
+ * overlap and whole regions can be accepted or skipped at once. Not thread safe, VoxelWorld guards it.
+ */
+class VoxelRegionIndex {
+public:
+	static constexpr int REGION_SIZE_BITS = 3;
+	static constexpr int REGION_SIZE = 1 << REGION_SIZE_BITS;
+	static constexpr int REGION_VOLUME = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+	
+	struct Region {
+		std::array<SharedVoxelChunk*, REGION_VOLUME> chunks = {};
+		int count = 0;
+	};
+	
+private:
+	std::unordered_map<VoxelChunkLocation, std::unique_ptr<Region>> m_regions;
+	
+	static constexpr int chunkIndex(int x, int y, int z) {
+		return ((z & (REGION_SIZE - 1)) * REGION_SIZE + (y & (REGION_SIZE - 1))) * REGION_SIZE +
+			(x & (REGION_SIZE - 1));
+	}
+	
+public:
+	static constexpr VoxelChunkLocation regionLocation(const VoxelChunkLocation &location) {
+		return {location.x >> REGION_SIZE_BITS, location.y >> REGION_SIZE_BITS, location.z >> REGION_SIZE_BITS};
+	}
+	
+	static constexpr VoxelChunkBox regionBox(const VoxelChunkLocation &region) {
+		return {
+			{region.x * REGION_SIZE, region.y * REGION_SIZE, region.z * REGION_SIZE},
+			{
+				region.x * REGION_SIZE + REGION_SIZE - 1,
+				region.y * REGION_SIZE + REGION_SIZE - 1,
+				region.z * REGION_SIZE + REGION_SIZE - 1
+			}
+		};
+	}
+	
+	void insert(const VoxelChunkLocation &location, SharedVoxelChunk *chunk) {
+		auto &region = m_regions[regionLocation(location)];
+		if (!region) {
+			region = std::make_unique<Region>();
+		}
+		auto &slot = region->chunks[chunkIndex(location.x, location.y, location.z)];
+		region->count += slot == nullptr;
+		slot = chunk;
+	}
+	
+	void erase(const VoxelChunkLocation &location) {
+		auto it = m_regions.find(regionLocation(location));
+		if (it == m_regions.end()) return;
+		auto &slot = it->second->chunks[chunkIndex(location.x, location.y, location.z)];
+		if (slot == nullptr) return;
+		slot = nullptr;
+		if (--it->second->count == 0) {
+			m_regions.erase(it);
+		}
+	}
+	
+	[[nodiscard]] size_t regionCount() const {
+		return m_regions.size();
+	}
+	
+	// Callable receives the region location and the region, it may accept or skip the whole region
+	template<typename Callable> void forEachRegion(Callable &&callable) const {
+		for (auto &[location, region] : m_regions) {
+			callable(location, *region);
+		}
+	}
+	
+	template<typename Callable> static void forEachInRegion(
+			const VoxelChunkLocation &regionLocation,
+			const Region &region,
+			Callable &&callable
+	) {
+		auto base = regionBox(regionLocation).from;
+		for (int i = 0; i < REGION_VOLUME; i++) {
+			auto chunk = region.chunks[i];
+			if (chunk == nullptr) continue;
+			callable(VoxelChunkLocation(
+					base.x + i % REGION_SIZE,
+					base.y + i / REGION_SIZE % REGION_SIZE,
+					base.z + i / (REGION_SIZE * REGION_SIZE)
+			), *chunk);
+		}
+	}
+	
+	template<typename Callable> void forEach(Callable &&callable) const {
+		for (auto &[location, region] : m_regions) {
+			forEachInRegion(location, *region, callable);
+		}
+	}
+	
+	template<typename Callable> void forEachInBox(const VoxelChunkBox &box, Callable &&callable) const {
+		auto from = regionLocation(box.from), to = regionLocation(box.to);
+		for (int rz = from.z; rz <= to.z; rz++) {
+			for (int ry = from.y; ry <= to.y; ry++) {
+				for (int rx = from.x; rx <= to.x; rx++) {
+					auto it = m_regions.find({rx, ry, rz});
+					if (it == m_regions.end()) continue;
+					auto regionBox = VoxelRegionIndex::regionBox(it->first);
+					if (box.containsBox(regionBox)) {
+						forEachInRegion(it->first, *it->second, callable);
+						continue;
+					}
+					for (int z = std::max(box.from.z, regionBox.from.z); z <= std::min(box.to.z, regionBox.to.z); z++) {
+						for (int y = std::max(box.from.y, regionBox.from.y); y <= std::min(box.to.y, regionBox.to.y); y++) {
+							for (int x = std::max(box.from.x, regionBox.from.x); x <= std::min(box.to.x, regionBox.to.x); x++) {
+								auto chunk = it->second->chunks[chunkIndex(x, y, z)];
+								if (chunk == nullptr) continue;
+								callable(VoxelChunkLocation(x, y, z), *chunk);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	
+};
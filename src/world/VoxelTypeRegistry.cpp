@@ -28,6 +28,9 @@ VoxelTypeInterface &VoxelTypeRegistry::add(std::string name, std::unique_ptr<Vox
 	std::unique_lock<std::shared_mutex> lock(m_mutex);
 	LOG(INFO) << "Registered \"" << name << "\" voxel type";
 	m_types.emplace(std::move(name), std::move(type));
+	if (m_linked) {
+		freezeProperties(typeRef);
+	}
 	return typeRef;
 }
 
@@ -45,8 +48,27 @@ VoxelTypeInterface &VoxelTypeRegistry::get(const std::string &name) {
 	return get(name);
 }
 
+void VoxelTypeRegistry::freezeProperties(VoxelTypeInterface &type) {
+	VoxelHolder voxel(type);
+	VoxelTypeProperties properties;
+	properties.shaderProvider = type.invokeShaderProvider(voxel.get());
+	properties.priority = properties.shaderProvider != nullptr ? properties.shaderProvider->priority() : INT_MIN;
+	properties.lightLevel = type.invokeLightLevel(voxel.get());
+	properties.empty = &type == &EmptyVoxelType::INSTANCE;
+	properties.opaque = properties.priority >= MAX_VOXEL_SHADER_PRIORITY;
+	properties.hasDensity = type.invokeHasDensity(voxel.get());
+	properties.dynamic = type.invokeHasState();
+	type.m_properties = properties;
+}
+
 void VoxelTypeRegistry::link() {
 	for (auto &type : m_types) {
 		type.second->invokeLink(*this);
 	}
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	freezeProperties(EmptyVoxelType::INSTANCE);
+	for (auto &type : m_types) {
+		freezeProperties(*type.second);
+	}
+	m_linked = true;
 }
@@ -14,10 +14,13 @@ class AssetLoader;
 class VoxelTypeRegistry {
 	std::unordered_map<std::string, std::unique_ptr<VoxelTypeInterface>> m_types;
 	std::shared_mutex m_mutex;
+	bool m_linked = false;
 	AssetLoader &m_assetLoader;
 #ifndef HEADLESS
 	GL::Texture m_unknownBlockTexture;
 #endif
+
+	void freezeProperties(VoxelTypeInterface &type);
 	
 	friend class UnknownVoxelType;
 
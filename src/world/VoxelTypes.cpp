@@ -33,7 +33,7 @@ void GrassVoxelType::slowUpdate(
 		State &voxel,
 		std::unordered_set<InChunkVoxelLocation> &invalidatedLocations
 ) {
-	if (chunk.extendedAt(location.x, location.y + 1, location.z).lightLevel() <= 4) {
+	if (chunk.extendedLightLevel(location.x, location.y + 1, location.z) <= 4) {
 		chunk.at(location).setType(*m_dirt);
 		invalidatedLocations.emplace(location);
 		return;
@@ -49,12 +49,13 @@ void GrassVoxelType::slowUpdate(
 				);
 				auto &n = chunk.extendedAt(nLocation);
 				if (&n.type() != m_dirt) continue;
-				auto &nTop = chunk.extendedAt({
+				InChunkVoxelLocation nTopLocation(
 					nLocation.x,
 					nLocation.y + 1,
 					nLocation.z
-				});
-				if (nTop.lightLevel() < 9) continue;
+				);
+				if (chunk.extendedLightLevel(nTopLocation) < 9) continue;
+				auto &nTop = chunk.extendedAt(nTopLocation);
 				if (nTop.hasDensity()) continue;
 				n.setType(*this);
 				invalidatedLocations.emplace(nLocation);
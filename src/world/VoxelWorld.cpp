@@ -1,8 +1,12 @@
+#include <algorithm>
+#include <bitset>
+#include <type_traits>
 #include <random>
 #include <optional>
 #include <vector>
 #include <easylogging++.h>
 #include "VoxelWorld.h"
+#include "VoxelChunkNeighborhood.h"
 #include "Entity.h"
 
 static thread_local std::default_random_engine randomEngine;
@@ -12,22 +16,32 @@ static thread_local std::default_random_engine randomEngine;
 class VoxelInvalidationNotifier {
 	VoxelWorld *m_world;
 	VoxelChunkLocation m_chunkLocation;
+	unsigned long m_generation;
 	VoxelChunkLightState m_lightState;
+	unsigned long m_version;
 	
 public:
-	VoxelInvalidationNotifier(): m_world(nullptr), m_lightState(VoxelChunkLightState::COMPLETE) {
+	VoxelInvalidationNotifier(): m_world(nullptr), m_generation(0), m_lightState(VoxelChunkLightState::COMPLETE),
+		m_version(0)
+	{
 	}
 	
 	explicit VoxelInvalidationNotifier(
 			SharedVoxelChunk &chunk
-	): m_world(&chunk.world()), m_chunkLocation(chunk.location()), m_lightState(chunk.lightState()) {
-		switch (chunk.lightState()) {
+	): m_world(&chunk.world()), m_chunkLocation(chunk.location()), m_generation(chunk.generation()),
+		m_lightState(chunk.lightState()), m_version(chunk.version())
+	{
+		switch (m_lightState) {
 			case VoxelChunkLightState::PENDING_INITIAL:
 			case VoxelChunkLightState::PENDING_INCREMENTAL:
+				m_world->postChunkEvents(chunk, VoxelChunkEvent::LIGHT_PENDING);
+				break;
 			case VoxelChunkLightState::COMPUTING:
 				break;
 			case VoxelChunkLightState::READY:
-				chunk.setLightState(VoxelChunkLightState::COMPLETE);
+				if (chunk.completeLight()) {
+					m_world->postChunkEvents(chunk, VoxelChunkEvent::LIGHT_READY);
+				}
 				break;
 			case VoxelChunkLightState::COMPLETE:
 				break;
@@ -37,16 +51,15 @@ public:
 	VoxelInvalidationNotifier &operator=(const VoxelInvalidationNotifier &notifier)  {
 		m_world = notifier.m_world;
 		m_chunkLocation = notifier.m_chunkLocation;
+		m_generation = notifier.m_generation;
 		m_lightState = notifier.m_lightState;
+		m_version = notifier.m_version;
 		return *this;
 	}
 	
 	void notify() {
 		if (m_world == nullptr) return;
-		auto &l = m_chunkLocation;
-		if (m_world->m_chunkListener != nullptr) {
-			m_world->m_chunkListener->chunkUnlocked(m_chunkLocation, m_lightState);
-		}
+		m_world->chunkLightStateChanged(m_chunkLocation, m_generation, m_lightState, m_version);
 		m_world = nullptr;
 	}
 	
@@ -54,7 +67,17 @@ public:
 
 /* SharedVoxelChunk */
 
+SharedVoxelChunk::SharedVoxelChunk(
+		VoxelWorld &world,
+		const VoxelChunkLocation &location
+): VoxelChunk(location), m_world(world), m_generation(++world.m_chunkGenerations) {
+}
+
 SharedVoxelChunk::~SharedVoxelChunk() {
+	releaseEntities();
+}
+
+void SharedVoxelChunk::releaseEntities() {
 	for (auto entity : m_entities) {
 		m_world.m_entities.erase(entity);
 		delete entity;
@@ -62,26 +85,64 @@ SharedVoxelChunk::~SharedVoxelChunk() {
 	if (!m_entities.empty()) {
 		LOG(DEBUG) << "Unloaded " << m_entities.size() << " entities";
 	}
+	m_entities.clear();
 }
 
-void SharedVoxelChunk::setNeighbors(
-		const std::unordered_map<VoxelChunkLocation, std::unique_ptr<SharedVoxelChunk>> &chunks
-) {
+void SharedVoxelChunk::reset(const VoxelChunkLocation &location) {
+	releaseEntities();
+	VoxelChunk::reset(location);
+	assert(!m_linkedComplete);
+	std::fill(std::begin(m_neighbors), std::end(m_neighbors), nullptr);
+	m_neighborMask = 0;
+	m_lightState = VoxelChunkLightState::PENDING_INITIAL;
+	// Events of the previous location are dropped, they would keep new ones from being queued
+	m_pendingEvents = 0;
+	m_dirtyLocations.clear();
+	m_pendingLocations.clear();
+	m_relightLocations.clear();
+	m_pendingInitialUpdate = true;
+	m_unloading = false;
+	m_updatedAt = 0;
+	m_storedAt = 0;
+	m_snapshot.reset();
+	m_generation = ++m_world.m_chunkGenerations;
+}
+
+void SharedVoxelChunk::setUnloading(bool unloading) {
+	if (m_unloading.exchange(unloading) == unloading) return;
+	if (unloading) {
+		m_world.m_unloadingChunkCount++;
+	} else {
+		m_world.m_unloadingChunkCount--;
+	}
+}
+
+void SharedVoxelChunk::setNeighbor(int index, SharedVoxelChunk *chunk) {
+	m_neighbors[index] = chunk;
+	uint32_t mask;
+	if (chunk != nullptr) {
+		mask = m_neighborMask.fetch_or(1u << index, std::memory_order_relaxed) | (1u << index);
+	} else {
+		mask = m_neighborMask.fetch_and(~(1u << index), std::memory_order_relaxed) & ~(1u << index);
+	}
+	if ((mask == ALL_NEIGHBORS) != m_linkedComplete) {
+		m_world.setChunkComplete(*this, mask == ALL_NEIGHBORS);
+	}
+}
+
+void SharedVoxelChunk::setNeighbors() {
 	for (int dz = -1; dz <= 1; dz++) {
 		for (int dy = -1; dy <= 1; dy++) {
 			for (int dx = -1; dx <= 1; dx++) {
-				SharedVoxelChunk *chunk = nullptr;
-				if (dx != 0 || dy != 0 || dz != 0) {
-					auto it = chunks.find({
-						location().x + dx,
-						location().y + dy,
-						location().z + dz
-					});
-					if (it == chunks.end()) continue;
-					chunk = it->second.get();
-					chunk->m_neighbors[(-dx + 1) + (-dy + 1) * 3 + (-dz + 1) * 3 * 3] = this;
-				}
-				m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3] = chunk;
+				if (dx == 0 && dy == 0 && dz == 0) continue;
+				auto chunk = m_world.findChunk({
+					location().x + dx,
+					location().y + dy,
+					location().z + dz
+				});
+				if (chunk == nullptr) continue;
+				chunk->setNeighbor((-dx + 1) + (-dy + 1) * 3 + (-dz + 1) * 3 * 3, this);
+				setNeighbor((dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3, chunk);
 			}
 		}
 	}
@@ -93,12 +154,32 @@ void SharedVoxelChunk::unsetNeighbors() {
 			for (int dx = -1; dx <= 1; dx++) {
 				auto chunk = m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3];
 				if (chunk == nullptr) continue;
-				chunk->m_neighbors[(-dx + 1) + (-dy + 1) * 3 + (-dz + 1) * 3 * 3] = nullptr;
+				chunk->setNeighbor((-dx + 1) + (-dy + 1) * 3 + (-dz + 1) * 3 * 3, nullptr);
+				setNeighbor((dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3, nullptr);
 			}
 		}
 	}
 }
 
+std::shared_ptr<const VoxelChunk> SharedVoxelChunk::snapshot() {
+	auto version = this->version();
+	std::unique_lock<std::mutex> lock(m_snapshotMutex);
+	if (version == m_snapshotVersion) {
+		auto snapshot = m_snapshot.lock();
+		if (snapshot) {
+			return snapshot;
+		}
+	}
+	auto snapshot = std::make_shared<VoxelChunk>(location());
+	snapshot->assign(*this);
+	// The holder of the exclusive lock may change the chunk without changing the version
+	if (version % 2 == 0) {
+		m_snapshot = snapshot;
+		m_snapshotVersion = version;
+	}
+	return snapshot;
+}
+
 SharedVoxelChunk *SharedVoxelChunk::neighbor(int dx, int dy, int dz) const {
 	return m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3];
 }
@@ -107,9 +188,24 @@ SharedVoxelChunk *SharedVoxelChunk::neighbor(int dx, int dy, int dz) const {
 
 VoxelChunkRef::VoxelChunkRef(SharedVoxelChunk &chunk, bool lock): m_chunk(&chunk) {
 	if (lock) {
-		auto &l = chunk.location();
-		LOG_IF(TRACE_LOCKS, TRACE) << "Lock shared x=" << l.x << ",y=" << l.y << ",z=" << l.z;
-		chunk.mutex().lock_shared();
+		lockChunk(chunk, LockMode::SHARED);
+	}
+}
+
+void VoxelChunkRef::lockChunk(SharedVoxelChunk &chunk, LockMode mode) {
+	auto &l = chunk.location();
+	switch (mode) {
+		case LockMode::NONE:
+			break;
+		case LockMode::SHARED:
+			LOG_IF(TRACE_LOCKS, TRACE) << "Lock shared x=" << l.x << ",y=" << l.y << ",z=" << l.z;
+			chunk.mutex().lock_shared();
+			break;
+		case LockMode::EXCLUSIVE:
+			LOG_IF(TRACE_LOCKS, TRACE) << "Lock x=" << l.x << ",y=" << l.y << ",z=" << l.z;
+			chunk.mutex().lock();
+			chunk.beginWrite();
+			break;
 	}
 }
 
@@ -148,21 +244,30 @@ void VoxelChunkRef::unlock() {
 
 VoxelChunkExtendedRef::VoxelChunkExtendedRef(
 		SharedVoxelChunk &chunk,
-		bool lock,
-		bool lockNeighbors
-): VoxelChunkRef(chunk, lock) {
+		LockMode mode,
+		LockMode neighborsMode
+): VoxelChunkRef(chunk, false), m_neighborhood(nullptr) {
+	/*
+	 * The loops enumerate chunks in the global (z, y, x) location order, the center included. Every multi-chunk ref
+	 * takes its locks in this order, so overlapping refs centered on different chunks can't wait for each other in
+	 * a cycle whatever the lock modes are.
+	 */
 	for (int dz = -1; dz <= 1; dz++) {
 		for (int dy = -1; dy <= 1; dy++) {
 			for (int dx = -1; dx <= 1; dx++) {
+				if (dx == 0 && dy == 0 && dz == 0) {
+					m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3] = nullptr;
+					lockChunk(chunk, mode);
+					continue;
+				}
 				auto neighbor = chunk.neighbor(dx, dy, dz);
 				if (neighbor && neighbor->unloading()) {
 					neighbor = nullptr;
 				}
 				m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3] = neighbor;
-				if (neighbor == nullptr || !lockNeighbors) continue;
-				auto &l = neighbor->location();
-				LOG_IF(TRACE_LOCKS, TRACE) << "Lock shared x=" << l.x << ",y=" << l.y << ",z=" << l.z;
-				neighbor->mutex().lock_shared();
+				if (neighbor == nullptr) continue;
+				m_neighborCount++;
+				lockChunk(*neighbor, neighborsMode);
 			}
 		}
 	}
@@ -170,10 +275,13 @@ VoxelChunkExtendedRef::VoxelChunkExtendedRef(
 
 VoxelChunkExtendedRef::VoxelChunkExtendedRef(
 		SharedVoxelChunk &chunk
-): VoxelChunkExtendedRef(chunk, true, true) {
+): VoxelChunkExtendedRef(chunk, LockMode::SHARED, LockMode::SHARED) {
 }
 
-VoxelChunkExtendedRef::VoxelChunkExtendedRef(VoxelChunkExtendedRef &&ref) noexcept: VoxelChunkRef(std::move(ref)) {
+VoxelChunkExtendedRef::VoxelChunkExtendedRef(
+		VoxelChunkExtendedRef &&ref
+) noexcept: VoxelChunkRef(std::move(ref)), m_neighborCount(std::exchange(ref.m_neighborCount, 0)),
+	m_neighborhood(std::exchange(ref.m_neighborhood, nullptr)) {
 	for (int i = 0; i < sizeof(m_neighbors) / sizeof(m_neighbors[0]); i++) {
 		m_neighbors[i] = ref.m_neighbors[i];
 		ref.m_neighbors[i] = nullptr;
@@ -186,6 +294,8 @@ VoxelChunkExtendedRef &VoxelChunkExtendedRef::operator=(VoxelChunkExtendedRef &&
 		m_neighbors[i] = ref.m_neighbors[i];
 		ref.m_neighbors[i] = nullptr;
 	}
+	m_neighborCount = std::exchange(ref.m_neighborCount, 0);
+	m_neighborhood = std::exchange(ref.m_neighborhood, nullptr);
 	VoxelChunkRef::operator=(std::move(ref));
 	return *this;
 }
@@ -195,6 +305,8 @@ VoxelChunkExtendedRef::~VoxelChunkExtendedRef() {
 }
 
 void VoxelChunkExtendedRef::unlock() {
+	m_neighborhood = nullptr;
+	m_neighborCount = 0;
 	VoxelInvalidationNotifier notifiers[sizeof(m_neighbors) / sizeof(m_neighbors[0])];
 	for (int i = 0; i < sizeof(m_neighbors) / sizeof(m_neighbors[0]); i++) {
 		auto &neighbor = m_neighbors[i];
@@ -215,67 +327,110 @@ bool VoxelChunkExtendedRef::hasNeighbor(int dx, int dy, int dz) const {
 	return m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3] != nullptr;
 }
 
+void VoxelChunkExtendedRef::attachNeighborhood(const VoxelChunkNeighborhood *neighborhood) {
+	assert(neighborhood == nullptr || (neighborhood->valid() && neighborhood->location() == location()));
+	m_neighborhood = neighborhood;
+}
+
 const VoxelHolder &VoxelChunkExtendedRef::extendedAt(int x, int y, int z, VoxelLocation *outLocation) const {
 	return extendedAt({x, y, z}, outLocation);
 }
 
-const VoxelHolder &VoxelChunkExtendedRef::extendedAt(const InChunkVoxelLocation &location, VoxelLocation *outLocation) const {
+SharedVoxelChunk *VoxelChunkExtendedRef::extendedChunk(
+		const InChunkVoxelLocation &location,
+		InChunkVoxelLocation &correctedLocation,
+		VoxelLocation *outLocation
+) const {
 	assert(location.x >= -VOXEL_CHUNK_SIZE && location.x < 2 * VOXEL_CHUNK_SIZE);
 	assert(location.y >= -VOXEL_CHUNK_SIZE && location.y < 2 * VOXEL_CHUNK_SIZE);
 	assert(location.z >= -VOXEL_CHUNK_SIZE && location.z < 2 * VOXEL_CHUNK_SIZE);
 	
-	const SharedVoxelChunk *chunk = m_chunk;
-	VoxelChunkLocation chunkLocation = this->location();
-	InChunkVoxelLocation correctedLocation = location;
-	if (location.x < 0) {
-		chunkLocation.x--;
-		correctedLocation.x += VOXEL_CHUNK_SIZE;
-	} else if (location.x >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.x++;
-		correctedLocation.x -= VOXEL_CHUNK_SIZE;
-	}
-	if (location.y < 0) {
-		chunkLocation.y--;
-		correctedLocation.y += VOXEL_CHUNK_SIZE;
-	} else if (location.y >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.y++;
-		correctedLocation.y -= VOXEL_CHUNK_SIZE;
-	}
-	if (location.z < 0) {
-		chunkLocation.z--;
-		correctedLocation.z += VOXEL_CHUNK_SIZE;
-	} else if (location.z >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.z++;
-		correctedLocation.z -= VOXEL_CHUNK_SIZE;
-	}
-	int dx = chunkLocation.x - this->location().x;
-	int dy = chunkLocation.y - this->location().y;
-	int dz = chunkLocation.z - this->location().z;
-	if (dx != 0 || dy != 0 || dz != 0) {
-		chunk = m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3];
-	}
+	int dx = (location.x >= VOXEL_CHUNK_SIZE) - (location.x < 0);
+	int dy = (location.y >= VOXEL_CHUNK_SIZE) - (location.y < 0);
+	int dz = (location.z >= VOXEL_CHUNK_SIZE) - (location.z < 0);
+	correctedLocation = {
+		location.x - dx * VOXEL_CHUNK_SIZE,
+		location.y - dy * VOXEL_CHUNK_SIZE,
+		location.z - dz * VOXEL_CHUNK_SIZE
+	};
 	if (outLocation != nullptr) {
-		*outLocation = VoxelLocation(chunkLocation, correctedLocation);
+		*outLocation = VoxelLocation(this->location(), location);
 	}
+	if (dx == 0 && dy == 0 && dz == 0) {
+		return m_chunk;
+	}
+	return m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3];
+}
+
+const VoxelHolder &VoxelChunkExtendedRef::extendedAt(const InChunkVoxelLocation &location, VoxelLocation *outLocation) const {
+	if (m_neighborhood != nullptr && VoxelChunkNeighborhood::contains(location)) {
+		if (outLocation != nullptr) {
+			*outLocation = VoxelLocation(this->location(), location);
+		}
+		return *m_neighborhood->at(location).voxel;
+	}
+	InChunkVoxelLocation correctedLocation;
+	auto chunk = extendedChunk(location, correctedLocation, outLocation);
 	if (chunk) {
-		return chunk->at(correctedLocation);
+		return std::as_const(*chunk).at(correctedLocation);
 	}
 	static const VoxelHolder empty;
 	return empty;
 }
 
+VoxelLight VoxelChunkExtendedRef::extendedLight(const InChunkVoxelLocation &location) const {
+	if (
+			location.x >= 0 && location.x < VOXEL_CHUNK_SIZE &&
+			location.y >= 0 && location.y < VOXEL_CHUNK_SIZE &&
+			location.z >= 0 && location.z < VOXEL_CHUNK_SIZE
+	) {
+		return m_chunk->light(location);
+	}
+	if (m_neighborhood != nullptr && VoxelChunkNeighborhood::contains(location)) {
+		return m_neighborhood->at(location).light;
+	}
+	InChunkVoxelLocation correctedLocation;
+	auto chunk = extendedChunk(location, correctedLocation, nullptr);
+	return chunk ? chunk->light(correctedLocation) : VoxelLight::fullSky();
+}
+
+VoxelLightLevel VoxelChunkExtendedRef::extendedLightLevel(int x, int y, int z) const {
+	return extendedLight({x, y, z}).level();
+}
+
+VoxelLightLevel VoxelChunkExtendedRef::extendedLightLevel(const InChunkVoxelLocation &location) const {
+	return extendedLight(location).level();
+}
+
+bool VoxelChunkExtendedRef::extendedMaskTest(
+		const InChunkVoxelLocation &location,
+		const VoxelChunkMask &(VoxelChunk::*mask)() const,
+		bool missingValue
+) const {
+	if (
+			location.x >= 0 && location.x < VOXEL_CHUNK_SIZE &&
+			location.y >= 0 && location.y < VOXEL_CHUNK_SIZE &&
+			location.z >= 0 && location.z < VOXEL_CHUNK_SIZE
+	) {
+		return (m_chunk->*mask)().test(VoxelChunk::voxelIndex(location.x, location.y, location.z));
+	}
+	InChunkVoxelLocation correctedLocation;
+	auto chunk = extendedChunk(location, correctedLocation, nullptr);
+	if (chunk == nullptr) return missingValue;
+	return (chunk->*mask)().test(VoxelChunk::voxelIndex(correctedLocation.x, correctedLocation.y, correctedLocation.z));
+}
+
 /* VoxelChunkMutableRef */
 
 VoxelChunkMutableRef::VoxelChunkMutableRef(
 		SharedVoxelChunk &chunk,
-		bool lockNeighbors
-): VoxelChunkExtendedRef(chunk, false, lockNeighbors) {
-	auto &l = chunk.location();
-	LOG_IF(TRACE_LOCKS, TRACE) << "Lock x=" << l.x << ",y=" << l.y << ",z=" << l.z;
-	chunk.mutex().lock();
+		LockMode neighborsMode
+): VoxelChunkExtendedRef(chunk, LockMode::EXCLUSIVE, neighborsMode) {
 }
 
-VoxelChunkMutableRef::VoxelChunkMutableRef(SharedVoxelChunk &chunk): VoxelChunkMutableRef(chunk, true) {
+VoxelChunkMutableRef::VoxelChunkMutableRef(
+		SharedVoxelChunk &chunk
+): VoxelChunkMutableRef(chunk, LockMode::SHARED) {
 }
 
 VoxelChunkMutableRef &VoxelChunkMutableRef::operator=(VoxelChunkMutableRef &&ref) noexcept {
@@ -292,6 +447,7 @@ void VoxelChunkMutableRef::unlock() {
 	std::optional<VoxelInvalidationNotifier> notifier;
 	if (m_chunk) {
 		notifier.emplace(*m_chunk);
+		m_chunk->endWrite();
 		m_chunk->mutex().unlock();
 		m_chunk = nullptr;
 	}
@@ -309,60 +465,126 @@ VoxelHolder &VoxelChunkMutableRef::at(const InChunkVoxelLocation &location) cons
 	return m_chunk->at(location);
 }
 
+bool VoxelChunkMutableRef::compact() const {
+	return m_chunk->compact();
+}
+
+void VoxelChunkMutableRef::setUniform(const VoxelHolder &voxel) const {
+	m_chunk->setUniform(voxel);
+}
+
+void VoxelChunkMutableRef::markPendingAround(const InChunkVoxelLocation &location) {
+	bool inner = location.x > 0 && location.x < VOXEL_CHUNK_SIZE - 1 &&
+		location.y > 0 && location.y < VOXEL_CHUNK_SIZE - 1 &&
+		location.z > 0 && location.z < VOXEL_CHUNK_SIZE - 1;
+	for (int dz = -1; dz <= 1; dz++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				InChunkVoxelLocation nLocation(location.x + dx, location.y + dy, location.z + dz);
+				if (inner) {
+					m_chunk->markPending(nLocation);
+				} else {
+					extendedMarkPending(nLocation);
+				}
+			}
+		}
+	}
+}
+
 void VoxelChunkMutableRef::markDirty(const InChunkVoxelLocation &location, bool markPending) {
 	m_chunk->markDirty(location);
 	if (markPending) {
-		this->markPending(location);
-		for (int dz = -1; dz <= 1; dz++) {
-			for (int dy = -1; dy <= 1; dy++) {
-				for (int dx = -1; dx <= 1; dx++) {
-					if (dx == 0 && dy == 0 && dz == 0) continue;
-					extendedMarkPending({dx, dy, dz});
+		markPendingAround(location);
+	}
+}
+
+void VoxelChunkMutableRef::markDirty(
+		const InChunkVoxelLocation &from,
+		const InChunkVoxelLocation &to,
+		bool markPending
+) {
+	std::vector<InChunkVoxelLocation> locations;
+	locations.reserve((to.x - from.x + 1) * (to.y - from.y + 1) * (to.z - from.z + 1));
+	VoxelChunk::forEachInBox(from, to, [&locations](size_t index) {
+		locations.emplace_back(VoxelChunk::voxelLocation(index));
+	});
+	m_chunk->markDirty(locations.begin(), locations.end());
+	if (!markPending) return;
+	for (int z = from.z - 1; z <= to.z + 1; z++) {
+		for (int y = from.y - 1; y <= to.y + 1; y++) {
+			for (int x = from.x - 1; x <= to.x + 1; x++) {
+				if (
+						x >= 0 && x < VOXEL_CHUNK_SIZE &&
+						y >= 0 && y < VOXEL_CHUNK_SIZE &&
+						z >= 0 && z < VOXEL_CHUNK_SIZE
+				) {
+					m_chunk->markPending({x, y, z});
+				} else {
+					extendedMarkPending({x, y, z});
 				}
 			}
 		}
 	}
 }
 
+void VoxelChunkMutableRef::markDirty(const std::vector<InChunkVoxelLocation> &locations, bool markPending) {
+	m_chunk->markDirty(locations.begin(), locations.end());
+	if (!markPending) return;
+	for (auto &location : locations) {
+		markPendingAround(location);
+	}
+}
+
+void VoxelChunkMutableRef::fill(
+		const InChunkVoxelLocation &from,
+		const InChunkVoxelLocation &to,
+		const VoxelHolder &voxel,
+		bool markDirty
+) {
+	m_chunk->fill(from, to, voxel);
+	if (markDirty) {
+		this->markDirty(from, to);
+	}
+}
+
+void VoxelChunkMutableRef::copyFrom(
+		const InChunkVoxelLocation &from,
+		const InChunkVoxelLocation &to,
+		std::span<const VoxelHolder> voxels,
+		bool markDirty
+) {
+	m_chunk->copyFrom(from, to, voxels);
+	if (markDirty) {
+		this->markDirty(from, to);
+	}
+}
+
+void VoxelChunkMutableRef::copyFrom(std::span<const VoxelHolder> voxels, bool markDirty) {
+	m_chunk->copyFrom(voxels);
+	if (markDirty) {
+		this->markDirty({0, 0, 0}, {VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1});
+	}
+}
+
+size_t VoxelChunkMutableRef::replace(VoxelTypeInterface &from, VoxelTypeInterface &to, bool markDirty) {
+	if (!markDirty) {
+		return m_chunk->replace(from, to);
+	}
+	std::vector<InChunkVoxelLocation> locations;
+	auto count = m_chunk->replace(from, to, &locations);
+	if (!locations.empty()) {
+		this->markDirty(locations);
+	}
+	return count;
+}
+
 void VoxelChunkMutableRef::markPending(const InChunkVoxelLocation &location) {
 	m_chunk->markPending(location);
 }
 
 void VoxelChunkMutableRef::extendedMarkPending(const InChunkVoxelLocation &location) {
-	assert(location.x >= -VOXEL_CHUNK_SIZE && location.x < 2 * VOXEL_CHUNK_SIZE);
-	assert(location.y >= -VOXEL_CHUNK_SIZE && location.y < 2 * VOXEL_CHUNK_SIZE);
-	assert(location.z >= -VOXEL_CHUNK_SIZE && location.z < 2 * VOXEL_CHUNK_SIZE);
-	
-	SharedVoxelChunk *chunk = m_chunk;
-	VoxelChunkLocation chunkLocation = this->location();
-	InChunkVoxelLocation correctedLocation = location;
-	if (location.x < 0) {
-		chunkLocation.x--;
-		correctedLocation.x += VOXEL_CHUNK_SIZE;
-	} else if (location.x >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.x++;
-		correctedLocation.x -= VOXEL_CHUNK_SIZE;
-	}
-	if (location.y < 0) {
-		chunkLocation.y--;
-		correctedLocation.y += VOXEL_CHUNK_SIZE;
-	} else if (location.y >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.y++;
-		correctedLocation.y -= VOXEL_CHUNK_SIZE;
-	}
-	if (location.z < 0) {
-		chunkLocation.z--;
-		correctedLocation.z += VOXEL_CHUNK_SIZE;
-	} else if (location.z >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.z++;
-		correctedLocation.z -= VOXEL_CHUNK_SIZE;
-	}
-	int dx = chunkLocation.x - this->location().x;
-	int dy = chunkLocation.y - this->location().y;
-	int dz = chunkLocation.z - this->location().z;
-	if (dx != 0 || dy != 0 || dz != 0) {
-		chunk = m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3];
-	}
+	InChunkVoxelLocation correctedLocation;
+	auto chunk = extendedChunk(location, correctedLocation, nullptr);
 	if (chunk) {
 		chunk->markPending(correctedLocation);
 	}
@@ -383,13 +605,7 @@ void VoxelChunkMutableRef::removeEntity(Entity *entity) {
 
 VoxelChunkExtendedMutableRef::VoxelChunkExtendedMutableRef(
 		SharedVoxelChunk &chunk
-): VoxelChunkMutableRef(chunk, false) {
-	for (auto neighbor : m_neighbors) {
-		if (neighbor == nullptr) continue;
-		auto &l = neighbor->location();
-		LOG_IF(TRACE_LOCKS, TRACE) << "Lock x=" << l.x << ",y=" << l.y << ",z=" << l.z;
-		neighbor->mutex().lock();
-	}
+): VoxelChunkMutableRef(chunk, LockMode::EXCLUSIVE) {
 }
 
 VoxelChunkExtendedMutableRef &VoxelChunkExtendedMutableRef::operator=(VoxelChunkExtendedMutableRef &&ref) noexcept {
@@ -403,6 +619,7 @@ VoxelChunkExtendedMutableRef::~VoxelChunkExtendedMutableRef() {
 }
 
 void VoxelChunkExtendedMutableRef::unlock() {
+	m_neighborCount = 0;
 	VoxelInvalidationNotifier notifiers[sizeof(m_neighbors) / sizeof(m_neighbors[0])];
 	for (int i = 0; i < sizeof(m_neighbors) / sizeof(m_neighbors[0]); i++) {
 		auto &neighbor = m_neighbors[i];
@@ -410,6 +627,7 @@ void VoxelChunkExtendedMutableRef::unlock() {
 		auto &l = neighbor->location();
 		notifiers[i] = VoxelInvalidationNotifier(*neighbor);
 		LOG_IF(TRACE_LOCKS, TRACE) << "Unlock x=" << l.x << ",y=" << l.y << ",z=" << l.z;
+		neighbor->endWrite();
 		neighbor->mutex().unlock();
 		neighbor = nullptr;
 	}
@@ -427,43 +645,8 @@ VoxelHolder &VoxelChunkExtendedMutableRef::extendedAt(
 		const InChunkVoxelLocation &location,
 		VoxelLocation *outLocation
 ) const {
-	assert(location.x >= -VOXEL_CHUNK_SIZE && location.x < 2 * VOXEL_CHUNK_SIZE);
-	assert(location.y >= -VOXEL_CHUNK_SIZE && location.y < 2 * VOXEL_CHUNK_SIZE);
-	assert(location.z >= -VOXEL_CHUNK_SIZE && location.z < 2 * VOXEL_CHUNK_SIZE);
-	
-	SharedVoxelChunk *chunk = m_chunk;
-	VoxelChunkLocation chunkLocation = this->location();
-	InChunkVoxelLocation correctedLocation = location;
-	if (location.x < 0) {
-		chunkLocation.x--;
-		correctedLocation.x += VOXEL_CHUNK_SIZE;
-	} else if (location.x >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.x++;
-		correctedLocation.x -= VOXEL_CHUNK_SIZE;
-	}
-	if (location.y < 0) {
-		chunkLocation.y--;
-		correctedLocation.y += VOXEL_CHUNK_SIZE;
-	} else if (location.y >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.y++;
-		correctedLocation.y -= VOXEL_CHUNK_SIZE;
-	}
-	if (location.z < 0) {
-		chunkLocation.z--;
-		correctedLocation.z += VOXEL_CHUNK_SIZE;
-	} else if (location.z >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.z++;
-		correctedLocation.z -= VOXEL_CHUNK_SIZE;
-	}
-	int dx = chunkLocation.x - this->location().x;
-	int dy = chunkLocation.y - this->location().y;
-	int dz = chunkLocation.z - this->location().z;
-	if (dx != 0 || dy != 0 || dz != 0) {
-		chunk = m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3];
-	}
-	if (outLocation != nullptr) {
-		*outLocation = VoxelLocation(chunkLocation, correctedLocation);
-	}
+	InChunkVoxelLocation correctedLocation;
+	auto chunk = extendedChunk(location, correctedLocation, outLocation);
 	if (chunk) {
 		return chunk->at(correctedLocation);
 	}
@@ -472,52 +655,12 @@ VoxelHolder &VoxelChunkExtendedMutableRef::extendedAt(
 }
 
 void VoxelChunkExtendedMutableRef::extendedMarkDirty(const InChunkVoxelLocation &location, bool markPending) {
-	assert(location.x >= -VOXEL_CHUNK_SIZE && location.x < 2 * VOXEL_CHUNK_SIZE);
-	assert(location.y >= -VOXEL_CHUNK_SIZE && location.y < 2 * VOXEL_CHUNK_SIZE);
-	assert(location.z >= -VOXEL_CHUNK_SIZE && location.z < 2 * VOXEL_CHUNK_SIZE);
-	
-	SharedVoxelChunk *chunk = m_chunk;
-	VoxelChunkLocation chunkLocation = this->location();
-	InChunkVoxelLocation correctedLocation = location;
-	if (location.x < 0) {
-		chunkLocation.x--;
-		correctedLocation.x += VOXEL_CHUNK_SIZE;
-	} else if (location.x >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.x++;
-		correctedLocation.x -= VOXEL_CHUNK_SIZE;
-	}
-	if (location.y < 0) {
-		chunkLocation.y--;
-		correctedLocation.y += VOXEL_CHUNK_SIZE;
-	} else if (location.y >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.y++;
-		correctedLocation.y -= VOXEL_CHUNK_SIZE;
-	}
-	if (location.z < 0) {
-		chunkLocation.z--;
-		correctedLocation.z += VOXEL_CHUNK_SIZE;
-	} else if (location.z >= VOXEL_CHUNK_SIZE) {
-		chunkLocation.z++;
-		correctedLocation.z -= VOXEL_CHUNK_SIZE;
-	}
-	int dx = chunkLocation.x - this->location().x;
-	int dy = chunkLocation.y - this->location().y;
-	int dz = chunkLocation.z - this->location().z;
-	if (dx != 0 || dy != 0 || dz != 0) {
-		chunk = m_neighbors[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3];
-	}
+	InChunkVoxelLocation correctedLocation;
+	auto chunk = extendedChunk(location, correctedLocation, nullptr);
 	if (chunk) {
 		chunk->markDirty(correctedLocation);
 		if (markPending) {
-			chunk->markPending(correctedLocation);
-			for (dz = -1; dz <= 1; dz++) {
-				for (dy = -1; dy <= 1; dy++) {
-					for (dx = -1; dx <= 1; dx++) {
-						if (dx == 0 && dy == 0 && dz == 0) continue;
-						extendedMarkPending({location.x + dx, location.y + dy, location.z + dz});
-					}
-				}
-			}
+			markPendingAround(location);
 		}
 	}
 }
@@ -535,6 +678,7 @@ void VoxelChunkExtendedMutableRef::update(unsigned long time) {
 			for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
 				for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
 					InChunkVoxelLocation location(x, y, z);
+					if (!VoxelChunkRef::at(location).type().invokeHasUpdate()) continue;
 					if (at(location).update(*this, location, deltaTime, invalidatedLocations)) {
 						m_chunk->markPending(location);
 					}
@@ -543,6 +687,7 @@ void VoxelChunkExtendedMutableRef::update(unsigned long time) {
 		}
 	} else {
 		for (auto &location : m_chunk->takePendingLocations()) {
+			if (!VoxelChunkRef::at(location).type().invokeHasUpdate()) continue;
 			if (at(location).update(*this, location, deltaTime, invalidatedLocations)) {
 				m_chunk->markPending(location);
 			}
@@ -555,6 +700,7 @@ void VoxelChunkExtendedMutableRef::update(unsigned long time) {
 				locationGenerator(randomEngine),
 				locationGenerator(randomEngine)
 		);
+		if (!VoxelChunkRef::at(location).type().invokeHasSlowUpdate()) continue;
 		at(location).slowUpdate(*this, location, invalidatedLocations);
 	}
 	auto prevUpdatedAt = m_chunk->updatedAt();
@@ -573,6 +719,9 @@ void VoxelChunkExtendedMutableRef::update(unsigned long time) {
 		m_chunk->world().storeChunk(location());
 		m_chunk->setStoredAt(time);
 	}
+	if (m_chunk->idleUpdate()) {
+		m_chunk->compact();
+	}
 }
 
 void VoxelChunkExtendedMutableRef::extendedAddEntity(Entity *entity) {
@@ -597,7 +746,139 @@ void VoxelChunkExtendedMutableRef::extendedRemoveEntity(Entity *entity) {
 
 /* VoxelWorld */
 
+size_t SharedVoxelChunkPool::residentSize(const SharedVoxelChunk &chunk) {
+	return sizeof(SharedVoxelChunk) - sizeof(VoxelChunk) + chunk.memoryUsage();
+}
+
+std::unique_ptr<SharedVoxelChunk> SharedVoxelChunkPool::acquire(
+		VoxelWorld &world,
+		const VoxelChunkLocation &location
+) {
+	if (m_chunks.empty()) {
+		m_stats.misses++;
+		return std::make_unique<SharedVoxelChunk>(world, location);
+	}
+	auto chunk = std::move(m_chunks.back());
+	m_chunks.pop_back();
+	assert(&chunk->world() == &world);
+	m_stats.hits++;
+	m_stats.pooledChunks--;
+	m_stats.residentBytes -= residentSize(*chunk);
+	chunk->reset(location);
+	return chunk;
+}
+
+void SharedVoxelChunkPool::release(std::unique_ptr<SharedVoxelChunk> chunk) {
+	if (m_chunks.size() >= m_capacity) {
+		m_stats.discarded++;
+		return;
+	}
+	chunk->reset(chunk->location());
+	m_stats.pooledChunks++;
+	m_stats.residentBytes += residentSize(*chunk);
+	m_chunks.emplace_back(std::move(chunk));
+}
+
+void SharedVoxelChunkPool::setCapacity(size_t capacity) {
+	m_capacity = capacity;
+	while (m_chunks.size() > m_capacity) {
+		m_stats.pooledChunks--;
+		m_stats.residentBytes -= residentSize(*m_chunks.back());
+		m_chunks.pop_back();
+	}
+}
+
+class VoxelWorld::ShardsLock {
+	VoxelWorld &m_world;
+	std::bitset<CHUNK_SHARD_COUNT> m_shards;
+	
+	void lock() {
+		for (size_t i = 0; i < CHUNK_SHARD_COUNT; i++) {
+			if (m_shards.test(i)) {
+				m_world.m_shards[i].mutex.lock();
+			}
+		}
+	}
+	
+public:
+	// Shards of the chunk and its neighbors, always locked in the index order
+	ShardsLock(VoxelWorld &world, const VoxelChunkLocation &location): m_world(world) {
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					m_shards.set(shardIndex({location.x + dx, location.y + dy, location.z + dz}));
+				}
+			}
+		}
+		lock();
+	}
+	
+	// All shards
+	explicit ShardsLock(VoxelWorld &world): m_world(world) {
+		m_shards.set();
+		lock();
+	}
+	
+	ShardsLock(const ShardsLock&) = delete;
+	ShardsLock &operator=(const ShardsLock&) = delete;
+	
+	~ShardsLock() {
+		for (size_t i = 0; i < CHUNK_SHARD_COUNT; i++) {
+			if (m_shards.test(i)) {
+				m_world.m_shards[i].mutex.unlock();
+			}
+		}
+	}
+	
+};
+
 VoxelWorld::VoxelWorld(VoxelChunkListener *chunkListener): m_chunkListener(chunkListener) {
+	if (m_chunkListener != nullptr) {
+		m_chunkEventThread = std::thread(&VoxelWorld::runChunkEvents, this);
+	}
+}
+
+VoxelWorld::~VoxelWorld() {
+	shutdownChunkEvents();
+}
+
+void VoxelWorld::shutdownChunkEvents() {
+	if (!m_chunkEventThread.joinable()) return;
+	m_chunkEvents.close();
+	m_chunkEventThread.join();
+}
+
+void VoxelWorld::postChunkEvents(SharedVoxelChunk &chunk, uint8_t types) {
+	if (m_chunkListener == nullptr) return;
+	if (chunk.addPendingEvents(types)) {
+		m_chunkEvents.push(chunk.location());
+	}
+}
+
+void VoxelWorld::runChunkEvents() {
+	LOG(INFO) << "Chunk event thread started";
+	std::vector<VoxelChunkLocation> locations;
+	std::vector<VoxelChunkEvent> events;
+	bool running = true;
+	while (running) {
+		locations.clear();
+		running = m_chunkEvents.pop(locations);
+		events.clear();
+		for (auto &location : locations) {
+			// The shard lock keeps the chunk from being erased, the event state itself is atomic
+			auto &shard = this->shard(location);
+			std::shared_lock<std::shared_mutex> lock(shard.mutex);
+			auto chunk = findChunk(location);
+			if (chunk == nullptr) continue;
+			auto types = chunk->takePendingEvents();
+			if (types == 0) continue;
+			events.push_back({location, types, chunk->lightState()});
+		}
+		if (!events.empty()) {
+			m_chunkListener->chunkEvents(events);
+		}
+	}
+	LOG(INFO) << "Chunk event thread stopped";
 }
 
 void VoxelWorld::setChunkLoader(VoxelChunkLoader *chunkLoader) {
@@ -605,24 +886,60 @@ void VoxelWorld::setChunkLoader(VoxelChunkLoader *chunkLoader) {
 	m_chunkLoader = chunkLoader;
 }
 
-template<typename T> T VoxelWorld::createChunk(const VoxelChunkLocation &location) {
+size_t VoxelWorld::shardIndex(const VoxelChunkLocation &location) {
+	auto hash = ((uint32_t) location.x * 73856093u) ^ ((uint32_t) location.y * 19349663u) ^
+		((uint32_t) location.z * 83492791u);
+	return (hash ^ (hash >> 16)) % CHUNK_SHARD_COUNT;
+}
+
+SharedVoxelChunk *VoxelWorld::findChunk(const VoxelChunkLocation &location) {
+	auto &chunks = shard(location).chunks;
+	auto it = chunks.find(location);
+	return it != chunks.end() ? it->second.get() : nullptr;
+}
+
+template<typename T> T VoxelWorld::createChunk(const VoxelChunkLocation &location, bool *created) {
 	if (m_chunkLoader) {
 		m_chunkLoader->cancelLoadAsync(*this, location);
 	}
-	auto it = m_chunks.find(location);
-	if (it != m_chunks.end()) {
-		return T(*it->second);
+	ShardsLock lock(*this, location);
+	auto existing = findChunk(location);
+	if (existing != nullptr) {
+		if constexpr (std::is_base_of_v<VoxelChunkMutableRef, T>) {
+			existing->setUnloading(false);
+		}
+		return T(*existing);
+	}
+	std::unique_ptr<SharedVoxelChunk> chunkPtr;
+	{
+		std::unique_lock<std::mutex> poolLock(m_mutex);
+		chunkPtr = m_chunkPool.acquire(*this, location);
 	}
-	auto chunkPtr = std::make_unique<SharedVoxelChunk>(*this, location);
 	auto &chunk = *chunkPtr;
-	chunk.setNeighbors(m_chunks);
-	m_chunks.emplace(location, std::move(chunkPtr));
+	chunk.setNeighbors();
+	shard(location).chunks.emplace(location, std::move(chunkPtr));
+	m_chunkCount++;
+	{
+		std::unique_lock<std::shared_mutex> regionsLock(m_regionsMutex);
+		m_regions.insert(location, &chunk);
+	}
+	if (created) {
+		*created = true;
+	}
+	auto ready = chunkPresenceChanged(location, &chunk);
+	runChunkRequests(ready);
 	return T(chunk);
 }
 
-template<typename T> T VoxelWorld::createAndLoadChunk(const VoxelChunkLocation &location, std::unique_lock<std::mutex> &lock) {
-	auto chunk = createChunk<T>(location);
-	lock.unlock();
+template<typename T> T VoxelWorld::createAndLoadChunk(const VoxelChunkLocation &location, bool *created) {
+	bool chunkCreated = false;
+	auto chunk = createChunk<T>(location, &chunkCreated);
+	if (created) {
+		*created = chunkCreated;
+	}
+	if (!chunkCreated) {
+		return chunk;
+	}
 	if (m_chunkLoader != nullptr) {
 		m_chunkLoader->load(chunk);
 	} else {
@@ -632,7 +949,7 @@ template<typename T> T VoxelWorld::createAndLoadChunk(const VoxelChunkLocation &
 	return chunk;
 }
 
-VoxelChunkRef VoxelWorld::chunk(
+template<typename T> T VoxelWorld::lookupChunk(
 		const VoxelChunkLocation &location,
 		MissingChunkPolicy policy,
 		bool *created
@@ -640,30 +957,42 @@ VoxelChunkRef VoxelWorld::chunk(
 	if (created) {
 		*created = false;
 	}
-	std::unique_lock<std::mutex> lock(m_mutex);
-	auto it = m_chunks.find(location);
-	if (it == m_chunks.end()) {
-		switch (policy) {
-			case MissingChunkPolicy::NONE:
-				return VoxelChunkRef();
-			case MissingChunkPolicy::CREATE:
-				if (created) {
-					*created = true;
-				}
-				return createChunk<VoxelChunkRef>(location);
-			case MissingChunkPolicy::LOAD:
-				if (created) {
-					*created = true;
-				}
-				createAndLoadChunk<VoxelChunkMutableRef>(location, lock);
-				return chunk(location, MissingChunkPolicy::NONE);
-			case MissingChunkPolicy::LOAD_ASYNC:
-				lock.unlock();
-				m_chunkLoader->loadAsync(*this, location);
-				return VoxelChunkRef();
+	{
+		auto &shard = this->shard(location);
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		auto it = shard.chunks.find(location);
+		if (it != shard.chunks.end()) {
+			if constexpr (std::is_base_of_v<VoxelChunkMutableRef, T>) {
+				it->second->setUnloading(false);
+			}
+			return T(*it->second);
 		}
 	}
-	return VoxelChunkRef(*it->second);
+	switch (policy) {
+		case MissingChunkPolicy::NONE:
+			break;
+		case MissingChunkPolicy::CREATE:
+			return createChunk<T>(location, created);
+		case MissingChunkPolicy::LOAD:
+			if constexpr (std::is_base_of_v<VoxelChunkMutableRef, T>) {
+				return createAndLoadChunk<T>(location, created);
+			} else {
+				createAndLoadChunk<VoxelChunkMutableRef>(location, created);
+				return lookupChunk<T>(location, MissingChunkPolicy::NONE, nullptr);
+			}
+		case MissingChunkPolicy::LOAD_ASYNC:
+			m_chunkLoader->loadAsync(*this, location);
+			break;
+	}
+	return T();
+}
+
+VoxelChunkRef VoxelWorld::chunk(
+		const VoxelChunkLocation &location,
+		MissingChunkPolicy policy,
+		bool *created
+) {
+	return lookupChunk<VoxelChunkRef>(location, policy, created);
 }
 
 VoxelChunkExtendedRef VoxelWorld::extendedChunk(
@@ -671,33 +1000,7 @@ VoxelChunkExtendedRef VoxelWorld::extendedChunk(
 		MissingChunkPolicy policy,
 		bool *created
 ) {
-	if (created) {
-		*created = false;
-	}
-	std::unique_lock<std::mutex> lock(m_mutex);
-	auto it = m_chunks.find(location);
-	if (it == m_chunks.end()) {
-		switch (policy) {
-			case MissingChunkPolicy::NONE:
-				return VoxelChunkExtendedRef();
-			case MissingChunkPolicy::CREATE:
-				if (created) {
-					*created = true;
-				}
-				return createChunk<VoxelChunkExtendedRef>(location);
-			case MissingChunkPolicy::LOAD:
-				if (created) {
-					*created = true;
-				}
-				createAndLoadChunk<VoxelChunkMutableRef>(location, lock);
-				return extendedChunk(location, MissingChunkPolicy::NONE);
-			case MissingChunkPolicy::LOAD_ASYNC:
-				lock.unlock();
-				m_chunkLoader->loadAsync(*this, location);
-				return VoxelChunkExtendedRef();
-		}
-	}
-	return VoxelChunkExtendedRef(*it->second);
+	return lookupChunk<VoxelChunkExtendedRef>(location, policy, created);
 }
 
 VoxelChunkMutableRef VoxelWorld::mutableChunk(
@@ -705,33 +1008,7 @@ VoxelChunkMutableRef VoxelWorld::mutableChunk(
 		MissingChunkPolicy policy,
 		bool *created
 ) {
-	if (created) {
-		*created = false;
-	}
-	std::unique_lock<std::mutex> lock(m_mutex);
-	auto it = m_chunks.find(location);
-	if (it == m_chunks.end()) {
-		switch (policy) {
-			case MissingChunkPolicy::NONE:
-				return VoxelChunkMutableRef();
-			case MissingChunkPolicy::CREATE:
-				if (created) {
-					*created = true;
-				}
-				return createChunk<VoxelChunkMutableRef>(location);
-			case MissingChunkPolicy::LOAD:
-				if (created) {
-					*created = true;
-				}
-				return createAndLoadChunk<VoxelChunkMutableRef>(location, lock);
-			case MissingChunkPolicy::LOAD_ASYNC:
-				lock.unlock();
-				m_chunkLoader->loadAsync(*this, location);
-				return VoxelChunkMutableRef();
-		}
-	}
-	it->second->setUnloading(false);
-	return VoxelChunkMutableRef(*it->second);
+	return lookupChunk<VoxelChunkMutableRef>(location, policy, created);
 }
 
 VoxelChunkExtendedMutableRef VoxelWorld::extendedMutableChunk(
@@ -739,44 +1016,51 @@ VoxelChunkExtendedMutableRef VoxelWorld::extendedMutableChunk(
 		MissingChunkPolicy policy,
 		bool *created
 ) {
-	if (created) {
-		*created = false;
-	}
-	std::unique_lock<std::mutex> lock(m_mutex);
-	auto it = m_chunks.find(location);
-	if (it == m_chunks.end()) {
-		switch (policy) {
-			case MissingChunkPolicy::NONE:
-				return VoxelChunkExtendedMutableRef();
-			case MissingChunkPolicy::CREATE:
-				if (created) {
-					*created = true;
-				}
-				return createChunk<VoxelChunkExtendedMutableRef>(location);
-			case MissingChunkPolicy::LOAD:
-				if (created) {
-					*created = true;
-				}
-				return createAndLoadChunk<VoxelChunkExtendedMutableRef>(location, lock);
-			case MissingChunkPolicy::LOAD_ASYNC:
-				lock.unlock();
-				m_chunkLoader->loadAsync(*this, location);
-				return VoxelChunkExtendedMutableRef();
-		}
+	return lookupChunk<VoxelChunkExtendedMutableRef>(location, policy, created);
+}
+
+std::vector<VoxelChunkRef> VoxelWorld::acquire(std::span<const VoxelChunkLocation> locations) {
+	std::vector<VoxelChunkLocation> sorted(locations.begin(), locations.end());
+	std::sort(sorted.begin(), sorted.end());
+	sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+	std::vector<VoxelChunkRef> refs;
+	refs.reserve(sorted.size());
+	for (auto &location : sorted) {
+		auto ref = lookupChunk<VoxelChunkRef>(location, MissingChunkPolicy::NONE, nullptr);
+		if (!ref) continue;
+		refs.emplace_back(std::move(ref));
 	}
-	it->second->setUnloading(false);
-	return VoxelChunkExtendedMutableRef(*it->second);
+	return refs;
 }
 
-void VoxelWorld::chunkStored(const VoxelChunkLocation &location) {
-	std::unique_lock<std::mutex> lock(m_mutex);
-	auto it = m_chunks.find(location);
-	if (it == m_chunks.end()) return;
-	if (!it->second->unloading()) return;
+void VoxelWorld::eraseChunk(const VoxelChunkLocation &location) {
+	auto &chunks = shard(location).chunks;
+	auto it = chunks.find(location);
+	assert(it != chunks.end());
 	std::unique_lock<std::shared_mutex> chunkLock(it->second->mutex());
 	it->second->unsetNeighbors();
 	chunkLock.unlock();
-	m_chunks.erase(it);
+	{
+		std::unique_lock<std::shared_mutex> regionsLock(m_regionsMutex);
+		m_regions.erase(location);
+	}
+	chunkPresenceChanged(location, nullptr);
+	auto chunk = std::move(it->second);
+	chunk->setUnloading(false);
+	chunks.erase(it);
+	m_chunkCount--;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_chunkPool.release(std::move(chunk));
+}
+
+bool VoxelWorld::chunkStored(const VoxelChunkLocation &location, unsigned long version) {
+	ShardsLock lock(*this, location);
+	auto chunk = findChunk(location);
+	if (chunk == nullptr || !chunk->unloading()) return true;
+	// Neighbor-centered extended refs can modify the chunk without cancelling the unload
+	if (chunk->version() != version) return false;
+	eraseChunk(location);
+	return true;
 }
 
 void VoxelWorld::storeChunk(const VoxelChunkLocation &location) {
@@ -786,38 +1070,274 @@ void VoxelWorld::storeChunk(const VoxelChunkLocation &location) {
 }
 
 void VoxelWorld::unloadChunks(const std::vector<VoxelChunkLocation> &locations) {
-	std::unique_lock<std::mutex> lock(m_mutex);
 	for (auto &location : locations) {
-		auto it = m_chunks.find(location);
-		if (it == m_chunks.end()) continue;
-		if (it->second->storedAt() < (long) it->second->updatedAt() && m_chunkLoader != nullptr) {
-			if (it->second->unloading()) continue;
-			it->second->setUnloading(true);
+		ShardsLock lock(*this, location);
+		auto chunk = findChunk(location);
+		if (chunk == nullptr) continue;
+		if (chunk->storedAt() < (long) chunk->updatedAt() && m_chunkLoader != nullptr) {
+			if (chunk->unloading()) continue;
+			chunk->setUnloading(true);
 			m_chunkLoader->storeChunkAsync(*this, location);
 		} else {
-			std::unique_lock<std::shared_mutex> chunkLock(it->second->mutex());
-			it->second->unsetNeighbors();
-			chunkLock.unlock();
-			m_chunks.erase(it);
+			eraseChunk(location);
 		}
 	}
 }
 
 void VoxelWorld::unload() {
 	LOG(INFO) << "Unloading world";
-	std::unique_lock<std::mutex> lock(m_mutex);
-	auto it = m_chunks.begin();
-	while (it != m_chunks.end()) {
-		if (it->second->storedAt() < (long) it->second->updatedAt() && m_chunkLoader != nullptr) {
-			if (it->second->unloading()) continue;
-			it->second->setUnloading(true);
-			m_chunkLoader->storeChunkAsync(*this, it->first);
-			++it;
+	ShardsLock lock(*this);
+	std::vector<VoxelChunkLocation> erased;
+	for (auto &shard : m_shards) {
+		for (auto &[location, chunk] : shard.chunks) {
+			if (chunk->storedAt() < (long) chunk->updatedAt() && m_chunkLoader != nullptr) {
+				if (chunk->unloading()) continue;
+				chunk->setUnloading(true);
+				m_chunkLoader->storeChunkAsync(*this, location);
+			} else {
+				erased.emplace_back(location);
+			}
+		}
+	}
+	for (auto &location : erased) {
+		eraseChunk(location);
+	}
+}
+
+bool VoxelWorld::lightStateReached(VoxelChunkLightState lightState, VoxelChunkLightState readiness) {
+	// The first unlock turns READY into COMPLETE, so a chunk reported READY satisfies both
+	if (lightState == VoxelChunkLightState::READY) {
+		lightState = VoxelChunkLightState::COMPLETE;
+	}
+	return lightState >= readiness;
+}
+
+void VoxelWorld::takeReadyChunkRequests(
+		std::unordered_map<VoxelChunkLocation, ChunkRequests>::iterator it,
+		std::vector<ReadyChunkRequest> &ready
+) {
+	auto &entry = it->second;
+	if (entry.loaded.all()) {
+		auto readyIt = std::stable_partition(entry.requests.begin(), entry.requests.end(), [&entry](auto &request) {
+			return !lightStateReached(entry.lightState, request.readiness);
+		});
+		for (auto requestIt = readyIt; requestIt != entry.requests.end(); ++requestIt) {
+			m_runningChunkRequests.emplace_back(requestIt->owner);
+			ready.push_back({it->first, std::move(*requestIt)});
+		}
+		entry.requests.erase(readyIt, entry.requests.end());
+	}
+	if (entry.requests.empty()) {
+		m_chunkRequests.erase(it);
+		m_chunkRequestCount--;
+	}
+}
+
+std::vector<VoxelWorld::ReadyChunkRequest> VoxelWorld::chunkPresenceChanged(
+		const VoxelChunkLocation &location,
+		const SharedVoxelChunk *chunk
+) {
+	std::vector<ReadyChunkRequest> ready;
+	if (m_chunkRequestCount == 0) return ready;
+	bool present = chunk != nullptr;
+	std::unique_lock<std::mutex> lock(m_chunkRequestsMutex);
+	if (present) {
+		m_requestedLoads.erase(location);
+	}
+	for (int dz = -1; dz <= 1; dz++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				// The chunk is the (-dx, -dy, -dz) neighbor of the requested location
+				auto it = m_chunkRequests.find({location.x + dx, location.y + dy, location.z + dz});
+				if (it == m_chunkRequests.end()) continue;
+				it->second.loaded.set((1 - dx) + (1 - dy) * 3 + (1 - dz) * 3 * 3, present);
+				if (dx == 0 && dy == 0 && dz == 0) {
+					// Reports of the previous life may still arrive, the generation tells them apart
+					it->second.lightState = VoxelChunkLightState::PENDING_INITIAL;
+					it->second.generation = present ? chunk->generation() : 0;
+					it->second.version = 0;
+				}
+				if (present) {
+					takeReadyChunkRequests(it, ready);
+				}
+			}
+		}
+	}
+	return ready;
+}
+
+void VoxelWorld::chunkLightStateChanged(
+		const VoxelChunkLocation &location,
+		unsigned long generation,
+		VoxelChunkLightState lightState,
+		unsigned long version
+) {
+	if (m_chunkRequestCount == 0) return;
+	std::vector<ReadyChunkRequest> ready;
+	{
+		std::unique_lock<std::mutex> lock(m_chunkRequestsMutex);
+		auto it = m_chunkRequests.find(location);
+		if (it == m_chunkRequests.end()) return;
+		// The chunk could be erased and created again between its unlock and the report
+		if (generation != it->second.generation || version < it->second.version) return;
+		it->second.lightState = lightState;
+		it->second.version = version;
+		takeReadyChunkRequests(it, ready);
+	}
+	runChunkRequests(ready);
+}
+
+void VoxelWorld::runChunkRequests(std::vector<ReadyChunkRequest> &ready) {
+	if (ready.empty()) return;
+	for (auto &[location, request] : ready) {
+		request.callback(location);
+	}
+	std::unique_lock<std::mutex> lock(m_chunkRequestsMutex);
+	for (auto &[location, request] : ready) {
+		auto it = std::find(m_runningChunkRequests.begin(), m_runningChunkRequests.end(), request.owner);
+		assert(it != m_runningChunkRequests.end());
+		m_runningChunkRequests.erase(it);
+	}
+	m_chunkRequestsCondVar.notify_all();
+}
+
+void VoxelWorld::setChunkComplete(SharedVoxelChunk &chunk, bool complete) {
+	std::unique_lock<std::mutex> lock(m_completeChunksMutex);
+	if (complete) {
+		chunk.m_prevComplete = nullptr;
+		chunk.m_nextComplete = m_completeChunks;
+		if (m_completeChunks != nullptr) {
+			m_completeChunks->m_prevComplete = &chunk;
+		}
+		m_completeChunks = &chunk;
+		m_completeChunkCount++;
+	} else {
+		if (chunk.m_prevComplete != nullptr) {
+			chunk.m_prevComplete->m_nextComplete = chunk.m_nextComplete;
+		} else {
+			m_completeChunks = chunk.m_nextComplete;
+		}
+		if (chunk.m_nextComplete != nullptr) {
+			chunk.m_nextComplete->m_prevComplete = chunk.m_prevComplete;
+		}
+		chunk.m_prevComplete = nullptr;
+		chunk.m_nextComplete = nullptr;
+		m_completeChunkCount--;
+	}
+	chunk.m_linkedComplete = complete;
+}
+
+void VoxelWorld::updatableChunkLocations(std::vector<VoxelChunkLocation> &locations) {
+	// Unlinking requires the mutex, so the linked chunks stay alive while it is held
+	std::unique_lock<std::mutex> lock(m_completeChunksMutex);
+	for (auto chunk = m_completeChunks; chunk != nullptr; chunk = chunk->m_nextComplete) {
+		if (!chunk->updatable()) continue;
+		locations.emplace_back(chunk->location());
+	}
+}
+
+size_t VoxelWorld::completeChunkCount() {
+	std::unique_lock<std::mutex> lock(m_completeChunksMutex);
+	return m_completeChunkCount;
+}
+
+void VoxelWorld::requestChunk(
+		const VoxelChunkLocation &location,
+		VoxelChunkLightState readiness,
+		const void *owner,
+		VoxelChunkRequestCallback callback
+) {
+	std::vector<VoxelChunkLocation> loads;
+	std::vector<ReadyChunkRequest> ready;
+	bool loaded;
+	{
+		ShardsLock lock(*this, location);
+		std::unique_lock<std::mutex> requestsLock(m_chunkRequestsMutex);
+		auto [it, inserted] = m_chunkRequests.try_emplace(location);
+		auto &entry = it->second;
+		if (inserted) {
+			m_chunkRequestCount++;
+			for (int dz = -1; dz <= 1; dz++) {
+				for (int dy = -1; dy <= 1; dy++) {
+					for (int dx = -1; dx <= 1; dx++) {
+						VoxelChunkLocation neighborLocation(location.x + dx, location.y + dy, location.z + dz);
+						if (auto neighbor = findChunk(neighborLocation)) {
+							entry.loaded.set((dx + 1) + (dy + 1) * 3 + (dz + 1) * 3 * 3);
+							if (dx == 0 && dy == 0 && dz == 0) {
+								entry.generation = neighbor->generation();
+							}
+						} else if (m_requestedLoads.emplace(neighborLocation).second) {
+							loads.emplace_back(neighborLocation);
+						}
+					}
+				}
+			}
+		}
+		auto requestIt = std::find_if(entry.requests.begin(), entry.requests.end(), [owner](auto &request) {
+			return request.owner == owner;
+		});
+		if (requestIt != entry.requests.end()) {
+			requestIt->readiness = readiness;
+			requestIt->callback = std::move(callback);
+		} else {
+			entry.requests.push_back({owner, readiness, std::move(callback)});
+		}
+		loaded = entry.loaded.test(13);
+		takeReadyChunkRequests(it, ready);
+	}
+	runChunkRequests(ready);
+	if (m_chunkLoader != nullptr) {
+		for (auto &loadLocation : loads) {
+			m_chunkLoader->loadAsync(*this, loadLocation);
+		}
+	}
+	if (loaded) {
+		// Unlocking reports the current light state to the requests and to the listener, which starts pending light
+		chunk(location).unlock();
+	}
+}
+
+void VoxelWorld::cancelChunkRequest(const VoxelChunkLocation &location, const void *owner) {
+	std::unique_lock<std::mutex> lock(m_chunkRequestsMutex);
+	auto it = m_chunkRequests.find(location);
+	if (it == m_chunkRequests.end()) return;
+	auto &requests = it->second.requests;
+	requests.erase(std::remove_if(requests.begin(), requests.end(), [owner](auto &request) {
+		return request.owner == owner;
+	}), requests.end());
+	if (requests.empty()) {
+		m_chunkRequests.erase(it);
+		m_chunkRequestCount--;
+	}
+}
+
+void VoxelWorld::cancelChunkRequests(const void *owner) {
+	std::unique_lock<std::mutex> lock(m_chunkRequestsMutex);
+	auto it = m_chunkRequests.begin();
+	while (it != m_chunkRequests.end()) {
+		auto &requests = it->second.requests;
+		requests.erase(std::remove_if(requests.begin(), requests.end(), [owner](auto &request) {
+			return request.owner == owner;
+		}), requests.end());
+		if (requests.empty()) {
+			it = m_chunkRequests.erase(it);
+			m_chunkRequestCount--;
 		} else {
-			std::unique_lock<std::shared_mutex> chunkLock(it->second->mutex());
-			it->second->unsetNeighbors();
-			chunkLock.unlock();
-			it = m_chunks.erase(it);
+			++it;
 		}
 	}
+	while (std::find(m_runningChunkRequests.begin(), m_runningChunkRequests.end(), owner) !=
+			m_runningChunkRequests.end()) {
+		m_chunkRequestsCondVar.wait(lock);
+	}
+}
+
+void VoxelWorld::setChunkPoolCapacity(size_t capacity) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_chunkPool.setCapacity(capacity);
+}
+
+SharedVoxelChunkPool::Stats VoxelWorld::chunkPoolStats() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_chunkPool.stats();
 }
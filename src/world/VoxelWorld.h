@@ -1,12 +1,29 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <bitset>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <unordered_set>
 #include <unordered_map>
 #include <shared_mutex>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "VoxelChunk.h"
+#include "VoxelChunkEventQueue.h"
+#include "VoxelRegionIndex.h"
 
 class Entity;
 class VoxelWorld;
+class VoxelChunkNeighborhood;
 
 enum class VoxelChunkLightState {
 	PENDING_INITIAL,
@@ -19,30 +36,90 @@ enum class VoxelChunkLightState {
 class SharedVoxelChunk: public VoxelChunk {
 	VoxelWorld &m_world;
 	SharedVoxelChunk *m_neighbors[3 * 3 * 3] = {};
+	// Bit per loaded neighbor in m_neighbors order, changed under the shards lock of the chunk
+	std::atomic<uint32_t> m_neighborMask = 0;
+	// Links of VoxelWorld's list of chunks having all neighbors loaded
+	SharedVoxelChunk *m_prevComplete = nullptr;
+	SharedVoxelChunk *m_nextComplete = nullptr;
+	bool m_linkedComplete = false;
 	std::shared_mutex m_mutex;
-	VoxelChunkLightState m_lightState = VoxelChunkLightState::PENDING_INITIAL;
-	std::unordered_set<InChunkVoxelLocation> m_dirtyLocations;
-	std::unordered_set<InChunkVoxelLocation> m_pendingLocations;
+	std::atomic<VoxelChunkLightState> m_lightState = VoxelChunkLightState::PENDING_INITIAL;
+	// VoxelChunkEvent types not delivered yet, the chunk is queued while they are not empty
+	std::atomic<uint8_t> m_pendingEvents = 0;
+	VoxelChunkLocationSet m_dirtyLocations;
+	VoxelChunkLocationSet m_pendingLocations;
+	VoxelChunkLocationSet m_relightLocations;
 	bool m_pendingInitialUpdate = true;
-	bool m_unloading = false;
+	std::atomic<bool> m_unloading = false;
+	std::atomic<unsigned long> m_version = 0;
+	// Unique per life of the chunk object, tells reports of a pooled or re-created chunk from the earlier ones
+	unsigned long m_generation;
+	std::weak_ptr<const VoxelChunk> m_snapshot;
+	unsigned long m_snapshotVersion = 1;
+	std::mutex m_snapshotMutex;
 	unsigned long m_updatedAt = 0;
 	long m_storedAt = 0;
+	// Updates in a row without dirty or pending voxels, the chunk is compacted while it stays idle
+	unsigned int m_idleUpdates = 0;
 	std::unordered_set<Entity*> m_entities;
 	
+	void releaseEntities();
+	void setNeighbor(int index, SharedVoxelChunk *chunk);
+	
+	friend class VoxelWorld;
+	
 public:
-	SharedVoxelChunk(VoxelWorld &world, const VoxelChunkLocation &location): VoxelChunk(location), m_world(world) {
-	}
+	static constexpr uint32_t ALL_NEIGHBORS = ((1u << 27) - 1) & ~(1u << 13);
+	static constexpr unsigned int COMPACT_IDLE_UPDATES = 50;
+	
+	SharedVoxelChunk(VoxelWorld &world, const VoxelChunkLocation &location);
 	~SharedVoxelChunk();
 	
-	void setNeighbors(const std::unordered_map<VoxelChunkLocation, std::unique_ptr<SharedVoxelChunk>> &chunks);
+	// Drops the content, entities and neighbor links, the chunk becomes a freshly created one at the new location
+	void reset(const VoxelChunkLocation &location);
+	void setNeighbors();
 	void unsetNeighbors();
 	
 	[[nodiscard]] SharedVoxelChunk *neighbor(int dx, int dy, int dz) const;
 	
+	[[nodiscard]] int neighborCount() const {
+		return std::popcount(m_neighborMask.load(std::memory_order_relaxed));
+	}
+	
+	[[nodiscard]] bool neighborsComplete() const {
+		return m_neighborMask.load(std::memory_order_relaxed) == ALL_NEIGHBORS;
+	}
+	
+	// All neighbors are loaded and the light is complete, so the chunk can be simulated
+	[[nodiscard]] bool updatable() const {
+		return neighborsComplete() && m_lightState == VoxelChunkLightState::COMPLETE && !m_unloading;
+	}
+	
 	[[nodiscard]] std::shared_mutex &mutex() {
 		return m_mutex;
 	}
 	
+	// Seqlock-style counter: odd while a writer holds the chunk exclusively, so it can be checked without locking
+	[[nodiscard]] unsigned long version() const {
+		return m_version.load(std::memory_order_acquire);
+	}
+	
+	void beginWrite() {
+		m_version.fetch_add(1, std::memory_order_acq_rel);
+	}
+	
+	void endWrite() {
+		m_version.fetch_add(1, std::memory_order_release);
+	}
+	
+	// Versions are comparable only between reports of the same generation
+	[[nodiscard]] unsigned long generation() const {
+		return m_generation;
+	}
+	
+	// Requires at least a shared lock. Snapshots of an unmodified chunk share the same copy while anyone holds it
+	[[nodiscard]] std::shared_ptr<const VoxelChunk> snapshot();
+	
 	[[nodiscard]] VoxelWorld &world() const {
 		return m_world;
 	}
@@ -55,6 +132,21 @@ public:
 		m_lightState = state;
 	}
 	
+	// READY turns into COMPLETE once it is reported, returns true for the only caller that did it
+	bool completeLight() {
+		auto expected = VoxelChunkLightState::READY;
+		return m_lightState.compare_exchange_strong(expected, VoxelChunkLightState::COMPLETE);
+	}
+	
+	// Returns true if the chunk had no undelivered events, then the caller has to queue it
+	bool addPendingEvents(uint8_t types) {
+		return m_pendingEvents.fetch_or(types, std::memory_order_acq_rel) == 0;
+	}
+	
+	uint8_t takePendingEvents() {
+		return m_pendingEvents.exchange(0, std::memory_order_acq_rel);
+	}
+	
 	void invalidateLight() {
 		switch (m_lightState) {
 			case VoxelChunkLightState::PENDING_INITIAL:
@@ -74,12 +166,22 @@ public:
 		}
 	}
 	
-	[[nodiscard]] const std::unordered_set<InChunkVoxelLocation> &dirtyLocations() const {
+	[[nodiscard]] const VoxelChunkLocationSet &dirtyLocations() const {
 		return m_dirtyLocations;
 	}
 	
 	void markDirty(const InChunkVoxelLocation &location) {
-		m_dirtyLocations.emplace(location);
+		updateMasks(location);
+		m_dirtyLocations.insert(location);
+		m_idleUpdates = 0;
+		invalidateStorage();
+		invalidateLight();
+	}
+	
+	// Bulk operations keep the masks up to date by themselves
+	template<typename Iterator> void markDirty(Iterator begin, Iterator end) {
+		m_dirtyLocations.insert(begin, end);
+		m_idleUpdates = 0;
 		invalidateStorage();
 		invalidateLight();
 	}
@@ -88,20 +190,44 @@ public:
 		m_dirtyLocations.clear();
 	}
 	
+	[[nodiscard]] const VoxelChunkLocationSet &relightLocations() const {
+		return m_relightLocations;
+	}
+	
+	// Voxels whose light only has to spread again, the light computer of a neighboring region hands them off
+	template<typename Iterator> void markRelight(Iterator begin, Iterator end) {
+		m_relightLocations.insert(begin, end);
+		invalidateLight();
+	}
+	
+	void clearRelightLocations() {
+		m_relightLocations.clear();
+	}
+	
 	void markPending(const InChunkVoxelLocation &location) {
-		m_pendingLocations.emplace(location);
+		m_pendingLocations.insert(location);
+		m_idleUpdates = 0;
+	}
+	
+	// Returns true every COMPACT_IDLE_UPDATES idle updates, so a chunk expanded again gets another chance
+	bool idleUpdate() {
+		if (!m_pendingLocations.empty() || !m_dirtyLocations.empty()) {
+			m_idleUpdates = 0;
+			return false;
+		}
+		return ++m_idleUpdates % COMPACT_IDLE_UPDATES == 0;
 	}
 	
 	void clearPending() {
 		m_pendingLocations.clear();
 	}
 	
-	const std::unordered_set<InChunkVoxelLocation> &pendingLocations() const {
+	const VoxelChunkLocationSet &pendingLocations() const {
 		return m_pendingLocations;
 	}
 	
-	std::unordered_set<InChunkVoxelLocation> takePendingLocations() {
-		return std::move(m_pendingLocations);
+	VoxelChunkLocationSet takePendingLocations() {
+		return std::exchange(m_pendingLocations, VoxelChunkLocationSet());
 	}
 	
 	[[nodiscard]] bool pendingInitialUpdate() const {
@@ -132,9 +258,8 @@ public:
 		return m_unloading;
 	}
 	
-	void setUnloading(bool unloading) {
-		m_unloading = unloading;
-	}
+	// Keeps VoxelWorld::unloadingChunkCount() up to date
+	void setUnloading(bool unloading);
 	
 	[[nodiscard]] const std::unordered_set<Entity*> &entities() const {
 		return m_entities;
@@ -152,11 +277,86 @@ public:
 	
 };
 
+/*
+ * Keeps released chunks around so that streaming chunks in and out doesn't allocate and construct them every time.
+ * Not thread safe, VoxelWorld uses it under its own mutex.
+ */
+class SharedVoxelChunkPool {
+public:
+	static constexpr size_t DEFAULT_CAPACITY = 256;
+	
+	struct Stats {
+		unsigned long hits = 0;
+		unsigned long misses = 0;
+		unsigned long discarded = 0;
+		size_t pooledChunks = 0;
+		size_t residentBytes = 0;
+	};
+	
+private:
+	std::vector<std::unique_ptr<SharedVoxelChunk>> m_chunks;
+	size_t m_capacity;
+	Stats m_stats;
+	
+	static size_t residentSize(const SharedVoxelChunk &chunk);
+	
+public:
+	explicit SharedVoxelChunkPool(size_t capacity = DEFAULT_CAPACITY): m_capacity(capacity) {
+	}
+	std::unique_ptr<SharedVoxelChunk> acquire(VoxelWorld &world, const VoxelChunkLocation &location);
+	void release(std::unique_ptr<SharedVoxelChunk> chunk);
+	void setCapacity(size_t capacity);
+	[[nodiscard]] size_t capacity() const {
+		return m_capacity;
+	}
+	[[nodiscard]] const Stats &stats() const {
+		return m_stats;
+	}
+	
+};
+
+// Immutable copy of a chunk, can be kept and read without holding any lock
+class VoxelChunkSnapshot {
+	std::shared_ptr<const VoxelChunk> m_chunk;
+	unsigned long m_version = 0;
+	
+public:
+	VoxelChunkSnapshot() = default;
+	VoxelChunkSnapshot(std::shared_ptr<const VoxelChunk> chunk, unsigned long version):
+		m_chunk(std::move(chunk)), m_version(version)
+	{
+	}
+	operator bool() const {
+		return m_chunk != nullptr;
+	}
+	[[nodiscard]] const VoxelChunk &operator*() const {
+		return *m_chunk;
+	}
+	[[nodiscard]] const VoxelChunk *operator->() const {
+		return m_chunk.get();
+	}
+	[[nodiscard]] unsigned long version() const {
+		return m_version;
+	}
+	
+	template<typename S> void serialize(S &s) const {
+		s.object(*m_chunk);
+	}
+	
+};
+
 class VoxelChunkRef {
 protected:
+	enum class LockMode {
+		NONE,
+		SHARED,
+		EXCLUSIVE
+	};
+	
 	SharedVoxelChunk *m_chunk;
 	
 	VoxelChunkRef(SharedVoxelChunk &chunk, bool lock);
+	static void lockChunk(SharedVoxelChunk &chunk, LockMode mode);
 	
 public:
 	constexpr VoxelChunkRef(): m_chunk(nullptr) {
@@ -176,14 +376,60 @@ public:
 		return m_chunk->location();
 	}
 	[[nodiscard]] const VoxelHolder &at(int x, int y, int z) const {
-		return m_chunk->at(x, y, z);
+		return std::as_const(*m_chunk).at(x, y, z);
 	}
 	[[nodiscard]] const VoxelHolder &at(const InChunkVoxelLocation &location) const {
-		return m_chunk->at(location);
+		return std::as_const(*m_chunk).at(location);
+	}
+	[[nodiscard]] VoxelLight light(int x, int y, int z) const {
+		return m_chunk->light(x, y, z);
+	}
+	[[nodiscard]] VoxelLight light(const InChunkVoxelLocation &location) const {
+		return m_chunk->light(location);
+	}
+	[[nodiscard]] VoxelLightLevel lightLevel(int x, int y, int z) const {
+		return m_chunk->lightLevel(x, y, z);
+	}
+	[[nodiscard]] VoxelLightLevel lightLevel(const InChunkVoxelLocation &location) const {
+		return m_chunk->lightLevel(location);
+	}
+	[[nodiscard]] bool lightUniform() const {
+		return m_chunk->lightUniform();
+	}
+	[[nodiscard]] const VoxelLight *lights() const {
+		return m_chunk->lights();
+	}
+	[[nodiscard]] const VoxelChunkMask &densityMask() const {
+		return m_chunk->densityMask();
+	}
+	[[nodiscard]] const VoxelChunkMask &opaqueMask() const {
+		return m_chunk->opaqueMask();
+	}
+	[[nodiscard]] const VoxelChunkMask &emptyMask() const {
+		return m_chunk->emptyMask();
+	}
+	[[nodiscard]] bool compacted() const {
+		return m_chunk->compacted();
+	}
+	[[nodiscard]] bool uniform() const {
+		return m_chunk->uniform();
+	}
+	[[nodiscard]] size_t memoryUsage() const {
+		return m_chunk->memoryUsage();
+	}
+	[[nodiscard]] unsigned long version() const {
+		return m_chunk->version();
+	}
+	[[nodiscard]] VoxelChunkSnapshot snapshot() const {
+		auto version = m_chunk->version();
+		return VoxelChunkSnapshot(m_chunk->snapshot(), version);
 	}
 	[[nodiscard]] VoxelChunkLightState lightState() const {
 		return m_chunk->lightState();
 	}
+	[[nodiscard]] int neighborCount() const {
+		return m_chunk->neighborCount();
+	}
 	[[nodiscard]] unsigned long updatedAt() const {
 		return m_chunk->storedAt();
 	}
@@ -208,11 +454,23 @@ public:
 class VoxelChunkExtendedRef: public VoxelChunkRef {
 protected:
 	SharedVoxelChunk *m_neighbors[3 * 3 * 3];
+	int m_neighborCount = 0;
+	const VoxelChunkNeighborhood *m_neighborhood;
 
-	VoxelChunkExtendedRef(SharedVoxelChunk &chunk, bool lock, bool lockNeighbors);
+	VoxelChunkExtendedRef(SharedVoxelChunk &chunk, LockMode mode, LockMode neighborsMode);
+	SharedVoxelChunk *extendedChunk(
+			const InChunkVoxelLocation &location,
+			InChunkVoxelLocation &correctedLocation,
+			VoxelLocation *outLocation
+	) const;
+	[[nodiscard]] bool extendedMaskTest(
+			const InChunkVoxelLocation &location,
+			const VoxelChunkMask &(VoxelChunk::*mask)() const,
+			bool missingValue
+	) const;
 	
 public:
-	constexpr VoxelChunkExtendedRef(): m_neighbors() {
+	constexpr VoxelChunkExtendedRef(): m_neighbors(), m_neighborhood(nullptr) {
 	}
 	explicit VoxelChunkExtendedRef(SharedVoxelChunk &chunk);
 	VoxelChunkExtendedRef(VoxelChunkExtendedRef &&ref) noexcept;
@@ -220,6 +478,12 @@ public:
 	~VoxelChunkExtendedRef();
 	void unlock();
 	[[nodiscard]] bool hasNeighbor(int dx, int dy, int dz) const;
+	// All 26 neighbors are locked, none of them was unloading
+	[[nodiscard]] bool hasAllNeighbors() const {
+		return m_neighborCount == 26;
+	}
+	// Serve extendedAt() and extendedLight() from a snapshot of this chunk while it is attached
+	void attachNeighborhood(const VoxelChunkNeighborhood *neighborhood);
 	const VoxelHolder &extendedAt(
 			int x, int y, int z,
 			VoxelLocation *outLocation = nullptr
@@ -228,12 +492,29 @@ public:
 			const InChunkVoxelLocation &location,
 			VoxelLocation *outLocation = nullptr
 	) const;
+	[[nodiscard]] VoxelLight extendedLight(const InChunkVoxelLocation &location) const;
+	[[nodiscard]] VoxelLightLevel extendedLightLevel(int x, int y, int z) const;
+	[[nodiscard]] VoxelLightLevel extendedLightLevel(const InChunkVoxelLocation &location) const;
+	// Mask lookups, missing neighbors are treated the same way as the empty voxel returned by extendedAt()
+	[[nodiscard]] bool extendedHasDensity(int x, int y, int z) const {
+		return extendedMaskTest({x, y, z}, &VoxelChunk::densityMask, true);
+	}
+	[[nodiscard]] bool extendedOpaque(const InChunkVoxelLocation &location) const {
+		return extendedMaskTest(location, &VoxelChunk::opaqueMask, false);
+	}
+	[[nodiscard]] bool extendedEmpty(const InChunkVoxelLocation &location) const {
+		return extendedMaskTest(location, &VoxelChunk::emptyMask, true);
+	}
 
+	friend class VoxelChunkNeighborhood;
+	
 };
 
 class VoxelChunkMutableRef: public VoxelChunkExtendedRef {
 protected:
-	VoxelChunkMutableRef(SharedVoxelChunk &chunk, bool lockNeighbors);
+	VoxelChunkMutableRef(SharedVoxelChunk &chunk, LockMode neighborsMode);
+	// Marks the location and its 26 neighbors pending
+	void markPendingAround(const InChunkVoxelLocation &location);
 
 public:
 	constexpr VoxelChunkMutableRef() = default;
@@ -244,16 +525,55 @@ public:
 	void unlock();
 	[[nodiscard]] VoxelHolder &at(int x, int y, int z) const;
 	[[nodiscard]] VoxelHolder &at(const InChunkVoxelLocation &location) const;
+	bool compact() const;
+	void setUniform(const VoxelHolder &voxel) const;
+	void fill(
+			const InChunkVoxelLocation &from,
+			const InChunkVoxelLocation &to,
+			const VoxelHolder &voxel,
+			bool markDirty = true
+	);
+	void copyFrom(
+			const InChunkVoxelLocation &from,
+			const InChunkVoxelLocation &to,
+			std::span<const VoxelHolder> voxels,
+			bool markDirty = true
+	);
+	void copyFrom(std::span<const VoxelHolder> voxels, bool markDirty = true);
+	size_t replace(VoxelTypeInterface &from, VoxelTypeInterface &to, bool markDirty = true);
+	void setLight(int x, int y, int z, VoxelLight light) const {
+		m_chunk->setLight(x, y, z, light);
+	}
+	void setLight(const InChunkVoxelLocation &location, VoxelLight light) const {
+		m_chunk->setLight(location, light);
+	}
+	void setUniformLight(VoxelLight light) const {
+		m_chunk->setUniformLight(light);
+	}
 	void setLightState(VoxelChunkLightState state) const {
 		m_chunk->setLightState(state);
 	}
-	const std::unordered_set<InChunkVoxelLocation> &dirtyLocations() const {
+	const VoxelChunkHeightmap &heightmap() const {
+		return m_chunk->heightmap();
+	}
+	const VoxelChunkLocationSet &dirtyLocations() const {
 		return m_chunk->dirtyLocations();
 	}
 	void clearDirtyLocations() {
 		m_chunk->clearDirtyLocations();
 	}
+	const VoxelChunkLocationSet &relightLocations() const {
+		return m_chunk->relightLocations();
+	}
+	void markRelight(const std::vector<InChunkVoxelLocation> &locations) {
+		m_chunk->markRelight(locations.begin(), locations.end());
+	}
+	void clearRelightLocations() {
+		m_chunk->clearRelightLocations();
+	}
 	void markDirty(const InChunkVoxelLocation &location, bool markPending = true);
+	void markDirty(const InChunkVoxelLocation &from, const InChunkVoxelLocation &to, bool markPending = true);
+	void markDirty(const std::vector<InChunkVoxelLocation> &locations, bool markPending = true);
 	void markPending(const InChunkVoxelLocation &location);
 	void extendedMarkPending(const InChunkVoxelLocation &location);
 	void setUpdatedAt(unsigned long time) {
@@ -314,22 +634,156 @@ public:
 	
 };
 
+struct VoxelChunkEvent {
+	// Chunk unlocked while its light had to be computed
+	static constexpr uint8_t LIGHT_PENDING = 1 << 0;
+	// Chunk light computed
+	static constexpr uint8_t LIGHT_READY = 1 << 1;
+	
+	VoxelChunkLocation location;
+	uint8_t types;
+	// Light state at delivery time
+	VoxelChunkLightState lightState;
+	
+};
+
 class VoxelChunkListener {
 public:
 	virtual ~VoxelChunkListener() = default;
-	virtual void chunkUnlocked(const VoxelChunkLocation &chunkLocation, VoxelChunkLightState lightState) = 0;
+	// Called on the world event thread, each chunk appears once per batch with the events coalesced since the last one
+	virtual void chunkEvents(std::span<const VoxelChunkEvent> events) = 0;
 
 };
 
+/*
+ * Completion of VoxelWorld::requestChunk(). It runs on the thread that made the chunk ready, possibly while that thread
+ * holds chunk or shard locks, so it must not access the world.
+ */
+using VoxelChunkRequestCallback = std::function<void(const VoxelChunkLocation &location)>;
+
+/*
+ * Chunks are spread over shards with their own locks, so lookups of existing chunks from different threads don't
+ * contend. A lookup holds the shard of the chunk shared while it locks the chunk and its neighbors. Creating or
+ * erasing a chunk rewires the neighbor links, so it holds the shards of the chunk and all its neighbors exclusively
+ * (see ShardsLock), which keeps neighbors of a chunk being looked up alive. The same operations keep the region index
+ * up to date, so enumeration and box queries don't need to walk every shard.
+ */
 class VoxelWorld {
+public:
+	static constexpr size_t CHUNK_SHARD_COUNT = 64;
+	
+	enum class MissingChunkPolicy {
+		NONE,
+		CREATE,
+		LOAD,
+		LOAD_ASYNC
+	};
+	
+private:
+	struct alignas(64) ChunkShard {
+		std::shared_mutex mutex;
+		std::unordered_map<VoxelChunkLocation, std::unique_ptr<SharedVoxelChunk>> chunks;
+	};
+	
+	class ShardsLock;
+	
+	struct ChunkRequest {
+		const void *owner;
+		VoxelChunkLightState readiness;
+		VoxelChunkRequestCallback callback;
+	};
+	
+	struct ChunkRequests {
+		std::vector<ChunkRequest> requests;
+		// The chunk and its neighbors present in the chunk map, indexed like SharedVoxelChunk neighbors
+		std::bitset<27> loaded;
+		// Light state reported by the latest unlock, older reports are recognized by the chunk version
+		VoxelChunkLightState lightState = VoxelChunkLightState::PENDING_INITIAL;
+		// Generation of the present chunk or zero, reports of other generations are ignored
+		unsigned long generation = 0;
+		unsigned long version = 0;
+	};
+	
+	struct ReadyChunkRequest {
+		VoxelChunkLocation location;
+		ChunkRequest request;
+	};
+	
 	VoxelChunkLoader *m_chunkLoader = nullptr;
 	VoxelChunkListener *m_chunkListener;
 	std::unordered_set<Entity*> m_entities;
-	std::unordered_map<VoxelChunkLocation, std::unique_ptr<SharedVoxelChunk>> m_chunks;
+	std::array<ChunkShard, CHUNK_SHARD_COUNT> m_shards;
+	std::atomic<size_t> m_chunkCount = 0;
+	std::atomic<unsigned long> m_chunkGenerations = 0;
+	std::atomic<size_t> m_unloadingChunkCount = 0;
+	// Locked after the shards, chunks are inserted and erased only while their ShardsLock is held
+	VoxelRegionIndex m_regions;
+	std::shared_mutex m_regionsMutex;
+	// Intrusive list of the chunks having all neighbors loaded, the updater walks it instead of every chunk
+	SharedVoxelChunk *m_completeChunks = nullptr;
+	size_t m_completeChunkCount = 0;
+	std::mutex m_completeChunksMutex;
+	SharedVoxelChunkPool m_chunkPool;
+	// Guards the chunk loader, the entity set and the chunk pool
 	std::mutex m_mutex;
-	
-	template<typename T> T createChunk(const VoxelChunkLocation &location);
-	template<typename T> T createAndLoadChunk(const VoxelChunkLocation &location, std::unique_lock<std::mutex> &lock);
+	std::unordered_map<VoxelChunkLocation, ChunkRequests> m_chunkRequests;
+	std::unordered_set<VoxelChunkLocation> m_requestedLoads;
+	std::vector<const void*> m_runningChunkRequests;
+	std::atomic<size_t> m_chunkRequestCount = 0;
+	// Locked after the shards, chunk creation and erasure update the requests while holding their ShardsLock
+	std::mutex m_chunkRequestsMutex;
+	std::condition_variable m_chunkRequestsCondVar;
+	VoxelChunkEventQueue m_chunkEvents;
+	std::thread m_chunkEventThread;
+	
+	static size_t shardIndex(const VoxelChunkLocation &location);
+	ChunkShard &shard(const VoxelChunkLocation &location) {
+		return m_shards[shardIndex(location)];
+	}
+	// The shard of the location has to be locked
+	SharedVoxelChunk *findChunk(const VoxelChunkLocation &location);
+	void eraseChunk(const VoxelChunkLocation &location);
+	template<typename T> T createChunk(const VoxelChunkLocation &location, bool *created);
+	template<typename T> T createAndLoadChunk(const VoxelChunkLocation &location, bool *created);
+	template<typename T> T lookupChunk(
+			const VoxelChunkLocation &location,
+			MissingChunkPolicy policy,
+			bool *created
+	);
+	static bool lightStateReached(VoxelChunkLightState lightState, VoxelChunkLightState readiness);
+	// m_chunkRequestsMutex has to be locked
+	void takeReadyChunkRequests(
+			std::unordered_map<VoxelChunkLocation, ChunkRequests>::iterator it,
+			std::vector<ReadyChunkRequest> &ready
+	);
+	// The ShardsLock of the location has to be held, the chunk is nullptr when it was erased
+	std::vector<ReadyChunkRequest> chunkPresenceChanged(
+			const VoxelChunkLocation &location,
+			const SharedVoxelChunk *chunk
+	);
+	void chunkLightStateChanged(
+			const VoxelChunkLocation &location,
+			unsigned long generation,
+			VoxelChunkLightState lightState,
+			unsigned long version
+	);
+	void runChunkRequests(std::vector<ReadyChunkRequest> &ready);
+	// The ShardsLock of the chunk has to be held
+	void setChunkComplete(SharedVoxelChunk &chunk, bool complete);
+	void postChunkEvents(SharedVoxelChunk &chunk, uint8_t types);
+	void runChunkEvents();
+	template<typename T> T existingChunk(const VoxelChunkLocation &location) {
+		if constexpr (std::is_same_v<T, VoxelChunkRef>) {
+			return chunk(location);
+		} else if constexpr (std::is_same_v<T, VoxelChunkExtendedRef>) {
+			return extendedChunk(location);
+		} else if constexpr (std::is_same_v<T, VoxelChunkMutableRef>) {
+			return mutableChunk(location);
+		} else {
+			static_assert(std::is_same_v<T, VoxelChunkExtendedMutableRef>);
+			return extendedMutableChunk(location);
+		}
+	}
 	
 	friend class VoxelInvalidationNotifier;
 	friend class SharedVoxelChunk;
@@ -337,17 +791,13 @@ class VoxelWorld {
 	friend class VoxelChunkExtendedMutableRef;
 	
 public:
-	enum class MissingChunkPolicy {
-		NONE,
-		CREATE,
-		LOAD,
-		LOAD_ASYNC
-	};
-	
 	explicit VoxelWorld(VoxelChunkListener *chunkListener = nullptr);
+	~VoxelWorld();
 	VoxelWorld(const VoxelWorld &world) = delete;
 	VoxelWorld &operator=(const VoxelWorld &world) = delete;
 	void setChunkLoader(VoxelChunkLoader *chunkLoader);
+	// Delivers the queued events and stops the event thread, has to be called before the chunk listener is destroyed
+	void shutdownChunkEvents();
 	VoxelChunkRef chunk(
 			const VoxelChunkLocation &location,
 			MissingChunkPolicy policy = MissingChunkPolicy::NONE,
@@ -368,19 +818,125 @@ public:
 			MissingChunkPolicy policy = MissingChunkPolicy::NONE,
 			bool *created = nullptr
 	);
+	// Shared refs of the loaded chunks among the locations, all locked at once in the global location order
+	std::vector<VoxelChunkRef> acquire(std::span<const VoxelChunkLocation> locations);
+	/*
+	 * Visits the loaded chunks among the locations in the global location order, one ref of type T at a time.
+	 * Refs that lock neighbors can overlap, so unlike acquire() they are never held together.
+	 */
+	template<typename T, typename Callable> void forEachChunk(
+			std::span<const VoxelChunkLocation> locations,
+			Callable &&callable
+	) {
+		std::vector<VoxelChunkLocation> sorted(locations.begin(), locations.end());
+		std::sort(sorted.begin(), sorted.end());
+		sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+		for (auto &location : sorted) {
+			auto chunk = existingChunk<T>(location);
+			if (!chunk) continue;
+			callable(chunk);
+		}
+	}
+	template<typename T, typename Callable> void forEachInBox(
+			const VoxelChunkLocation &from,
+			const VoxelChunkLocation &to,
+			Callable &&callable
+	) {
+		for (int z = from.z; z <= to.z; z++) {
+			for (int y = from.y; y <= to.y; y++) {
+				for (int x = from.x; x <= to.x; x++) {
+					auto chunk = existingChunk<T>({x, y, z});
+					if (!chunk) continue;
+					callable(chunk);
+				}
+			}
+		}
+	}
 	void storeChunk(const VoxelChunkLocation &location);
 	void unloadChunks(const std::vector<VoxelChunkLocation> &locations);
 	void unload();
 	size_t chunkCount() const {
-		return m_chunks.size();
-	}
+		return m_chunkCount;
+	}
+	// Chunks being stored before they are erased, included in chunkCount()
+	size_t unloadingChunkCount() const {
+		return m_unloadingChunkCount;
+	}
+	// Appends the chunks that are SharedVoxelChunk::updatable() without visiting the rest
+	void updatableChunkLocations(std::vector<VoxelChunkLocation> &locations);
+	size_t completeChunkCount();
+	/*
+	 * The location enumeration below runs under the region index lock, so the callables must not create or erase
+	 * chunks. Chunks being unloaded are skipped.
+	 */
 	template<typename Callable> void forEachChunkLocation(Callable callable) {
-		std::unique_lock<std::mutex> lock(m_mutex);
-		for (auto &chunk : m_chunks) {
-			if (chunk.second->unloading()) continue;
-			callable(chunk.first);
-		}
-	}
-	void chunkStored(const VoxelChunkLocation &location);
+		std::shared_lock<std::shared_mutex> lock(m_regionsMutex);
+		m_regions.forEach([&callable](const VoxelChunkLocation &location, const SharedVoxelChunk &chunk) {
+			if (chunk.unloading()) return;
+			callable(location);
+		});
+	}
+	template<typename Callable> void forEachChunkLocationInBox(const VoxelChunkBox &box, Callable callable) {
+		std::shared_lock<std::shared_mutex> lock(m_regionsMutex);
+		m_regions.forEachInBox(box, [&callable](const VoxelChunkLocation &location, const SharedVoxelChunk &chunk) {
+			if (chunk.unloading()) return;
+			callable(location);
+		});
+	}
+	template<typename Callable> void forEachChunkLocationInRadius(
+			const VoxelChunkLocation &center,
+			int radius,
+			Callable callable
+	) {
+		forEachChunkLocationInBox(VoxelChunkBox::around(center, radius), [&](const VoxelChunkLocation &location) {
+			int dx = location.x - center.x, dy = location.y - center.y, dz = location.z - center.z;
+			if (dx * dx + dy * dy + dz * dz > radius * radius) return;
+			callable(location);
+		});
+	}
+	// Visits loaded chunks outside all of the boxes, regions that no box touches are taken without per-chunk checks
+	template<typename Callable> void forEachChunkLocationOutside(std::span<const VoxelChunkBox> boxes, Callable callable) {
+		std::shared_lock<std::shared_mutex> lock(m_regionsMutex);
+		std::vector<const VoxelChunkBox*> intersecting;
+		m_regions.forEachRegion([&](const VoxelChunkLocation &regionLocation, const VoxelRegionIndex::Region &region) {
+			auto regionBox = VoxelRegionIndex::regionBox(regionLocation);
+			intersecting.clear();
+			for (auto &box : boxes) {
+				if (box.containsBox(regionBox)) return;
+				if (box.intersects(regionBox)) {
+					intersecting.emplace_back(&box);
+				}
+			}
+			VoxelRegionIndex::forEachInRegion(regionLocation, region, [&](
+					const VoxelChunkLocation &location,
+					const SharedVoxelChunk &chunk
+			) {
+				if (chunk.unloading()) return;
+				for (auto box : intersecting) {
+					if (box->contains(location)) return;
+				}
+				callable(location);
+			});
+		});
+	}
+	/*
+	 * Calls back once the chunk and all its neighbors are loaded and the chunk light reached the readiness state,
+	 * right away if they already are. Missing chunks are loaded asynchronously. Requests for a location are coalesced:
+	 * each missing chunk is loaded once and a repeated request of the same owner replaces the earlier one. The caller
+	 * must not hold chunk refs.
+	 */
+	void requestChunk(
+			const VoxelChunkLocation &location,
+			VoxelChunkLightState readiness,
+			const void *owner,
+			VoxelChunkRequestCallback callback
+	);
+	void cancelChunkRequest(const VoxelChunkLocation &location, const void *owner);
+	// Drops all requests of the owner and waits for its callbacks running on other threads
+	void cancelChunkRequests(const void *owner);
+	// Erases a chunk being unloaded, returns false if it was modified after the stored snapshot had been taken
+	bool chunkStored(const VoxelChunkLocation &location, unsigned long version);
+	void setChunkPoolCapacity(size_t capacity);
+	[[nodiscard]] SharedVoxelChunkPool::Stats chunkPoolStats();
 	
 };
@@ -0,0 +1,149 @@
+#include <chrono>
+#include <thread>
+#include <gtest/gtest.h>
+#include "Asset.h"
+#include "world/VoxelWorld.h"
+#include "server/world/VoxelLightComputer.h"
+
+static bool lightComputed(VoxelWorld &world, const VoxelChunkLocation &location) {
+	auto state = world.chunk(location).lightState();
+	return state == VoxelChunkLightState::READY || state == VoxelChunkLightState::COMPLETE;
+}
+
+static void computeLight(VoxelWorld &world, VoxelLightComputer &computer, const VoxelChunkLocation &location) {
+	computer.computeAsync(world, location);
+	for (int i = 0; i < 500; i++) {
+		if (computer.stats().queued == 0 && lightComputed(world, location)) return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	FAIL() << "Light of chunk x=" << location.x << ",y=" << location.y << ",z=" << location.z << " wasn't computed";
+}
+
+// Runs the jobs of the chunks that still have pending light, returns how many were needed
+static size_t computePendingLight(VoxelWorld &world, VoxelLightComputer &computer) {
+	size_t count = 0;
+	// A job can hand light back to a chunk computed earlier, so the chunks are checked until none is pending
+	for (size_t previousCount = SIZE_MAX; previousCount != count;) {
+		previousCount = count;
+		std::vector<VoxelChunkLocation> pending;
+		world.forEachChunkLocation([&pending](const VoxelChunkLocation &location) {
+			pending.emplace_back(location);
+		});
+		for (auto &location : pending) {
+			if (lightComputed(world, location)) continue;
+			computeLight(world, computer, location);
+			count++;
+		}
+	}
+	return count;
+}
+
+TEST(VoxelLightComputer, regionBorderEdit) {
+	AssetLoader assetLoader(".");
+	SimpleVoxelType airVoxelType("air", assetLoader.load("dummy.png"), false, 0, true, false);
+	SimpleVoxelType emitterVoxelType("emitter", assetLoader.load("dummy.png"), false, MAX_VOXEL_LIGHT_LEVEL - 1, true);
+	
+	// Dark chunks around the border between two regions, every edited chunk has all of its neighbors
+	VoxelWorld world;
+	for (int x = VoxelRegionIndex::REGION_SIZE - 3; x < VoxelRegionIndex::REGION_SIZE + 3; x++) {
+		for (int y = 0; y < 3; y++) {
+			for (int z = 0; z < 3; z++) {
+				auto chunk = world.mutableChunk({x, y, z}, VoxelWorld::MissingChunkPolicy::CREATE);
+				chunk.setUniform(VoxelHolder(airVoxelType));
+				chunk.setUniformLight(VoxelLight());
+				chunk.setLightState(VoxelChunkLightState::READY);
+			}
+		}
+	}
+	VoxelChunkLocation edited(VoxelRegionIndex::REGION_SIZE - 1, 1, 1), neighbor(VoxelRegionIndex::REGION_SIZE, 1, 1);
+	InChunkVoxelLocation location(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE / 2, VOXEL_CHUNK_SIZE / 2);
+	InChunkVoxelLocation neighborLocation(0, VOXEL_CHUNK_SIZE / 2, VOXEL_CHUNK_SIZE / 2);
+	// Only the chunks of the region the light reaches are touched, not the whole region
+	VoxelLocation source(edited, location);
+	int reach = MAX_VOXEL_LIGHT_LEVEL - 2;
+	auto from = VoxelLocation(source.x - reach, source.y - reach, source.z - reach).chunk();
+	auto to = VoxelLocation(source.x, source.y + reach, source.z + reach).chunk();
+	size_t maxTouchedChunks = (to.x - from.x + 1) * (to.y - from.y + 1) * (to.z - from.z + 1);
+	
+	VoxelLightComputer computer(1);
+	{
+		auto chunk = world.mutableChunk(edited);
+		chunk.at(location).setType(emitterVoxelType);
+		chunk.markDirty(location);
+	}
+	computeLight(world, computer, edited);
+	auto stats = computer.stats();
+	ASSERT_EQ(stats.jobs, 1);
+	ASSERT_LE(stats.maxTouchedChunks, maxTouchedChunks);
+	ASSERT_LT(stats.iterations, stats.touchedChunks * VOXEL_CHUNK_VOLUME);
+	ASSERT_EQ(world.chunk(neighbor).lightState(), VoxelChunkLightState::PENDING_INCREMENTAL);
+	ASSERT_GE(stats.handedOffChunks, 1);
+	// Pending chunks may hand light back, every chunk computed afterwards still needs a hand-off
+	ASSERT_LE(computePendingLight(world, computer), computer.stats().handedOffChunks);
+	ASSERT_EQ(world.chunk(edited).light(location).block(), MAX_VOXEL_LIGHT_LEVEL - 1);
+	ASSERT_EQ(world.chunk(neighbor).light(neighborLocation).block(), MAX_VOXEL_LIGHT_LEVEL - 2);
+	ASSERT_EQ(world.chunk(neighbor).light(neighborLocation).sky(), 0);
+	
+	// Removing the emitter clears its light on both sides of the border
+	stats = computer.stats();
+	{
+		auto chunk = world.mutableChunk(edited);
+		chunk.at(location).setType(airVoxelType);
+		chunk.markDirty(location);
+	}
+	computeLight(world, computer, edited);
+	ASSERT_EQ(world.chunk(neighbor).lightState(), VoxelChunkLightState::PENDING_INCREMENTAL);
+	auto pendingChunks = computePendingLight(world, computer);
+	auto removalStats = computer.stats();
+	ASSERT_LE(pendingChunks, removalStats.handedOffChunks - stats.handedOffChunks);
+	ASSERT_EQ(removalStats.jobs, stats.jobs + 1 + pendingChunks);
+	ASSERT_LE(removalStats.maxTouchedChunks, maxTouchedChunks);
+	ASSERT_LT(
+			removalStats.iterations - stats.iterations,
+			(removalStats.touchedChunks - stats.touchedChunks) * VOXEL_CHUNK_VOLUME
+	);
+	ASSERT_EQ(world.chunk(edited).light(location), VoxelLight());
+	ASSERT_EQ(world.chunk(neighbor).light(neighborLocation), VoxelLight());
+	ASSERT_TRUE(lightComputed(world, {VoxelRegionIndex::REGION_SIZE + 1, 1, 1}));
+	computer.shutdown();
+}
+
+TEST(VoxelLightComputer, jobEquality) {
+	VoxelWorld world, otherWorld;
+	VoxelLightComputerJob job{&world, {1, 2, 3}};
+	ASSERT_EQ(job, (VoxelLightComputerJob{&world, {1, 2, 3}}));
+	// Jobs of another chunk or another world must not be cancelled or deduplicated instead of this one
+	ASSERT_FALSE(job == (VoxelLightComputerJob{&world, {1, 2, 4}}));
+	ASSERT_FALSE(job == (VoxelLightComputerJob{&otherWorld, {1, 2, 3}}));
+}
+
+TEST(VoxelLightComputer, jobQueue) {
+	VoxelWorld world, otherWorld;
+	VoxelLightJobQueue queue;
+	ASSERT_TRUE(queue.empty());
+	ASSERT_TRUE(queue.push({&world, {10, 0, 0}}));
+	ASSERT_TRUE(queue.push({&world, {1, 0, 0}}));
+	ASSERT_TRUE(queue.push({&world, {0, 1, 0}}));
+	ASSERT_TRUE(queue.push({&otherWorld, {10, 0, 0}}));
+	ASSERT_FALSE(queue.push({&world, {10, 0, 0}}));
+	ASSERT_EQ(queue.size(), 4);
+	
+	// Without interests the jobs run in posting order
+	ASSERT_EQ(queue.pop(), (VoxelLightComputerJob{&world, {10, 0, 0}}));
+	ASSERT_TRUE(queue.push({&world, {10, 0, 0}}));
+	
+	// The nearest chunk goes first, older jobs win between equally distant chunks
+	queue.setInterests({{10, 0, 0}, {-5, 0, 0}});
+	ASSERT_TRUE(queue.erase({&otherWorld, {10, 0, 0}}));
+	ASSERT_FALSE(queue.erase({&otherWorld, {10, 0, 0}}));
+	ASSERT_EQ(queue.pop(), (VoxelLightComputerJob{&world, {10, 0, 0}}));
+	queue.setInterests({{0, 0, 0}});
+	ASSERT_EQ(queue.pop(), (VoxelLightComputerJob{&world, {1, 0, 0}}));
+	ASSERT_EQ(queue.pop(), (VoxelLightComputerJob{&world, {0, 1, 0}}));
+	ASSERT_TRUE(queue.empty());
+	
+	// A job pushed after the interests changed gets its priority right away
+	ASSERT_TRUE(queue.push({&world, {5, 0, 0}}));
+	ASSERT_TRUE(queue.push({&world, {2, 0, 0}}));
+	ASSERT_EQ(queue.pop(), (VoxelLightComputerJob{&world, {2, 0, 0}}));
+}
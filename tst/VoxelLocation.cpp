@@ -1,24 +1,26 @@
 #include <gtest/gtest.h>
 #include "world/VoxelLocation.h"
 
+static const int S = VOXEL_CHUNK_SIZE;
+
 TEST(VoxelLocation, chunkLocation) {
 	EXPECT_EQ(VoxelLocation(0, 0, 0).chunk(), VoxelChunkLocation(0, 0, 0));
-	EXPECT_EQ(VoxelLocation(15, 15, 15).chunk(), VoxelChunkLocation(0, 0, 0));
-	EXPECT_EQ(VoxelLocation(16, 16, 16).chunk(), VoxelChunkLocation(1, 1, 1));
+	EXPECT_EQ(VoxelLocation(S - 1, S - 1, S - 1).chunk(), VoxelChunkLocation(0, 0, 0));
+	EXPECT_EQ(VoxelLocation(S, S, S).chunk(), VoxelChunkLocation(1, 1, 1));
 	
 	EXPECT_EQ(VoxelLocation(-1, -1, -1).chunk(), VoxelChunkLocation(-1, -1, -1));
-	EXPECT_EQ(VoxelLocation(-16, -16, -16).chunk(), VoxelChunkLocation(-1, -1, -1));
-	EXPECT_EQ(VoxelLocation(-17, -17, -17).chunk(), VoxelChunkLocation(-2, -2, -2));
+	EXPECT_EQ(VoxelLocation(-S, -S, -S).chunk(), VoxelChunkLocation(-1, -1, -1));
+	EXPECT_EQ(VoxelLocation(-S - 1, -S - 1, -S - 1).chunk(), VoxelChunkLocation(-2, -2, -2));
 }
 
 TEST(VoxelLocation, inChunkLocation) {
 	EXPECT_EQ(VoxelLocation(0, 0, 0).inChunk(), InChunkVoxelLocation(0, 0, 0));
-	EXPECT_EQ(VoxelLocation(15, 15, 15).inChunk(), InChunkVoxelLocation(15, 15, 15));
-	EXPECT_EQ(VoxelLocation(16, 16, 16).inChunk(), InChunkVoxelLocation(0, 0, 0));
+	EXPECT_EQ(VoxelLocation(S - 1, S - 1, S - 1).inChunk(), InChunkVoxelLocation(S - 1, S - 1, S - 1));
+	EXPECT_EQ(VoxelLocation(S, S, S).inChunk(), InChunkVoxelLocation(0, 0, 0));
 	
-	EXPECT_EQ(VoxelLocation(-1, -1, -1).inChunk(), InChunkVoxelLocation(15, 15, 15));
-	EXPECT_EQ(VoxelLocation(-16, -16, -16).inChunk(), InChunkVoxelLocation(0, 0, 0));
-	EXPECT_EQ(VoxelLocation(-17, -17, -17).inChunk(), InChunkVoxelLocation(15, 15, 15));
+	EXPECT_EQ(VoxelLocation(-1, -1, -1).inChunk(), InChunkVoxelLocation(S - 1, S - 1, S - 1));
+	EXPECT_EQ(VoxelLocation(-S, -S, -S).inChunk(), InChunkVoxelLocation(0, 0, 0));
+	EXPECT_EQ(VoxelLocation(-S - 1, -S - 1, -S - 1).inChunk(), InChunkVoxelLocation(S - 1, S - 1, S - 1));
 }
 
 TEST(VoxelLocation, location) {
@@ -27,24 +29,24 @@ TEST(VoxelLocation, location) {
 			VoxelLocation(0, 0, 0)
 	);
 	EXPECT_EQ(
-			VoxelLocation(VoxelChunkLocation(0, 0, 0), InChunkVoxelLocation(15, 15, 15)),
-			VoxelLocation(15, 15, 15)
+			VoxelLocation(VoxelChunkLocation(0, 0, 0), InChunkVoxelLocation(S - 1, S - 1, S - 1)),
+			VoxelLocation(S - 1, S - 1, S - 1)
 	);
 	EXPECT_EQ(
 			VoxelLocation(VoxelChunkLocation(1, 1, 1), InChunkVoxelLocation(0, 0, 0)),
-			VoxelLocation(16, 16, 16)
+			VoxelLocation(S, S, S)
 	);
 	
 	EXPECT_EQ(
-			VoxelLocation(VoxelChunkLocation(-1, -1, -1), InChunkVoxelLocation(15, 15, 15)),
+			VoxelLocation(VoxelChunkLocation(-1, -1, -1), InChunkVoxelLocation(S - 1, S - 1, S - 1)),
 			VoxelLocation(-1, -1, -1)
 	);
 	EXPECT_EQ(
 			VoxelLocation(VoxelChunkLocation(-1, -1, -1), InChunkVoxelLocation(0, 0, 0)),
-			VoxelLocation(-16, -16, -16)
+			VoxelLocation(-S, -S, -S)
 	);
 	EXPECT_EQ(
-			VoxelLocation(VoxelChunkLocation(-2, -2, -2), InChunkVoxelLocation(15, 15, 15)),
-			VoxelLocation(-17, -17, -17)
+			VoxelLocation(VoxelChunkLocation(-2, -2, -2), InChunkVoxelLocation(S - 1, S - 1, S - 1)),
+			VoxelLocation(-S - 1, -S - 1, -S - 1)
 	);
 }
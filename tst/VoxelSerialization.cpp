@@ -4,6 +4,11 @@
 #include "world/VoxelTypeRegistry.h"
 #include "world/VoxelWorld.h"
 
+// Voxel set by the chunk tests, (7, 11, 13) in a chunk of 16, its neighbors are in range for every chunk size
+static const int TEST_X = VOXEL_CHUNK_SIZE / 2 - 1;
+static const int TEST_Y = VOXEL_CHUNK_SIZE * 3 / 4 - 1;
+static const int TEST_Z = VOXEL_CHUNK_SIZE - 3;
+
 struct MyVoxel {
 	int a = 10;
 	int b = 20;
@@ -224,8 +229,8 @@ TEST(VoxelSerialization, chunk) {
 	
 	{
 		VoxelChunk chunk({0, 0, 0});
-		chunk.at(7, 11, 13).setType(typeRegistry.get("test"));
-		chunk.at(7, 11, 13).get<MyVoxelType::State>().a = 100;
+		chunk.at(TEST_X, TEST_Y, TEST_Z).setType(typeRegistry.get("test"));
+		chunk.at(TEST_X, TEST_Y, TEST_Z).get<MyVoxelType::State>().a = 100;
 		
 		VoxelSerializer serializer(typeSerializationContext, buffer);
 		serializer.object(chunk);
@@ -241,15 +246,128 @@ TEST(VoxelSerialization, chunk) {
 		deserializer.object(chunk);
 		EXPECT_EQ(deserializer.adapter().currentReadPos(), buffer.size());
 		
-		EXPECT_EQ(chunk.at(6, 11, 13).toString(), "empty");
-		EXPECT_EQ(chunk.at(7, 10, 13).toString(), "empty");
-		EXPECT_EQ(chunk.at(7, 11, 12).toString(), "empty");
-		EXPECT_EQ(chunk.at(8, 11, 13).toString(), "empty");
-		EXPECT_EQ(chunk.at(7, 12, 13).toString(), "empty");
-		EXPECT_EQ(chunk.at(7, 11, 14).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X - 1, TEST_Y, TEST_Z).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y - 1, TEST_Z).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z - 1).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X + 1, TEST_Y, TEST_Z).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y + 1, TEST_Z).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z + 1).toString(), "empty");
+		
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z).toString(), "test");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z).get<MyVoxelType::State>().a, 100);
+	}
+}
+
+TEST(VoxelSerialization, compactedChunk) {
+	AssetLoader assetLoader(".");
+	VoxelTypeRegistry typeRegistry(assetLoader);
+	typeRegistry.add("test", std::make_unique<MyVoxelType>(assetLoader));
+	VoxelTypeSerializationContext typeSerializationContext(typeRegistry);
+	
+	std::string expandedBuffer, compactedBuffer;
+	
+	{
+		VoxelChunk chunk({0, 0, 0});
+		chunk.at(TEST_X, TEST_Y, TEST_Z).setType(typeRegistry.get("test"));
+		chunk.at(TEST_X, TEST_Y, TEST_Z).get<MyVoxelType::State>().a = 100;
+		chunk.setLight(2, 3, 1, VoxelLight(3, 5));
+		
+		VoxelSerializer serializer(typeSerializationContext, expandedBuffer);
+		serializer.object(chunk);
+		expandedBuffer.resize(serializer.adapter().currentWritePos());
 		
-		EXPECT_EQ(chunk.at(7, 11, 13).toString(), "test");
-		EXPECT_EQ(chunk.at(7, 11, 13).get<MyVoxelType::State>().a, 100);
+		ASSERT_TRUE(chunk.compact());
+		VoxelSerializer compactedSerializer(typeSerializationContext, compactedBuffer);
+		compactedSerializer.object(chunk);
+		compactedBuffer.resize(compactedSerializer.adapter().currentWritePos());
+	}
+	
+	EXPECT_EQ(expandedBuffer, compactedBuffer);
+	
+	{
+		VoxelChunk chunk({0, 0, 0});
+		ASSERT_TRUE(chunk.compact());
+		
+		VoxelDeserializer deserializer(typeSerializationContext, compactedBuffer.cbegin(), compactedBuffer.cend());
+		deserializer.object(chunk);
+		EXPECT_EQ(deserializer.adapter().currentReadPos(), compactedBuffer.size());
+		
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z).toString(), "test");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z).get<MyVoxelType::State>().a, 100);
+		EXPECT_EQ(chunk.light(2, 3, 1), VoxelLight(3, 5));
+		EXPECT_EQ(chunk.at(2, 3, 2).toString(), "empty");
+	}
+	
+	std::string statefulBuffer;
+	
+	{
+		VoxelChunk chunk({0, 0, 0});
+		for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
+			for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
+				for (int y = 0; y < VOXEL_CHUNK_SIZE / 4; y++) {
+					chunk.at(x, y, z).setType(typeRegistry.get("test"));
+					chunk.at(x, y, z).get<MyVoxelType::State>().a = x + y + z;
+				}
+			}
+		}
+		
+		VoxelSerializer serializer(typeSerializationContext, statefulBuffer);
+		serializer.object(chunk);
+		statefulBuffer.resize(serializer.adapter().currentWritePos());
+	}
+	
+	{
+		VoxelChunk chunk({0, 0, 0});
+		
+		VoxelDeserializer deserializer(typeSerializationContext, statefulBuffer.cbegin(), statefulBuffer.cend());
+		deserializer.object(chunk);
+		EXPECT_EQ(deserializer.adapter().currentReadPos(), statefulBuffer.size());
+		EXPECT_FALSE(chunk.compacted());
+		
+		EXPECT_EQ(chunk.at(0, 0, 0).get<MyVoxelType::State>().a, 0);
+		EXPECT_EQ(
+				chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE / 4 - 1, VOXEL_CHUNK_SIZE - 1).get<MyVoxelType::State>().a,
+				(VOXEL_CHUNK_SIZE - 1) * 2 + VOXEL_CHUNK_SIZE / 4 - 1
+		);
+		EXPECT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE / 4, VOXEL_CHUNK_SIZE - 1).toString(), "empty");
+	}
+}
+
+TEST(VoxelSerialization, uniformChunk) {
+	AssetLoader assetLoader(".");
+	VoxelTypeRegistry typeRegistry(assetLoader);
+	VoxelTypeSerializationContext typeSerializationContext(typeRegistry);
+	
+	std::string uniformBuffer, expandedBuffer;
+	
+	{
+		VoxelChunk chunk({0, 0, 0});
+		ASSERT_TRUE(chunk.uniform());
+		VoxelSerializer serializer(typeSerializationContext, uniformBuffer);
+		serializer.object(chunk);
+		uniformBuffer.resize(serializer.adapter().currentWritePos());
+		
+		chunk.expand();
+		ASSERT_FALSE(chunk.uniform());
+		VoxelSerializer expandedSerializer(typeSerializationContext, expandedBuffer);
+		expandedSerializer.object(chunk);
+		expandedBuffer.resize(expandedSerializer.adapter().currentWritePos());
+	}
+	
+	EXPECT_EQ(uniformBuffer, expandedBuffer);
+	
+	{
+		VoxelChunk chunk({0, 0, 0});
+		chunk.at(1, 2, 3).setType(typeRegistry.get("test1"));
+		chunk.setLight(1, 2, 3, VoxelLight(0, 5));
+		ASSERT_FALSE(chunk.uniform());
+		
+		VoxelDeserializer deserializer(typeSerializationContext, uniformBuffer.cbegin(), uniformBuffer.cend());
+		deserializer.object(chunk);
+		EXPECT_EQ(deserializer.adapter().currentReadPos(), uniformBuffer.size());
+		EXPECT_TRUE(chunk.uniform());
+		EXPECT_TRUE(chunk.lightUniform());
+		EXPECT_EQ(chunk.light(1, 2, 3), VoxelLight::fullSky());
 	}
 }
 
@@ -266,8 +384,8 @@ TEST(VoxelSerialization, world) {
 		
 		{
 			auto chunk = world.mutableChunk({0, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
-			chunk.at(7, 11, 13).setType(typeRegistry.get("test"));
-			chunk.at(7, 11, 13).get<MyVoxelType::State>().a = 100;
+			chunk.at(TEST_X, TEST_Y, TEST_Z).setType(typeRegistry.get("test"));
+			chunk.at(TEST_X, TEST_Y, TEST_Z).get<MyVoxelType::State>().a = 100;
 		}
 		
 		{
@@ -288,14 +406,14 @@ TEST(VoxelSerialization, world) {
 		deserializer.object(chunk);
 		EXPECT_EQ(deserializer.adapter().currentReadPos(), buffer.size());
 		
-		EXPECT_EQ(chunk.at(6, 11, 13).toString(), "empty");
-		EXPECT_EQ(chunk.at(7, 10, 13).toString(), "empty");
-		EXPECT_EQ(chunk.at(7, 11, 12).toString(), "empty");
-		EXPECT_EQ(chunk.at(8, 11, 13).toString(), "empty");
-		EXPECT_EQ(chunk.at(7, 12, 13).toString(), "empty");
-		EXPECT_EQ(chunk.at(7, 11, 14).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X - 1, TEST_Y, TEST_Z).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y - 1, TEST_Z).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z - 1).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X + 1, TEST_Y, TEST_Z).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y + 1, TEST_Z).toString(), "empty");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z + 1).toString(), "empty");
 		
-		EXPECT_EQ(chunk.at(7, 11, 13).toString(), "test");
-		EXPECT_EQ(chunk.at(7, 11, 13).get<MyVoxelType::State>().a, 100);
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z).toString(), "test");
+		EXPECT_EQ(chunk.at(TEST_X, TEST_Y, TEST_Z).get<MyVoxelType::State>().a, 100);
 	}
 }
@@ -1,7 +1,16 @@
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include "Asset.h"
 #include "world/VoxelWorld.h"
+#include "world/VoxelChunkNeighborhood.h"
+#include "world/VoxelChunkResidency.h"
+#include "world/VoxelTypeRegistry.h"
 
 struct Observer {
 	MOCK_METHOD0(invoke, void());
@@ -83,6 +92,14 @@ public:
 	
 };
 
+class StatelessVoxelType: public VoxelType<StatelessVoxelType> {
+public:
+	std::string toString(const State &voxel) {
+		return "stateless";
+	}
+	
+};
+
 TEST(VoxelWorld, voxelType) {
 	Observer destructorObserver;
 	TestVoxelType testVoxelType;
@@ -182,20 +199,348 @@ TEST(VoxelWorld, rawChunk) {
 	
 	{
 		VoxelChunk chunk({0, 0, 0});
-		ASSERT_EQ(chunk.at(14, 14, 14).toString(), "empty");
-		ASSERT_EQ(chunk.at(15, 14, 14).toString(), "empty");
-		ASSERT_EQ(chunk.at(14, 15, 14).toString(), "empty");
-		ASSERT_EQ(chunk.at(14, 14, 15).toString(), "empty");
-		ASSERT_EQ(chunk.at(15, 15, 15).toString(), "empty");
-		chunk.at(15, 15, 15).setType(testVoxelType);
-		ASSERT_EQ(chunk.at(14, 14, 14).toString(), "empty");
-		ASSERT_EQ(chunk.at(15, 14, 14).toString(), "empty");
-		ASSERT_EQ(chunk.at(14, 15, 14).toString(), "empty");
-		ASSERT_EQ(chunk.at(14, 14, 15).toString(), "empty");
-		ASSERT_EQ(chunk.at(15, 15, 15).toString(), "test");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2).toString(), "empty");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2).toString(), "empty");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 2).toString(), "empty");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 1).toString(), "empty");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1).toString(), "empty");
+		chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1).setType(testVoxelType);
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2).toString(), "empty");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2).toString(), "empty");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 2).toString(), "empty");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 2, VOXEL_CHUNK_SIZE - 1).toString(), "empty");
+		ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1).toString(), "test");
 	}
 }
 
+TEST(VoxelWorld, compactChunk) {
+	TestVoxelType testVoxelType;
+	StatelessVoxelType statelessVoxelType;
+	ASSERT_TRUE(testVoxelType.invokeHasState());
+	ASSERT_FALSE(statelessVoxelType.invokeHasState());
+	ASSERT_FALSE(statelessVoxelType.invokeHasUpdate());
+	ASSERT_FALSE(statelessVoxelType.invokeHasSlowUpdate());
+	
+	VoxelChunk chunk({0, 0, 0});
+	for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
+		chunk.at(3, y, 2).setType(statelessVoxelType);
+		chunk.setLight(3, y, 2, VoxelLight(y % 4, y % (VoxelLight::MAX_LEVEL + 1)));
+	}
+	chunk.at(1, 2, 3).setType(testVoxelType);
+	chunk.at(1, 2, 3).get<TestVoxelType::State>().a = 42;
+	ASSERT_FALSE(chunk.compacted());
+	auto expandedMemoryUsage = chunk.memoryUsage();
+	ASSERT_TRUE(chunk.compact());
+	ASSERT_TRUE(chunk.compacted());
+	ASSERT_LT(chunk.memoryUsage() - sizeof(VoxelChunk), (expandedMemoryUsage - sizeof(VoxelChunk)) / 8);
+	
+	const auto &constChunk = chunk;
+	ASSERT_EQ(constChunk.at(0, 0, 0).toString(), "empty");
+	ASSERT_EQ(chunk.lightLevel(0, 0, 0), MAX_VOXEL_LIGHT_LEVEL);
+	for (int y = 0; y < VOXEL_CHUNK_SIZE; y++) {
+		ASSERT_EQ(constChunk.at(3, y, 2).toString(), "stateless");
+		ASSERT_EQ(chunk.light(3, y, 2), VoxelLight(y % 4, y % (VoxelLight::MAX_LEVEL + 1)));
+	}
+	ASSERT_EQ(constChunk.at(1, 2, 3).toString(), "test");
+	ASSERT_EQ(constChunk.at(1, 2, 3).get<TestVoxelType::State>().a, 42);
+	ASSERT_TRUE(chunk.compacted());
+	
+	chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1).setType(statelessVoxelType);
+	ASSERT_FALSE(chunk.compacted());
+	ASSERT_EQ(chunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1).toString(), "stateless");
+	ASSERT_EQ(chunk.light(3, 3, 2), VoxelLight(3, 3));
+	ASSERT_EQ(chunk.at(1, 2, 3).get<TestVoxelType::State>().a, 42);
+	
+	for (int x = 0; x < VOXEL_CHUNK_SIZE; x++) {
+		for (int z = 0; z < VOXEL_CHUNK_SIZE; z++) {
+			for (int y = 0; y < VOXEL_CHUNK_SIZE / 4; y++) {
+				chunk.at(x, y, z).setType(testVoxelType);
+			}
+		}
+	}
+	ASSERT_FALSE(chunk.compact());
+	ASSERT_FALSE(chunk.compacted());
+	ASSERT_EQ(chunk.light(3, 3, 2), VoxelLight(3, 3));
+}
+
+TEST(VoxelWorld, uniformChunk) {
+	TestVoxelType testVoxelType;
+	StatelessVoxelType statelessVoxelType;
+	
+	VoxelChunk chunk({0, 0, 0});
+	const auto &constChunk = chunk;
+	ASSERT_TRUE(chunk.uniform());
+	ASSERT_EQ(constChunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1).toString(), "empty");
+	ASSERT_TRUE(chunk.uniform());
+	
+	chunk.setUniform(VoxelHolder(statelessVoxelType));
+	ASSERT_TRUE(chunk.uniform());
+	ASSERT_EQ(constChunk.at(1, 2, 3).toString(), "stateless");
+	
+	chunk.at(1, 2, 3).setType(testVoxelType);
+	ASSERT_FALSE(chunk.uniform());
+	ASSERT_FALSE(chunk.compacted());
+	ASSERT_EQ(constChunk.at(1, 2, 3).toString(), "test");
+	ASSERT_EQ(constChunk.at(1, 2, 2).toString(), "stateless");
+	
+	chunk.setUniform(chunk.at(1, 2, 2));
+	ASSERT_TRUE(chunk.uniform());
+	ASSERT_EQ(constChunk.at(1, 2, 3).toString(), "stateless");
+	
+	chunk.setUniform(VoxelHolder(testVoxelType));
+	ASSERT_FALSE(chunk.compacted());
+	ASSERT_EQ(constChunk.at(0, 0, 0).toString(), "test");
+	ASSERT_EQ(constChunk.at(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1).toString(), "test");
+}
+
+TEST(VoxelWorld, light) {
+	StatelessVoxelType statelessVoxelType;
+	
+	VoxelLight light(9, 4);
+	ASSERT_EQ(light.sky(), 9);
+	ASSERT_EQ(light.block(), 4);
+	ASSERT_EQ(light.level(), 10);
+	ASSERT_EQ(VoxelLight(0, 4).level(), 4);
+	ASSERT_EQ(VoxelLight(2, VoxelLight::MAX_LEVEL).level(), VoxelLight::MAX_LEVEL);
+	ASSERT_EQ(VoxelLight::fullSky().level(), MAX_VOXEL_LIGHT_LEVEL);
+	ASSERT_EQ(VoxelLight().level(), 0);
+	
+	VoxelChunk chunk({0, 0, 0});
+	ASSERT_TRUE(chunk.lightUniform());
+	ASSERT_EQ(chunk.lights(), nullptr);
+	ASSERT_EQ(chunk.light(1, 2, 3), VoxelLight::fullSky());
+	
+	chunk.setUniformLight(VoxelLight());
+	chunk.setLight(1, 2, 3, VoxelLight());
+	ASSERT_TRUE(chunk.lightUniform());
+	ASSERT_EQ(chunk.lightLevel(VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1), 0);
+	
+	chunk.setLight(1, 2, 3, light);
+	ASSERT_FALSE(chunk.lightUniform());
+	ASSERT_EQ(chunk.light(1, 2, 3), light);
+	ASSERT_EQ(chunk.lights()[VoxelChunk::voxelIndex(1, 2, 3)], light);
+	ASSERT_EQ(chunk.light(1, 2, 2), VoxelLight());
+	
+	chunk.at(1, 2, 3).setType(statelessVoxelType);
+	ASSERT_EQ(chunk.light(1, 2, 3), light);
+	ASSERT_TRUE(chunk.compact());
+	ASSERT_FALSE(chunk.lightUniform());
+	ASSERT_EQ(chunk.light(1, 2, 3), light);
+	
+	chunk.setLight(1, 2, 3, VoxelLight());
+	ASSERT_TRUE(chunk.compact());
+	ASSERT_TRUE(chunk.lightUniform());
+	ASSERT_EQ(chunk.light(1, 2, 3), VoxelLight());
+}
+
+TEST(VoxelWorld, bulkOperations) {
+	TestVoxelType testVoxelType;
+	StatelessVoxelType statelessVoxelType;
+	ASSERT_TRUE(statelessVoxelType.invokeHasTrivialData());
+	ASSERT_FALSE(testVoxelType.invokeHasTrivialData());
+	
+	VoxelChunk chunk({0, 0, 0});
+	const auto &constChunk = chunk;
+	chunk.fill({1, 1, 0}, {2, 3, 1}, VoxelHolder(statelessVoxelType));
+	ASSERT_TRUE(chunk.compacted());
+	ASSERT_EQ(constChunk.at(1, 1, 1).toString(), "stateless");
+	ASSERT_EQ(constChunk.at(2, 3, 1).toString(), "stateless");
+	ASSERT_EQ(constChunk.at(0, 1, 1).toString(), "empty");
+	ASSERT_EQ(constChunk.at(2, 3, 2).toString(), "empty");
+	
+	chunk.fill({2, 2, 2}, {2, 2, 2}, VoxelHolder(testVoxelType));
+	ASSERT_EQ(constChunk.at(2, 2, 2).toString(), "test");
+	ASSERT_FALSE(chunk.compacted());
+	ASSERT_TRUE(chunk.compact());
+	chunk.fill({0, 0, 0}, {VOXEL_CHUNK_SIZE - 1, 2, VOXEL_CHUNK_SIZE - 1}, VoxelHolder(statelessVoxelType));
+	ASSERT_TRUE(chunk.compacted());
+	ASSERT_EQ(constChunk.at(2, 2, 2).toString(), "stateless");
+	ASSERT_EQ(constChunk.at(2, 3, 1).toString(), "stateless");
+	ASSERT_EQ(constChunk.at(0, 3, 0).toString(), "empty");
+	
+	std::vector<InChunkVoxelLocation> locations;
+	auto replaced = VOXEL_CHUNK_SIZE * 3 * VOXEL_CHUNK_SIZE + 2 * 1 * 2;
+	ASSERT_EQ(chunk.replace(statelessVoxelType, EmptyVoxelType::INSTANCE, &locations), replaced);
+	ASSERT_EQ(locations.size(), replaced);
+	ASSERT_EQ(constChunk.at(2, 3, 1).toString(), "empty");
+	ASSERT_TRUE(chunk.uniform());
+	
+	// Replacing with a type already in the palette merges the entries and keeps stateful voxels
+	chunk.fill({0, 0, 0}, {2, 0, 0}, VoxelHolder(statelessVoxelType));
+	chunk.at(3, 0, 0).setType(testVoxelType);
+	chunk.at(3, 0, 0).get<TestVoxelType::State>().a = 7;
+	ASSERT_TRUE(chunk.compact());
+	locations.clear();
+	ASSERT_EQ(chunk.replace(statelessVoxelType, EmptyVoxelType::INSTANCE, &locations), 3);
+	ASSERT_EQ(locations.size(), 3);
+	ASSERT_TRUE(chunk.compacted());
+	ASSERT_FALSE(chunk.uniform());
+	ASSERT_EQ(constChunk.at(2, 0, 0).toString(), "empty");
+	ASSERT_EQ(constChunk.at(3, 0, 0).get<TestVoxelType::State>().a, 7);
+	ASSERT_EQ(chunk.replace(statelessVoxelType, EmptyVoxelType::INSTANCE), 0);
+	
+	chunk.fill(
+			{0, 0, 0},
+			{VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1},
+			VoxelHolder(statelessVoxelType)
+	);
+	ASSERT_TRUE(chunk.uniform());
+	chunk.at(0, 0, 0).setType(testVoxelType);
+	ASSERT_FALSE(chunk.compacted());
+	chunk.fill({0, 0, 0}, {1, 0, 0}, VoxelHolder(EmptyVoxelType::INSTANCE));
+	ASSERT_EQ(constChunk.at(0, 0, 0).toString(), "empty");
+	ASSERT_EQ(constChunk.at(1, 0, 0).toString(), "empty");
+	ASSERT_EQ(constChunk.at(2, 0, 0).toString(), "stateless");
+	
+	std::vector<VoxelHolder> voxels(2);
+	voxels[1].setType(testVoxelType);
+	voxels[1].get<TestVoxelType::State>().a = 42;
+	chunk.copyFrom({2, 3, 3}, {3, 3, 3}, voxels);
+	ASSERT_EQ(constChunk.at(2, 3, 3).toString(), "empty");
+	ASSERT_EQ(constChunk.at(3, 3, 3).get<TestVoxelType::State>().a, 42);
+	
+	std::vector<VoxelHolder> allVoxels(VOXEL_CHUNK_VOLUME);
+	allVoxels[VoxelChunk::voxelIndex(1, 2, 3)].setType(statelessVoxelType);
+	chunk.copyFrom(allVoxels);
+	ASSERT_TRUE(chunk.compacted());
+	ASSERT_EQ(constChunk.at(1, 2, 3).toString(), "stateless");
+	ASSERT_EQ(constChunk.at(3, 3, 3).toString(), "empty");
+	
+	VoxelWorld world;
+	auto mutableChunk = world.mutableChunk({0, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+	mutableChunk.fill({0, 0, 0}, {2, 2, 2}, VoxelHolder(statelessVoxelType));
+	ASSERT_EQ(mutableChunk.dirtyLocations().size(), 3 * 3 * 3);
+	ASSERT_EQ(mutableChunk.pendingVoxelCount(), 4 * 4 * 4);
+	mutableChunk.clearDirtyLocations();
+	ASSERT_EQ(mutableChunk.replace(statelessVoxelType, testVoxelType), 3 * 3 * 3);
+	ASSERT_EQ(mutableChunk.dirtyLocations().size(), 3 * 3 * 3);
+	ASSERT_EQ(mutableChunk.at(2, 2, 2).toString(), "test");
+}
+
+TEST(VoxelWorld, typeProperties) {
+	AssetLoader assetLoader(".");
+	VoxelTypeRegistry registry(assetLoader);
+	auto &statelessVoxelType = registry.make<StatelessVoxelType>("stateless");
+	auto &testVoxelType = registry.make<TestVoxelType>("test");
+	ASSERT_TRUE(statelessVoxelType.properties().dynamic);
+	
+	registry.link();
+	ASSERT_TRUE(EmptyVoxelType::INSTANCE.properties().empty);
+	ASSERT_FALSE(statelessVoxelType.properties().dynamic);
+	ASSERT_FALSE(statelessVoxelType.properties().empty);
+	ASSERT_TRUE(testVoxelType.properties().dynamic);
+	ASSERT_EQ(statelessVoxelType.properties().priority, INT_MIN);
+	
+	VoxelHolder voxel(statelessVoxelType);
+	ASSERT_EQ(voxel.shaderProvider(), nullptr);
+	ASSERT_EQ(voxel.shaderProviderPriority(), INT_MIN);
+	ASSERT_FALSE(voxel.opaque());
+	ASSERT_TRUE(voxel.hasDensity());
+	ASSERT_EQ(voxel.typeLightLevel(), 0);
+	ASSERT_FALSE(voxel.empty());
+	ASSERT_TRUE(VoxelHolder().empty());
+	
+	auto &unknownVoxelType = registry.get("unknown");
+	ASSERT_FALSE(unknownVoxelType.properties().dynamic);
+	ASSERT_TRUE(VoxelHolder(unknownVoxelType).opaque());
+}
+
+TEST(VoxelWorld, occupancyMasks) {
+	AssetLoader assetLoader(".");
+	SimpleVoxelType opaqueVoxelType("opaque", assetLoader.load("dummy.png"));
+	StatelessVoxelType statelessVoxelType;
+	
+	VoxelChunk chunk({0, 0, 0});
+	ASSERT_EQ(chunk.emptyMask().count(), VOXEL_CHUNK_VOLUME);
+	ASSERT_EQ(chunk.densityMask().count(), VOXEL_CHUNK_VOLUME);
+	ASSERT_EQ(chunk.opaqueMask().count(), 0);
+	
+	chunk.fill({0, 0, 0}, {2, 2, 2}, VoxelHolder(opaqueVoxelType));
+	ASSERT_EQ(chunk.emptyMask().count(), VOXEL_CHUNK_VOLUME - 27);
+	ASSERT_EQ(chunk.opaqueMask().count(), 27);
+	ASSERT_TRUE(chunk.opaqueMask().test(VoxelChunk::voxelIndex(2, 2, 2)));
+	ASSERT_FALSE(chunk.opaqueMask().test(VoxelChunk::voxelIndex(3, 2, 2)));
+	auto interior = chunk.opaqueMask().interior();
+	ASSERT_EQ(interior.count(), 1);
+	ASSERT_TRUE(interior.test(VoxelChunk::voxelIndex(1, 1, 1)));
+	
+	chunk.at(1, 1, 1).setType(statelessVoxelType);
+	chunk.updateMasks({1, 1, 1});
+	ASSERT_FALSE(chunk.opaqueMask().test(VoxelChunk::voxelIndex(1, 1, 1)));
+	ASSERT_FALSE(chunk.emptyMask().test(VoxelChunk::voxelIndex(1, 1, 1)));
+	ASSERT_EQ(chunk.opaqueMask().interior().count(), 0);
+	
+	chunk.setUniform(VoxelHolder(opaqueVoxelType));
+	ASSERT_EQ(chunk.opaqueMask().count(), VOXEL_CHUNK_VOLUME);
+	ASSERT_EQ(chunk.opaqueMask().interior().count(), (VOXEL_CHUNK_SIZE - 2) * (VOXEL_CHUNK_SIZE - 2) * (VOXEL_CHUNK_SIZE - 2));
+	
+	VoxelWorld world;
+	{
+		auto mutableChunk = world.mutableChunk({0, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+		mutableChunk.at(2, 2, 2).setType(opaqueVoxelType);
+		mutableChunk.markDirty({2, 2, 2});
+	}
+	world.mutableChunk({1, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+	auto extendedChunk = world.extendedChunk({0, 0, 0});
+	ASSERT_TRUE(extendedChunk.extendedOpaque({2, 2, 2}));
+	ASSERT_FALSE(extendedChunk.extendedEmpty({2, 2, 2}));
+	ASSERT_FALSE(extendedChunk.extendedOpaque({VOXEL_CHUNK_SIZE, 2, 2}));
+	ASSERT_TRUE(extendedChunk.extendedEmpty({VOXEL_CHUNK_SIZE, 2, 2}));
+	ASSERT_TRUE(extendedChunk.extendedEmpty({-1, 2, 2}));
+	ASSERT_TRUE(extendedChunk.extendedHasDensity(-1, 2, 2));
+}
+
+TEST(VoxelWorld, heightmap) {
+	AssetLoader assetLoader(".");
+	SimpleVoxelType opaqueVoxelType("opaque", assetLoader.load("dummy.png"));
+	StatelessVoxelType statelessVoxelType;
+	
+	VoxelChunk chunk({0, 0, 0});
+	chunk.setUniform(VoxelHolder(statelessVoxelType));
+	ASSERT_EQ(chunk.heightmap()[VoxelChunk::columnIndex(3, 2)], -1);
+	
+	chunk.fill({0, 0, 0}, {VOXEL_CHUNK_SIZE - 1, 2, VOXEL_CHUNK_SIZE - 1}, VoxelHolder(opaqueVoxelType));
+	chunk.at(3, 3, 2).setType(opaqueVoxelType);
+	chunk.updateMasks({3, 3, 2});
+	ASSERT_EQ(chunk.heightmap()[VoxelChunk::columnIndex(3, 2)], 3);
+	ASSERT_EQ(chunk.heightmap()[VoxelChunk::columnIndex(2, 2)], 2);
+	
+	chunk.at(3, 3, 2).setType(statelessVoxelType);
+	chunk.updateMasks({3, 3, 2});
+	ASSERT_EQ(chunk.heightmap()[VoxelChunk::columnIndex(3, 2)], 2);
+	
+	chunk.setUniform(VoxelHolder(opaqueVoxelType));
+	ASSERT_EQ(chunk.heightmap()[VoxelChunk::columnIndex(0, 0)], VOXEL_CHUNK_SIZE - 1);
+}
+
+TEST(VoxelWorld, locationSet) {
+	VoxelChunkLocationSet set;
+	ASSERT_TRUE(set.empty());
+	ASSERT_TRUE(set.begin() == set.end());
+	ASSERT_TRUE(set.insert({VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1}));
+	ASSERT_TRUE(set.insert({1, 0, 0}));
+	ASSERT_TRUE(set.insert({1, 2, 3}));
+	ASSERT_FALSE(set.insert({1, 2, 3}));
+	ASSERT_EQ(set.size(), 3);
+	ASSERT_TRUE(set.contains({1, 2, 3}));
+	ASSERT_FALSE(set.contains({3, 2, 1}));
+	
+	std::vector<InChunkVoxelLocation> locations(set.begin(), set.end());
+	ASSERT_EQ(locations, std::vector<InChunkVoxelLocation>({
+			{1, 0, 0},
+			{1, 2, 3},
+			{VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1}
+	}));
+	
+	ASSERT_TRUE(set.erase({1, 0, 0}));
+	ASSERT_FALSE(set.erase({1, 0, 0}));
+	ASSERT_EQ(set.size(), 2);
+	ASSERT_EQ(*set.begin(), InChunkVoxelLocation(1, 2, 3));
+	set.clear();
+	ASSERT_TRUE(set.empty());
+	ASSERT_TRUE(set.begin() == set.end());
+}
+
 TEST(VoxelWorld, oneChunk) {
 	TestVoxelType testVoxelType;
 	VoxelWorld world;
@@ -216,6 +561,18 @@ TEST(VoxelWorld, oneChunk) {
 		ASSERT_EQ(chunk.at(0, 0, 0).toString(), "test");
 		ASSERT_EQ(chunk.at(0, 0, 1).toString(), "empty");
 	}
+	
+	{
+		auto chunk = world.mutableChunk({0, 0, 0});
+		ASSERT_TRUE(chunk.compact());
+	}
+	
+	{
+		auto chunk = world.chunk({0, 0, 0});
+		ASSERT_EQ(chunk.at(0, 0, 0).toString(), "test");
+		ASSERT_EQ(chunk.at(0, 0, 1).toString(), "empty");
+		ASSERT_TRUE(chunk.compacted());
+	}
 }
 
 TEST(VoxelWorld, twoChunks) {
@@ -228,7 +585,7 @@ TEST(VoxelWorld, twoChunks) {
 		auto chunk = world.mutableChunk({0, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
 		ASSERT_TRUE(chunk);
 		ASSERT_FALSE(chunk.hasNeighbor(1, 0, 0));
-		ASSERT_EQ(chunk.extendedAt(16, 0, 0).toString(), "empty");
+		ASSERT_EQ(chunk.extendedAt(VOXEL_CHUNK_SIZE, 0, 0).toString(), "empty");
 		
 		ASSERT_EQ(chunk.extendedAt(0, 0, 0).toString(), "empty");
 		chunk.at(0, 0, 0).setType(testVoxelType);
@@ -240,8 +597,8 @@ TEST(VoxelWorld, twoChunks) {
 		auto chunk = world.mutableChunk({1, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
 		ASSERT_TRUE(chunk);
 		ASSERT_TRUE(chunk.hasNeighbor(-1, 0, 0));
-		ASSERT_EQ(chunk.extendedAt(-16, 0, 0).toString(), "test");
-		ASSERT_EQ(chunk.extendedAt(-15, 0, 0).toString(), "empty");
+		ASSERT_EQ(chunk.extendedAt(-VOXEL_CHUNK_SIZE, 0, 0).toString(), "test");
+		ASSERT_EQ(chunk.extendedAt(-VOXEL_CHUNK_SIZE + 1, 0, 0).toString(), "empty");
 		ASSERT_EQ(chunk.at(0, 0, 0).toString(), "empty");
 		chunk.at(0, 0, 0).setType(testVoxelType);
 		ASSERT_EQ(chunk.extendedAt(0, 0, 0).toString(), "test");
@@ -251,17 +608,17 @@ TEST(VoxelWorld, twoChunks) {
 		auto chunk = world.extendedChunk({0, 0, 0});
 		ASSERT_TRUE(chunk);
 		ASSERT_TRUE(chunk.hasNeighbor(1, 0, 0));
-		ASSERT_EQ(chunk.extendedAt(16, 0, 0).toString(), "test");
+		ASSERT_EQ(chunk.extendedAt(VOXEL_CHUNK_SIZE, 0, 0).toString(), "test");
 	}
 	
 	{
 		auto chunk = world.extendedMutableChunk({0, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
 		ASSERT_TRUE(chunk);
 		ASSERT_TRUE(chunk.hasNeighbor(1, 0, 0));
-		ASSERT_EQ(chunk.extendedAt(16, 0, 0).toString(), "test");
-		ASSERT_EQ(chunk.extendedAt(16, 1, 0).toString(), "empty");
-		chunk.extendedAt(16, 1, 0).setType(testVoxelType);
-		ASSERT_EQ(chunk.extendedAt(16, 1, 0).toString(), "test");
+		ASSERT_EQ(chunk.extendedAt(VOXEL_CHUNK_SIZE, 0, 0).toString(), "test");
+		ASSERT_EQ(chunk.extendedAt(VOXEL_CHUNK_SIZE, 1, 0).toString(), "empty");
+		chunk.extendedAt(VOXEL_CHUNK_SIZE, 1, 0).setType(testVoxelType);
+		ASSERT_EQ(chunk.extendedAt(VOXEL_CHUNK_SIZE, 1, 0).toString(), "test");
 	}
 	
 	{
@@ -271,4 +628,605 @@ TEST(VoxelWorld, twoChunks) {
 		ASSERT_EQ(chunk.at(0, 1, 0).toString(), "test");
 		ASSERT_EQ(chunk.at(0, 2, 0).toString(), "empty");
 	}
+	
+	{
+		auto chunk = world.mutableChunk({1, 0, 0});
+		ASSERT_TRUE(chunk.compact());
+	}
+	
+	{
+		// Reading a neighbor through a shared extended ref must not expand it
+		auto chunk = world.extendedChunk({0, 0, 0});
+		ASSERT_EQ(chunk.extendedAt(VOXEL_CHUNK_SIZE, 1, 0).toString(), "test");
+		ASSERT_EQ(chunk.extendedAt(VOXEL_CHUNK_SIZE, 2, 0).toString(), "empty");
+	}
+	ASSERT_TRUE(world.chunk({1, 0, 0}).compacted());
+}
+
+TEST(VoxelWorld, chunkPool) {
+	TestVoxelType testVoxelType;
+	VoxelWorld world;
+	world.setChunkPoolCapacity(1);
+	
+	{
+		auto chunk = world.mutableChunk({0, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+		chunk.at(1, 2, 3).setType(testVoxelType);
+		chunk.markDirty({1, 2, 3});
+		chunk.setLight(1, 2, 3, VoxelLight(0, 5));
+		chunk.setLightState(VoxelChunkLightState::COMPLETE);
+	}
+	world.mutableChunk({1, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+	auto stats = world.chunkPoolStats();
+	ASSERT_EQ(stats.hits, 0);
+	ASSERT_EQ(stats.misses, 2);
+	
+	world.unloadChunks({{0, 0, 0}, {1, 0, 0}});
+	ASSERT_EQ(world.chunkCount(), 0);
+	stats = world.chunkPoolStats();
+	ASSERT_EQ(stats.pooledChunks, 1);
+	ASSERT_EQ(stats.discarded, 1);
+	ASSERT_GT(stats.residentBytes, sizeof(SharedVoxelChunk));
+	
+	world.mutableChunk({5, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+	{
+		auto chunk = world.mutableChunk({5, 0, 1}, VoxelWorld::MissingChunkPolicy::CREATE);
+		ASSERT_EQ(chunk.location(), VoxelChunkLocation(5, 0, 1));
+		ASSERT_TRUE(chunk.uniform());
+		ASSERT_EQ(chunk.at(1, 2, 3).toString(), "empty");
+		ASSERT_TRUE(chunk.lightUniform());
+		ASSERT_EQ(chunk.light(1, 2, 3), VoxelLight::fullSky());
+		ASSERT_EQ(chunk.pendingVoxelCount(), 0);
+		ASSERT_TRUE(chunk.dirtyLocations().empty());
+		ASSERT_TRUE(chunk.emptyMask().test(VoxelChunk::voxelIndex(1, 2, 3)));
+		ASSERT_EQ(chunk.lightState(), VoxelChunkLightState::PENDING_INITIAL);
+		ASSERT_TRUE(chunk.hasNeighbor(0, 0, -1));
+		ASSERT_FALSE(chunk.hasNeighbor(1, 0, 0));
+	}
+	stats = world.chunkPoolStats();
+	ASSERT_EQ(stats.hits, 1);
+	ASSERT_EQ(stats.misses, 3);
+	ASSERT_EQ(stats.pooledChunks, 0);
+	ASSERT_EQ(stats.residentBytes, 0);
+}
+
+TEST(VoxelWorld, concurrentLookups) {
+	VoxelWorld world;
+	std::atomic<bool> failed = false;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&world, &failed, t]() {
+			for (int i = 0; i < 2000; i++) {
+				VoxelChunkLocation location(i % 4, (i / 4) % 4, t % 2);
+				switch ((i + t) % 3) {
+					case 0: {
+						auto chunk = world.extendedMutableChunk(location, VoxelWorld::MissingChunkPolicy::CREATE);
+						if (!chunk || chunk.location() != location) failed = true;
+						break;
+					}
+					case 1: {
+						auto chunk = world.extendedChunk(location);
+						if (chunk && chunk.location() != location) failed = true;
+						break;
+					}
+					case 2:
+						world.unloadChunks({location});
+						break;
+				}
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	ASSERT_FALSE(failed);
+	size_t count = 0;
+	world.forEachChunkLocation([&count](const VoxelChunkLocation &location) {
+		count++;
+	});
+	ASSERT_EQ(count, world.chunkCount());
+}
+
+TEST(VoxelWorld, overlappingExtendedRefs) {
+	// Refs centered on neighboring chunks lock overlapping sets of chunks, a wrong lock order deadlocks here
+	static const int GRID_SIZE = 3;
+	VoxelWorld world;
+	long counters[GRID_SIZE][GRID_SIZE][GRID_SIZE] = {};
+	for (int z = 0; z < GRID_SIZE; z++) {
+		for (int y = 0; y < GRID_SIZE; y++) {
+			for (int x = 0; x < GRID_SIZE; x++) {
+				world.chunk({x, y, z}, VoxelWorld::MissingChunkPolicy::CREATE);
+			}
+		}
+	}
+	std::atomic<long> expected = 0;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 8; t++) {
+		threads.emplace_back([&world, &counters, &expected, t]() {
+			std::default_random_engine engine(t);
+			std::uniform_int_distribution<int> coordinate(0, GRID_SIZE - 1);
+			long increments = 0;
+			for (int i = 0; i < 3000; i++) {
+				VoxelChunkLocation location(coordinate(engine), coordinate(engine), coordinate(engine));
+				switch (engine() % 4) {
+					case 0: {
+						auto chunk = world.extendedMutableChunk(location);
+						for (int dz = -1; dz <= 1; dz++) {
+							for (int dy = -1; dy <= 1; dy++) {
+								for (int dx = -1; dx <= 1; dx++) {
+									if ((dx != 0 || dy != 0 || dz != 0) && !chunk.hasNeighbor(dx, dy, dz)) continue;
+									counters[location.z + dz][location.y + dy][location.x + dx]++;
+									increments++;
+								}
+							}
+						}
+						break;
+					}
+					case 1: {
+						auto chunk = world.mutableChunk(location);
+						counters[location.z][location.y][location.x]++;
+						increments++;
+						break;
+					}
+					case 2:
+						world.extendedChunk(location);
+						break;
+					case 3:
+						world.chunk(location);
+						break;
+				}
+			}
+			expected += increments;
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	long total = 0;
+	for (auto &plane : counters) {
+		for (auto &row : plane) {
+			for (auto counter : row) {
+				total += counter;
+			}
+		}
+	}
+	ASSERT_EQ(total, expected);
+}
+
+TEST(VoxelWorld, versionedSnapshot) {
+	struct Loader: public VoxelChunkLoader {
+		std::vector<VoxelChunkLocation> stored;
+		
+		void load(VoxelChunkMutableRef &chunk) override {
+		}
+		
+		void loadAsync(VoxelWorld &world, const VoxelChunkLocation &location) override {
+		}
+		
+		void cancelLoadAsync(VoxelWorld &world, const VoxelChunkLocation &location) override {
+		}
+		
+		void storeChunkAsync(VoxelWorld &world, const VoxelChunkLocation &location) override {
+			stored.emplace_back(location);
+		}
+		
+	} loader;
+	
+	TestVoxelType testVoxelType;
+	VoxelWorld world;
+	world.setChunkLoader(&loader);
+	world.mutableChunk({1, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+	unsigned long version;
+	{
+		auto chunk = world.mutableChunk({0, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+		ASSERT_EQ(chunk.version() % 2, 1);
+		chunk.at(1, 2, 3).setType(testVoxelType);
+		chunk.markDirty({1, 2, 3});
+		chunk.setUpdatedAt(1);
+	}
+	
+	VoxelChunkSnapshot snapshot;
+	{
+		auto chunk = world.chunk({0, 0, 0});
+		snapshot = chunk.snapshot();
+		version = snapshot.version();
+		ASSERT_EQ(version % 2, 0);
+		ASSERT_EQ(version, chunk.version());
+		// Unmodified chunk shares the copy
+		ASSERT_EQ(&*chunk.snapshot(), &*snapshot);
+	}
+	ASSERT_EQ(snapshot->location(), VoxelChunkLocation(0, 0, 0));
+	ASSERT_EQ(snapshot->at(1, 2, 3).toString(), "test");
+	ASSERT_EQ(snapshot->at(1, 2, 2).toString(), "empty");
+	ASSERT_FALSE(snapshot->emptyMask().test(VoxelChunk::voxelIndex(1, 2, 3)));
+	
+	world.unloadChunks({{0, 0, 0}});
+	ASSERT_EQ(loader.stored.size(), 1);
+	
+	// Modified and unloaded again while the snapshot was being stored
+	{
+		auto chunk = world.mutableChunk({0, 0, 0});
+		chunk.at(1, 2, 3).setType(EmptyVoxelType::INSTANCE);
+		chunk.setUpdatedAt(2);
+		ASSERT_EQ(chunk.snapshot()->at(1, 2, 3).toString(), "empty");
+	}
+	ASSERT_EQ(snapshot->at(1, 2, 3).toString(), "test");
+	ASSERT_NE(&*world.chunk({0, 0, 0}).snapshot(), &*snapshot);
+	world.unloadChunks({{0, 0, 0}});
+	ASSERT_EQ(loader.stored.size(), 2);
+	ASSERT_FALSE(world.chunkStored({0, 0, 0}, version));
+	ASSERT_EQ(world.chunkCount(), 2);
+	version = world.chunk({0, 0, 0}).version();
+	ASSERT_TRUE(world.chunkStored({0, 0, 0}, version));
+	ASSERT_EQ(world.chunkCount(), 1);
+}
+
+TEST(VoxelWorld, batchAcquire) {
+	VoxelWorld world;
+	for (int x = 0; x < 3; x++) {
+		world.chunk({x, 0, 1}, VoxelWorld::MissingChunkPolicy::CREATE);
+		world.chunk({x, 1, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+	}
+	
+	std::vector<VoxelChunkLocation> locations = {{2, 0, 1}, {7, 7, 7}, {0, 1, 0}, {1, 0, 1}, {2, 0, 1}};
+	{
+		auto refs = world.acquire(locations);
+		ASSERT_EQ(refs.size(), 3);
+		ASSERT_EQ(refs[0].location(), VoxelChunkLocation(0, 1, 0));
+		ASSERT_EQ(refs[1].location(), VoxelChunkLocation(1, 0, 1));
+		ASSERT_EQ(refs[2].location(), VoxelChunkLocation(2, 0, 1));
+	}
+	
+	std::vector<VoxelChunkLocation> visited;
+	world.forEachChunk<VoxelChunkExtendedMutableRef>(locations, [&visited](VoxelChunkExtendedMutableRef &chunk) {
+		visited.emplace_back(chunk.location());
+	});
+	ASSERT_EQ(visited.size(), 3);
+	ASSERT_TRUE(std::is_sorted(visited.begin(), visited.end()));
+	
+	visited.clear();
+	world.forEachInBox<VoxelChunkRef>({1, 0, 0}, {2, 1, 1}, [&visited](VoxelChunkRef &chunk) {
+		visited.emplace_back(chunk.location());
+	});
+	std::vector<VoxelChunkLocation> expected = {{1, 1, 0}, {2, 1, 0}, {1, 0, 1}, {2, 0, 1}};
+	ASSERT_EQ(visited, expected);
+}
+
+TEST(VoxelWorld, regionQueries) {
+	VoxelWorld world;
+	// Spans negative and positive regions
+	for (int z = -9; z <= 9; z += 3) {
+		for (int y = -1; y <= 1; y++) {
+			for (int x = -9; x <= 9; x += 3) {
+				world.chunk({x, y, z}, VoxelWorld::MissingChunkPolicy::CREATE);
+			}
+		}
+	}
+	std::vector<VoxelChunkLocation> all;
+	world.forEachChunkLocation([&all](const VoxelChunkLocation &location) {
+		all.emplace_back(location);
+	});
+	ASSERT_EQ(all.size(), world.chunkCount());
+	
+	VoxelChunkBox box = {{-4, 0, -3}, {6, 1, 9}};
+	std::vector<VoxelChunkLocation> inBox;
+	world.forEachChunkLocationInBox(box, [&inBox](const VoxelChunkLocation &location) {
+		inBox.emplace_back(location);
+	});
+	std::vector<VoxelChunkLocation> expected;
+	for (auto &location : all) {
+		if (box.contains(location)) {
+			expected.emplace_back(location);
+		}
+	}
+	std::sort(inBox.begin(), inBox.end());
+	std::sort(expected.begin(), expected.end());
+	ASSERT_EQ(inBox, expected);
+	
+	size_t inRadius = 0;
+	world.forEachChunkLocationInRadius({0, 0, 0}, 3, [&inRadius](const VoxelChunkLocation &location) {
+		ASSERT_LE(location.x * location.x + location.y * location.y + location.z * location.z, 9);
+		inRadius++;
+	});
+	// The origin, its vertical neighbors and the four chunks 3 away on the X and Z axes
+	ASSERT_EQ(inRadius, 7);
+	
+	std::vector<VoxelChunkBox> kept = {VoxelChunkBox::around({0, 0, 0}, 3), {{9, -1, 9}, {9, 1, 9}}};
+	std::vector<VoxelChunkLocation> outside;
+	world.forEachChunkLocationOutside(kept, [&outside](const VoxelChunkLocation &location) {
+		outside.emplace_back(location);
+	});
+	ASSERT_EQ(outside.size(), all.size() - 3 * 3 * 3 - 3);
+	for (auto &location : outside) {
+		for (auto &keptBox : kept) {
+			ASSERT_FALSE(keptBox.contains(location));
+		}
+	}
+	
+	world.unloadChunks(outside);
+	ASSERT_EQ(world.chunkCount(), 3 * 3 * 3 + 3);
+	size_t remaining = 0;
+	world.forEachChunkLocation([&remaining](const VoxelChunkLocation &location) {
+		remaining++;
+	});
+	ASSERT_EQ(remaining, world.chunkCount());
+}
+
+TEST(VoxelWorld, chunkRequests) {
+	VoxelWorld world;
+	int owner, otherOwner;
+	std::vector<VoxelChunkLocation> completed;
+	auto callback = [&completed](const VoxelChunkLocation &location) {
+		completed.emplace_back(location);
+	};
+	VoxelChunkLocation location(0, 0, 0);
+	world.requestChunk(location, VoxelChunkLightState::READY, &owner, callback);
+	world.mutableChunk(location, VoxelWorld::MissingChunkPolicy::CREATE).setLightState(VoxelChunkLightState::READY);
+	ASSERT_TRUE(completed.empty());
+	
+	// Completes only once the last neighbor is loaded
+	for (int dz = -1; dz <= 1; dz++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				if (dx == 0 && dy == 0 && dz == 0) continue;
+				ASSERT_TRUE(completed.empty());
+				world.chunk({dx, dy, dz}, VoxelWorld::MissingChunkPolicy::CREATE);
+			}
+		}
+	}
+	ASSERT_EQ(completed, std::vector<VoxelChunkLocation>({location}));
+	
+	// A ready chunk completes right away
+	world.requestChunk(location, VoxelChunkLightState::COMPLETE, &owner, callback);
+	ASSERT_EQ(completed.size(), 2);
+	
+	// A repeated request of the same owner replaces the earlier one, requests of other owners are kept
+	int replacedCount = 0;
+	VoxelChunkLocation neighbor(1, 0, 0);
+	world.requestChunk(neighbor, VoxelChunkLightState::READY, &owner, [&replacedCount](auto&) {
+		replacedCount++;
+	});
+	world.requestChunk(neighbor, VoxelChunkLightState::READY, &owner, callback);
+	world.requestChunk(neighbor, VoxelChunkLightState::READY, &otherOwner, callback);
+	VoxelChunkLocation cancelled(-1, 0, 0);
+	world.requestChunk(cancelled, VoxelChunkLightState::READY, &owner, callback);
+	world.cancelChunkRequests(&owner);
+	world.requestChunk(neighbor, VoxelChunkLightState::READY, &owner, callback);
+	for (int dz = -1; dz <= 1; dz++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -2; dx <= 2; dx++) {
+				world.mutableChunk({dx, dy, dz}, VoxelWorld::MissingChunkPolicy::CREATE).setLightState(
+						VoxelChunkLightState::READY
+				);
+			}
+		}
+	}
+	ASSERT_EQ(replacedCount, 0);
+	ASSERT_EQ(std::count(completed.begin(), completed.end(), neighbor), 2);
+	ASSERT_EQ(std::count(completed.begin(), completed.end(), cancelled), 0);
+	
+	// Light invalidation holds a request back until the chunk is lit again
+	world.mutableChunk(location).setLightState(VoxelChunkLightState::PENDING_INCREMENTAL);
+	world.requestChunk(location, VoxelChunkLightState::READY, &owner, callback);
+	ASSERT_EQ(completed.size(), 4);
+	world.mutableChunk(location).setLightState(VoxelChunkLightState::READY);
+	ASSERT_EQ(completed.size(), 5);
+}
+
+TEST(VoxelWorld, recreatedChunkRequests) {
+	VoxelWorld world;
+	// Freshly allocated chunks count versions from zero, below the versions of the erased one
+	world.setChunkPoolCapacity(0);
+	int owner;
+	std::vector<VoxelChunkLocation> completed;
+	auto callback = [&completed](const VoxelChunkLocation &location) {
+		completed.emplace_back(location);
+	};
+	VoxelChunkLocation location(0, 0, 0);
+	VoxelChunkLocation neighbor(1, 0, 0);
+	for (int dz = -1; dz <= 1; dz++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 2; dx++) {
+				world.chunk({dx, dy, dz}, VoxelWorld::MissingChunkPolicy::CREATE);
+			}
+		}
+	}
+	for (int i = 0; i < 10; i++) {
+		world.mutableChunk(neighbor).setLightState(VoxelChunkLightState::READY);
+	}
+	
+	// The neighbor is re-created between its unlock and the report of its old light state
+	world.requestChunk(location, VoxelChunkLightState::READY, &owner, [&](const VoxelChunkLocation &location) {
+		callback(location);
+		world.unloadChunks({neighbor});
+		world.chunk(neighbor, VoxelWorld::MissingChunkPolicy::CREATE);
+		world.requestChunk(neighbor, VoxelChunkLightState::READY, &owner, callback);
+	});
+	world.extendedMutableChunk(location).setLightState(VoxelChunkLightState::READY);
+	ASSERT_EQ(completed, std::vector<VoxelChunkLocation>({location}));
+	
+	world.mutableChunk(neighbor).setLightState(VoxelChunkLightState::READY);
+	ASSERT_EQ(completed, std::vector<VoxelChunkLocation>({location, neighbor}));
+}
+
+TEST(VoxelWorld, chunkEvents) {
+	struct Listener: public VoxelChunkListener {
+		std::mutex mutex;
+		std::condition_variable condVar;
+		std::vector<std::vector<VoxelChunkEvent>> batches;
+		bool blocked = true;
+		
+		void chunkEvents(std::span<const VoxelChunkEvent> events) override {
+			std::unique_lock<std::mutex> lock(mutex);
+			batches.emplace_back(events.begin(), events.end());
+			condVar.notify_all();
+			// Holding the first batch lets everything posted meanwhile coalesce into the next one
+			condVar.wait(lock, [this] {
+				return !blocked;
+			});
+		}
+	} listener;
+	VoxelWorld world(&listener);
+	VoxelChunkLocation first(0, 0, 0), pending(5, 0, 0), lit(9, 0, 0);
+	world.chunk(first, VoxelWorld::MissingChunkPolicy::CREATE);
+	{
+		std::unique_lock<std::mutex> lock(listener.mutex);
+		listener.condVar.wait(lock, [&listener] {
+			return !listener.batches.empty();
+		});
+	}
+	for (int i = 0; i < 100; i++) {
+		world.chunk(pending, VoxelWorld::MissingChunkPolicy::CREATE);
+	}
+	world.mutableChunk(lit, VoxelWorld::MissingChunkPolicy::CREATE).setLightState(VoxelChunkLightState::READY);
+	for (int i = 0; i < 10; i++) {
+		world.chunk(lit);
+	}
+	{
+		std::unique_lock<std::mutex> lock(listener.mutex);
+		listener.blocked = false;
+		listener.condVar.notify_all();
+		listener.condVar.wait(lock, [&listener] {
+			return listener.batches.size() == 2;
+		});
+	}
+	world.shutdownChunkEvents();
+	
+	ASSERT_EQ(listener.batches[0].size(), 1);
+	ASSERT_EQ(listener.batches[0][0].location, first);
+	ASSERT_EQ(listener.batches[0][0].types, VoxelChunkEvent::LIGHT_PENDING);
+	ASSERT_EQ(listener.batches[0][0].lightState, VoxelChunkLightState::PENDING_INITIAL);
+	auto &batch = listener.batches[1];
+	ASSERT_EQ(batch.size(), 2);
+	ASSERT_EQ(batch[0].location, pending);
+	ASSERT_EQ(batch[0].types, VoxelChunkEvent::LIGHT_PENDING);
+	ASSERT_EQ(batch[1].location, lit);
+	ASSERT_EQ(batch[1].types, VoxelChunkEvent::LIGHT_READY);
+	ASSERT_EQ(batch[1].lightState, VoxelChunkLightState::COMPLETE);
+	ASSERT_EQ(listener.batches.size(), 2);
+}
+
+TEST(VoxelWorld, residency) {
+	VoxelWorld world;
+	for (int x = 0; x < 10; x++) {
+		world.chunk({x, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+	}
+	auto chunkBytes = sizeof(SharedVoxelChunk) + world.chunk({0, 0, 0}).memoryUsage();
+	VoxelChunkResidency residency(world, 3 * chunkBytes);
+	auto ticket = residency.addTicket({{0, 0, 0}, {2, 0, 0}});
+	
+	// Seven chunks lose their ticket, three of them fit the warm budget
+	ASSERT_EQ(residency.update().size(), 4);
+	ASSERT_EQ(world.chunkCount(), 6);
+	auto stats = residency.stats();
+	ASSERT_EQ(stats.resident, 6);
+	ASSERT_EQ(stats.warm, 3);
+	ASSERT_EQ(stats.warmBytes, 3 * chunkBytes);
+	ASSERT_EQ(stats.evicting, 0);
+	
+	// Warm chunks get their ticket back without being reloaded
+	residency.moveTicket(ticket, {{0, 0, 0}, {9, 0, 0}});
+	ASSERT_TRUE(residency.update().empty());
+	ASSERT_EQ(residency.stats().warm, 0);
+	ASSERT_EQ(world.chunkCount(), 6);
+	
+	residency.removeTicket(ticket);
+	ASSERT_EQ(residency.update().size(), 3);
+	ASSERT_EQ(world.chunkCount(), 3);
+	ASSERT_EQ(residency.stats().warm, 3);
+}
+
+TEST(VoxelWorld, neighborCompleteness) {
+	VoxelWorld world;
+	for (int z = -1; z <= 1; z++) {
+		for (int y = -1; y <= 1; y++) {
+			for (int x = -1; x <= 2; x++) {
+				world.chunk({x, y, z}, VoxelWorld::MissingChunkPolicy::CREATE);
+			}
+		}
+	}
+	ASSERT_EQ(world.completeChunkCount(), 2);
+	ASSERT_EQ(world.chunk({0, 0, 0}).neighborCount(), 26);
+	ASSERT_EQ(world.chunk({-1, -1, -1}).neighborCount(), 7);
+	
+	// Only chunks with complete light are updatable
+	std::vector<VoxelChunkLocation> updatable;
+	world.updatableChunkLocations(updatable);
+	ASSERT_TRUE(updatable.empty());
+	world.mutableChunk({0, 0, 0}).setLightState(VoxelChunkLightState::COMPLETE);
+	world.updatableChunkLocations(updatable);
+	ASSERT_EQ(updatable, std::vector<VoxelChunkLocation>({{0, 0, 0}}));
+	
+	world.unloadChunks({{-1, 1, 1}});
+	ASSERT_EQ(world.chunk({0, 0, 0}).neighborCount(), 25);
+	ASSERT_EQ(world.completeChunkCount(), 1);
+	updatable.clear();
+	world.updatableChunkLocations(updatable);
+	ASSERT_TRUE(updatable.empty());
+	
+	world.chunk({-1, 1, 1}, VoxelWorld::MissingChunkPolicy::CREATE);
+	ASSERT_EQ(world.completeChunkCount(), 2);
+}
+
+TEST(VoxelWorld, neighborhood) {
+	AssetLoader assetLoader(".");
+	SimpleVoxelType opaqueVoxelType("opaque", assetLoader.load("dummy.png"));
+	StatelessVoxelType statelessVoxelType;
+	VoxelWorld world;
+	
+	{
+		auto chunk = world.mutableChunk({0, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+		chunk.at(VOXEL_CHUNK_SIZE - 1, 2, 1).setType(opaqueVoxelType);
+		chunk.markDirty({VOXEL_CHUNK_SIZE - 1, 2, 1});
+		chunk.setLight({VOXEL_CHUNK_SIZE - 1, 2, 2}, VoxelLight(0, 7));
+	}
+	{
+		auto chunk = world.mutableChunk({1, 0, 0}, VoxelWorld::MissingChunkPolicy::CREATE);
+		chunk.at(0, 2, 1).setType(statelessVoxelType);
+		chunk.markDirty({0, 2, 1});
+		chunk.setLight({0, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1}, VoxelLight(2, 0));
+	}
+	
+	auto chunk = world.extendedChunk({0, 0, 0});
+	VoxelChunkNeighborhood neighborhood;
+	ASSERT_FALSE(neighborhood.valid());
+	neighborhood.build(chunk);
+	ASSERT_TRUE(neighborhood.valid());
+	
+	auto i = VoxelChunkNeighborhood::index(VOXEL_CHUNK_SIZE - 1, 2, 1);
+	ASSERT_EQ(neighborhood[i].voxel->toString(), "opaque");
+	ASSERT_TRUE(neighborhood[i].opaque());
+	ASSERT_FALSE(neighborhood[i].empty());
+	ASSERT_GE(neighborhood[i].priority, MAX_VOXEL_SHADER_PRIORITY);
+	ASSERT_EQ(neighborhood[i].light, VoxelLight::fullSky());
+	ASSERT_EQ(neighborhood[i + VoxelChunkNeighborhood::offset(0, 0, 1)].light, VoxelLight(0, 7));
+	
+	auto &next = neighborhood[i + VoxelChunkNeighborhood::offset(1, 0, 0)];
+	ASSERT_EQ(next.voxel->toString(), "stateless");
+	ASSERT_FALSE(next.empty());
+	ASSERT_FALSE(next.opaque());
+	ASSERT_EQ(neighborhood.at(VOXEL_CHUNK_SIZE, VOXEL_CHUNK_SIZE - 1, VOXEL_CHUNK_SIZE - 1).light, VoxelLight(2, 0));
+	
+	// Missing neighbors look like the empty voxel returned by extendedAt()
+	auto &missing = neighborhood.at(-1, 2, 1);
+	ASSERT_EQ(missing.voxel->toString(), "empty");
+	ASSERT_TRUE(missing.empty());
+	ASSERT_TRUE(missing.hasDensity());
+	ASSERT_EQ(missing.light, VoxelLight::fullSky());
+	
+	for (int z = -1; z <= VOXEL_CHUNK_SIZE; z++) {
+		for (int y = -1; y <= VOXEL_CHUNK_SIZE; y++) {
+			for (int x = -1; x <= VOXEL_CHUNK_SIZE; x++) {
+				auto &entry = neighborhood.at(x, y, z);
+				ASSERT_EQ(entry.voxel->toString(), chunk.extendedAt(x, y, z).toString());
+				ASSERT_EQ(entry.light, chunk.extendedLight({x, y, z}));
+				ASSERT_EQ(entry.empty(), chunk.extendedEmpty({x, y, z}));
+				ASSERT_EQ(entry.opaque(), chunk.extendedOpaque({x, y, z}));
+			}
+		}
+	}
+	
+	chunk.attachNeighborhood(&neighborhood);
+	ASSERT_EQ(&chunk.extendedAt(VOXEL_CHUNK_SIZE, 2, 1), next.voxel);
+	ASSERT_EQ(chunk.extendedLightLevel(-1, 0, 0), MAX_VOXEL_LIGHT_LEVEL);
+	ASSERT_EQ(chunk.extendedAt(VOXEL_CHUNK_SIZE + 2, 2, 1).toString(), "empty");
 }